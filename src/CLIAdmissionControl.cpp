@@ -0,0 +1,160 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+#include "CLIAdmissionControl.h"
+#include "CLIOutput.h"
+
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+/**
+ * Read MemAvailable from /proc/meminfo
+ */
+long host_available_memory() {
+#ifdef __linux__
+	ifstream f( "/proc/meminfo" );
+	string line, key;
+	long value;
+	while (getline(f, line)) {
+		istringstream iss( line );
+		if (!(iss >> key >> value)) continue;
+		if (key.compare("MemAvailable:") == 0)
+			return value / 1024;
+	}
+#endif
+	return -1;
+}
+
+/**
+ * Count the processors in /proc/cpuinfo
+ */
+int host_cpu_count() {
+	int cpus = 0;
+#ifdef __linux__
+	ifstream f( "/proc/cpuinfo" );
+	string line;
+	while (getline(f, line)) {
+		if (line.compare(0, 9, "processor") == 0)
+			cpus++;
+	}
+#endif
+	if (cpus == 0) {
+		cpus = boost::thread::hardware_concurrency();
+		if (cpus == 0) cpus = 1;
+	}
+	return cpus;
+}
+
+/**
+ * Constructor
+ */
+CLIAdmissionControl::CLIAdmissionControl( double overcommit, int usedCpus )
+	: overcommit(overcommit), hostCpus(host_cpu_count()), usedCpus(usedCpus),
+	  pendingRam(0), pendingStarts(0), nextTicket(0), servingTicket(0) { }
+
+/**
+ * Check if the VM fits in the resources we have right now
+ */
+bool CLIAdmissionControl::fits( int ram, int cpus ) {
+	// Check cores
+	if (usedCpus + cpus > hostCpus * overcommit)
+		return false;
+
+	// Check memory. The VMs we are still starting might not have
+	// allocated their memory yet, so account for them separately.
+	long freeRam = host_available_memory();
+	if (freeRam < 0)
+		return true;
+	return (pendingRam + ram <= freeRam * overcommit);
+}
+
+/**
+ * Serve the next ticket, skipping the ones given up
+ */
+void CLIAdmissionControl::advance() {
+	servingTicket++;
+	while (abandoned.erase( servingTicket ) > 0)
+		servingTicket++;
+	cond.notify_all();
+}
+
+/**
+ * Wait for our turn and for enough resources
+ */
+bool CLIAdmissionControl::acquire( const string& name, int ram, int cpus, const CLIDeadline& deadline ) {
+	boost::mutex::scoped_lock lock(mutex);
+	unsigned long ticket = nextTicket++;
+	bool notified = false;
+
+	while (true) {
+		if (ticket == servingTicket) {
+			if (fits(ram, cpus))
+				break;
+
+			// If nothing else is starting, waiting will not free anything,
+			// so fall back to starting one VM at a time.
+			if (pendingStarts == 0) {
+				CLIOutputLine(CLI_STDERR) << "[warn] " << name << ": Not enough free resources on the host, starting anyway";
+				break;
+			}
+
+			if (!notified) {
+				CLIOutputLine(CLI_STDERR) << "[wait] " << name << ": Waiting for host resources (" << ram << " MB, " << cpus << " CPUs)";
+				notified = true;
+			}
+		}
+
+		// Give up our place in the queue if we ran out of time
+		if (CLICancel::requested() || deadline.expired()) {
+			if (ticket == servingTicket) {
+				advance();
+			} else {
+				abandoned.insert( ticket );
+			}
+			return false;
+		}
+
+		// Wait for a start to complete (or re-check memory in a while)
+		cond.timed_wait( lock, boost::posix_time::seconds(1) );
+	}
+
+	// Reserve resources
+	pendingRam += ram;
+	pendingStarts++;
+	usedCpus += cpus;
+	advance();
+	return true;
+}
+
+/**
+ * Release the reservation
+ */
+void CLIAdmissionControl::release( int ram, int cpus, bool started ) {
+	boost::mutex::scoped_lock lock(mutex);
+	pendingRam -= ram;
+	pendingStarts--;
+	if (!started)
+		usedCpus -= cpus;
+	cond.notify_all();
+}
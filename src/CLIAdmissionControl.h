@@ -0,0 +1,92 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+#pragma once
+#ifndef CLI_ADMISSION_CONTROL_H
+#define CLI_ADMISSION_CONTROL_H
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <set>
+#include <string>
+
+#include "CLICancel.h"
+
+using namespace std;
+
+/**
+ * Return the memory (in MB) available on the host, or -1 if unknown
+ */
+long host_available_memory();
+
+/**
+ * Return the number of CPU cores on the host
+ */
+int host_cpu_count();
+
+/**
+ * Admission control for starting many VMs concurrently
+ *
+ * A VM is admitted only if the host has enough free memory and cores
+ * for it (multiplied by the over-commit ratio). The rest are queued
+ * in FIFO order until the VMs being started complete.
+ */
+class CLIAdmissionControl {
+public:
+
+	/**
+	 * Create an admission controller, given the over-commit ratio and
+	 * the number of CPUs already used by the running VMs.
+	 */
+	CLIAdmissionControl( double overcommit, int usedCpus );
+
+	/**
+	 * Block until there are enough resources to start the VM.
+	 * Returns false if the deadline passed or the user cancelled.
+	 */
+	bool 	acquire( const string& name, int ram, int cpus, const CLIDeadline& deadline );
+
+	/**
+	 * The VM has completed it's start (or failed to)
+	 */
+	void 	release( int ram, int cpus, bool started );
+
+private:
+
+	bool 	fits( int ram, int cpus );
+	void 	advance();
+
+	boost::mutex 				mutex;
+	boost::condition_variable 	cond;
+
+	double 						overcommit;
+	int 						hostCpus;
+	int 						usedCpus;
+	long 						pendingRam;
+	int 						pendingStarts;
+
+	unsigned long 				nextTicket;
+	unsigned long 				servingTicket;
+	set<unsigned long> 			abandoned;
+
+};
+
+#endif /* end of include guard: CLI_ADMISSION_CONTROL_H */
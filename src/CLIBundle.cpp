@@ -0,0 +1,366 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLIBundle.h"
+#include "CLICancel.h"
+#include "CLIOutput.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <sstream>
+#include <string.h>
+#include <zlib.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#define BUNDLE_MAGIC 		"CVMBNDL1"
+
+/**
+ * A chunk of a disk, on it's way in or out of the bundle
+ */
+struct bundle_chunk {
+	unsigned long long 	offset;
+	vector<char> 		raw;
+	vector<char> 		packed;
+	int 				res;
+};
+
+/**
+ * Big-endian integer I/O
+ */
+static bool write_int( FILE * f, unsigned long long v, int bytes ) {
+	unsigned char buf[8];
+	for (int i=0; i<bytes; i++)
+		buf[i] = (unsigned char)(v >> (8 * (bytes - i - 1)));
+	return fwrite( buf, 1, bytes, f ) == (size_t)bytes;
+}
+static bool read_int( FILE * f, unsigned long long * v, int bytes ) {
+	unsigned char buf[8];
+	if (fread( buf, 1, bytes, f ) != (size_t)bytes) return false;
+	*v = 0;
+	for (int i=0; i<bytes; i++)
+		*v = (*v << 8) | buf[i];
+	return true;
+}
+
+/**
+ * String I/O
+ */
+static bool write_string( FILE * f, const string& s ) {
+	return write_int( f, s.length(), 4 ) && (fwrite( s.data(), 1, s.length(), f ) == s.length());
+}
+static bool read_string( FILE * f, string * s ) {
+	unsigned long long len;
+	if (!read_int( f, &len, 4 ) || (len > CLI_BUNDLE_CHUNK)) return false;
+	vector<char> buf( len + 1 );
+	if (fread( &buf[0], 1, len, f ) != len) return false;
+	s->assign( &buf[0], len );
+	return true;
+}
+
+/**
+ * 64-bit file size and seek
+ */
+static long long file_size( const string& path ) {
+#ifdef _WIN32
+	struct _stati64 st;
+	if (_stati64( path.c_str(), &st ) != 0) return -1;
+#else
+	struct stat st;
+	if (stat( path.c_str(), &st ) != 0) return -1;
+#endif
+	return st.st_size;
+}
+static bool file_seek( FILE * f, unsigned long long offset ) {
+#ifdef _WIN32
+	return _fseeki64( f, offset, SEEK_SET ) == 0;
+#else
+	return fseeko( f, offset, SEEK_SET ) == 0;
+#endif
+}
+static bool file_resize( FILE * f, unsigned long long size ) {
+#ifdef _WIN32
+	return _chsize_s( _fileno(f), size ) == 0;
+#else
+	return ftruncate( fileno(f), size ) == 0;
+#endif
+}
+
+/**
+ * Compress or decompress every 'threads'-th chunk, starting from 'first'
+ */
+static void compress_chunks( vector<bundle_chunk> * chunks, size_t first, size_t step ) {
+	for (size_t i=first; i<chunks->size(); i+=step) {
+		bundle_chunk & c = (*chunks)[i];
+		uLongf len = compressBound( c.raw.size() );
+		c.packed.resize( len );
+		c.res = compress2( (Bytef *) &c.packed[0], &len, (const Bytef *) &c.raw[0], c.raw.size(), Z_BEST_SPEED );
+		c.packed.resize( len );
+	}
+}
+static void decompress_chunks( vector<bundle_chunk> * chunks, size_t first, size_t step ) {
+	for (size_t i=first; i<chunks->size(); i+=step) {
+		bundle_chunk & c = (*chunks)[i];
+		uLongf len = c.raw.size();
+		c.res = uncompress( (Bytef *) &c.raw[0], &len, (const Bytef *) &c.packed[0], c.packed.size() );
+		if ((c.res == Z_OK) && (len != c.raw.size()))
+			c.res = Z_DATA_ERROR;
+	}
+}
+
+/**
+ * Run the function on all the chunks with the given number of threads
+ */
+static void parallel_chunks( void (*fn)(vector<bundle_chunk> *, size_t, size_t), vector<bundle_chunk> * chunks, int threads ) {
+	size_t n = (threads < 1) ? 1 : threads;
+	if (n > chunks->size()) n = chunks->size();
+	boost::thread_group group;
+	for (size_t i=0; i<n; i++)
+		group.create_thread( boost::bind(fn, chunks, i, n) );
+	group.join_all();
+}
+
+/**
+ * Show the progress of a disk
+ */
+static void show_progress( const string& label, unsigned long long done, unsigned long long total ) {
+	ostringstream oss;
+	oss << label << ": " << (total ? (done * 100 / total) : 100) << "%";
+	CLIOutput::status( oss.str() );
+}
+
+/**
+ * Constructor
+ */
+CLIBundleWriter::CLIBundleWriter( FILE * out, int threads ) : out(out), threads(threads) { }
+
+/**
+ * Write the magic and the session parameters
+ */
+int CLIBundleWriter::writeParameters( const map<string, string>& params ) {
+	if (fwrite( BUNDLE_MAGIC, 1, 8, out ) != 8) return -1;
+	if (!write_int( out, 'P', 1 ) || !write_int( out, params.size(), 4 )) return -1;
+	for (map<string, string>::const_iterator it = params.begin(); it != params.end(); ++it) {
+		if (!write_string( out, (*it).first ) || !write_string( out, (*it).second ))
+			return -1;
+	}
+	return 0;
+}
+
+/**
+ * Write the contents of a disk
+ */
+int CLIBundleWriter::writeFile( const string& slot, const string& path ) {
+	long long size = file_size( path );
+	FILE * f = fopen( path.c_str(), "rb" );
+	if ((size < 0) || (f == NULL)) {
+		if (f) fclose( f );
+		return -1;
+	}
+	if (!write_int( out, 'F', 1 ) || !write_string( out, slot ) || !write_int( out, size, 8 )) {
+		fclose( f );
+		return -1;
+	}
+
+	// Read a batch, compress it in parallel and write it out in order
+	unsigned long long offset = 0;
+	size_t batchSize = (threads < 1 ? 1 : threads) * 2;
+	while (offset < (unsigned long long)size) {
+		vector<bundle_chunk> batch;
+		while ((batch.size() < batchSize) && (offset < (unsigned long long)size)) {
+			bundle_chunk c;
+			c.offset = offset;
+			c.raw.resize( CLI_BUNDLE_CHUNK );
+			size_t len = fread( &c.raw[0], 1, CLI_BUNDLE_CHUNK, f );
+			if (len == 0) break;
+			c.raw.resize( len );
+			offset += len;
+
+			// Skip the holes
+			bool zero = true;
+			for (size_t i=0; (i<len) && zero; i++)
+				zero = (c.raw[i] == 0);
+			if (!zero) batch.push_back( c );
+		}
+		if (ferror( f )) {
+			fclose( f );
+			return -1;
+		}
+
+		parallel_chunks( &compress_chunks, &batch, threads );
+		for (vector<bundle_chunk>::iterator it = batch.begin(); it != batch.end(); ++it) {
+			if ((it->res != Z_OK) ||
+				!write_int( out, 'C', 1 ) || !write_int( out, it->offset, 8 ) ||
+				!write_int( out, it->raw.size(), 4 ) || !write_int( out, it->packed.size(), 4 ) ||
+				(fwrite( &it->packed[0], 1, it->packed.size(), out ) != it->packed.size())) {
+				fclose( f );
+				return -1;
+			}
+		}
+
+		show_progress( "Exporting " + slot, offset, size );
+		if (CLICancel::requested()) {
+			fclose( f );
+			return CLI_EXIT_CANCELLED;
+		}
+
+		// The file was shorter than it's size
+		if (feof( f )) break;
+	}
+	fclose( f );
+
+	return write_int( out, 'E', 1 ) ? 0 : -1;
+}
+
+/**
+ * Write the end of the bundle
+ */
+int CLIBundleWriter::finish() {
+	if (!write_int( out, 'X', 1 )) return -1;
+	return (fflush( out ) == 0) ? 0 : -1;
+}
+
+/**
+ * Constructor
+ */
+CLIBundleReader::CLIBundleReader( FILE * in, int threads ) : error(false), in(in), threads(threads) { }
+
+/**
+ * Read the magic and the session parameters
+ */
+int CLIBundleReader::readParameters( map<string, string> * params ) {
+	char magic[8];
+	unsigned long long type, count;
+	if ((fread( magic, 1, 8, in ) != 8) || (memcmp( magic, BUNDLE_MAGIC, 8 ) != 0) ||
+		!read_int( in, &type, 1 ) || (type != 'P') || !read_int( in, &count, 4 )) {
+		error = true;
+		return -1;
+	}
+	params->clear();
+	for (unsigned long long i=0; i<count; i++) {
+		string key, value;
+		if (!read_string( in, &key ) || !read_string( in, &value )) {
+			error = true;
+			return -1;
+		}
+		(*params)[key] = value;
+	}
+	return 0;
+}
+
+/**
+ * Move to the next disk
+ */
+bool CLIBundleReader::nextFile( string * slot, unsigned long long * size ) {
+	unsigned long long type;
+	if (!read_int( in, &type, 1 )) {
+		error = true;
+		return false;
+	}
+	if (type == 'X')
+		return false;
+	if ((type != 'F') || !read_string( in, slot ) || !read_int( in, size, 8 )) {
+		error = true;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Write the current disk to the given file
+ */
+int CLIBundleReader::extractFile( const string& path, unsigned long long size ) {
+	// Start from an empty file of the right size, so the chunks
+	// we don't get stay holes
+	FILE * f = fopen( path.c_str(), "wb" );
+	if (f == NULL) return -1;
+	if (!file_resize( f, size )) {
+		fclose( f );
+		return -1;
+	}
+
+	// Read a batch, decompress it in parallel and write it out
+	size_t batchSize = (threads < 1 ? 1 : threads) * 2;
+	bool done = false;
+	while (!done) {
+		vector<bundle_chunk> batch;
+		while (batch.size() < batchSize) {
+			unsigned long long type, offset, len, zlen;
+			if (!read_int( in, &type, 1 )) {
+				error = true;
+				break;
+			}
+			if (type == 'E') {
+				done = true;
+				break;
+			}
+			if ((type != 'C') || !read_int( in, &offset, 8 ) || !read_int( in, &len, 4 ) || !read_int( in, &zlen, 4 ) ||
+				(len == 0) || (zlen == 0) || (len > CLI_BUNDLE_CHUNK) || (zlen > compressBound(CLI_BUNDLE_CHUNK)) || (offset + len > size)) {
+				error = true;
+				break;
+			}
+			bundle_chunk c;
+			c.offset = offset;
+			c.raw.resize( len );
+			c.packed.resize( zlen );
+			if (fread( &c.packed[0], 1, zlen, in ) != zlen) {
+				error = true;
+				break;
+			}
+			batch.push_back( c );
+		}
+		if (error) {
+			fclose( f );
+			return -1;
+		}
+
+		parallel_chunks( &decompress_chunks, &batch, threads );
+		for (vector<bundle_chunk>::iterator it = batch.begin(); it != batch.end(); ++it) {
+			if (it->res != Z_OK) {
+				error = true;
+				fclose( f );
+				return -1;
+			}
+			if (!file_seek( f, it->offset ) || (fwrite( &it->raw[0], 1, it->raw.size(), f ) != it->raw.size())) {
+				fclose( f );
+				return -1;
+			}
+		}
+
+		if (!batch.empty())
+			show_progress( "Importing " + path.substr( path.find_last_of("/\\") + 1 ), batch.back().offset + batch.back().raw.size(), size );
+		if (CLICancel::requested()) {
+			fclose( f );
+			return CLI_EXIT_CANCELLED;
+		}
+	}
+
+	return (fclose( f ) == 0) ? 0 : -1;
+}
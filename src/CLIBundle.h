@@ -0,0 +1,118 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_BUNDLE_H
+#define CLI_BUNDLE_H
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Size of the chunks the disks are split to
+ */
+#define CLI_BUNDLE_CHUNK 		(1024 * 1024)
+
+/**
+ * A session bundle is a stream of records:
+ *
+ *   "CVMBNDL1"                              Magic
+ *   'P' <count> (<key> <value>)...          Session parameters
+ *   'F' <slot> <size>                       Start of a disk, attached at <slot>
+ *   'C' <offset> <length> <zlength> <data>  A compressed chunk of the disk
+ *   'E'                                     End of the disk
+ *   'X'                                     End of the bundle
+ *
+ * Integers are big-endian and strings are prefixed by their length.
+ * Chunks that contain only zeroes are not written, so the holes of
+ * sparse disks cost nothing and are recreated as holes on import.
+ * Nothing is ever seeked, so bundles can go through pipes.
+ */
+
+/**
+ * Writes a bundle, compressing chunks in parallel
+ */
+class CLIBundleWriter {
+public:
+
+	CLIBundleWriter( FILE * out, int threads );
+
+	/**
+	 * Write the magic and the session parameters
+	 */
+	int 	writeParameters( const map<string, string>& params );
+
+	/**
+	 * Write the contents of a disk
+	 */
+	int 	writeFile( const string& slot, const string& path );
+
+	/**
+	 * Write the end of the bundle
+	 */
+	int 	finish();
+
+private:
+	FILE * 	out;
+	int 	threads;
+
+};
+
+/**
+ * Reads a bundle, decompressing chunks in parallel
+ */
+class CLIBundleReader {
+public:
+
+	CLIBundleReader( FILE * in, int threads );
+
+	/**
+	 * Read the magic and the session parameters
+	 */
+	int 	readParameters( map<string, string> * params );
+
+	/**
+	 * Move to the next disk. Returns false at the end of the bundle
+	 * (or if the bundle is corrupt, in which case error is set).
+	 */
+	bool 	nextFile( string * slot, unsigned long long * size );
+
+	/**
+	 * Write the current disk to the given file
+	 */
+	int 	extractFile( const string& path, unsigned long long size );
+
+	/**
+	 * Set when the bundle is corrupt
+	 */
+	bool 	error;
+
+private:
+	FILE * 	in;
+	int 	threads;
+
+};
+
+#endif /* end of include guard: CLI_BUNDLE_H */
@@ -0,0 +1,155 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLICancel.h"
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <signal.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+int CLICancel::timeout = 0;
+map<string, int> CLICancel::commandTimeouts;
+
+// Raised by the signal handler
+static volatile sig_atomic_t cancelFlag = 0;
+
+#ifdef _WIN32
+
+/**
+ * Console control handler. Returning FALSE on the second
+ * event lets the default handler terminate the process.
+ */
+static BOOL WINAPI cancel_handler( DWORD ctrlType ) {
+	if ((ctrlType != CTRL_C_EVENT) && (ctrlType != CTRL_BREAK_EVENT))
+		return FALSE;
+	if (cancelFlag)
+		return FALSE;
+	cancelFlag = 1;
+	return TRUE;
+}
+
+#else
+
+/**
+ * Signal handler. It's reset after the first signal, so the
+ * second one terminates the process.
+ */
+static void cancel_handler( int sig ) {
+	cancelFlag = 1;
+}
+
+#endif
+
+/**
+ * Install the signal handlers
+ */
+void CLICancel::install() {
+#ifdef _WIN32
+	SetConsoleCtrlHandler( cancel_handler, TRUE );
+#else
+	struct sigaction sa;
+	sa.sa_handler = cancel_handler;
+	sigemptyset( &sa.sa_mask );
+	sa.sa_flags = SA_RESETHAND;
+	sigaction( SIGINT, &sa, NULL );
+	sigaction( SIGTERM, &sa, NULL );
+#endif
+}
+
+/**
+ * Check if the user asked to cancel
+ */
+bool CLICancel::requested() {
+	return cancelFlag != 0;
+}
+
+/**
+ * Look up the time limit of a command
+ */
+int CLICancel::timeoutFor( const string& command ) {
+	map<string, int>::const_iterator it = commandTimeouts.find( command );
+	if (it == commandTimeouts.end())
+		return timeout;
+	return it->second;
+}
+
+/**
+ * Start a deadline
+ */
+CLIDeadline::CLIDeadline( int seconds ) : bounded( seconds > 0 ) {
+	if (bounded)
+		at = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds( seconds );
+}
+
+/**
+ * Check if the deadline has passed
+ */
+bool CLIDeadline::expired() const {
+	return bounded && (boost::posix_time::microsec_clock::universal_time() >= at);
+}
+
+/**
+ * Sleep in small steps, checking for cancellation
+ */
+bool CLIDeadline::sleep( int ms ) const {
+	while (ms > 0) {
+		if (CLICancel::requested() || expired())
+			return false;
+		int step = (ms > 100) ? 100 : ms;
+		boost::this_thread::sleep( boost::posix_time::milliseconds(step) );
+		ms -= step;
+	}
+	return !(CLICancel::requested() || expired());
+}
+
+/**
+ * Return the exit code for an interrupted operation
+ */
+int CLIDeadline::reason() const {
+	return CLICancel::requested() ? CLI_EXIT_CANCELLED : CLI_EXIT_TIMEOUT;
+}
+
+/**
+ * Wait for the session, with a deadline
+ */
+int wait_session( const HVSessionPtr& session, const CLIDeadline& deadline ) {
+
+	// HVSession::wait() can't be interrupted, so do it in a thread
+	boost::thread waiter( boost::bind( &HVSession::wait, session ) );
+	while (!waiter.timed_join( boost::posix_time::milliseconds(100) )) {
+		if (CLICancel::requested() || deadline.expired()) {
+
+			// Stop the session's state machine and give the
+			// waiter a moment to return
+			session->abort();
+			waiter.timed_join( boost::posix_time::seconds(5) );
+			waiter.detach();
+			return deadline.reason();
+
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,121 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_CANCEL_H
+#define CLI_CANCEL_H
+
+#include <CernVM/Hypervisor.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <map>
+#include <string>
+
+using namespace std;
+
+/**
+ * Exit codes of operations that did not complete
+ */
+#define CLI_EXIT_TIMEOUT 	7
+#define CLI_EXIT_CANCELLED 	8
+
+/**
+ * Cancellation of the blocking operations
+ *
+ * The first SIGINT/SIGTERM (or Ctrl-C on windows) only raises a flag.
+ * The operations in progress notice it, abort cleanly and report what
+ * they managed to do. A second signal terminates the process.
+ */
+class CLICancel {
+public:
+
+	/**
+	 * Install the signal handlers
+	 */
+	static void 	install();
+
+	/**
+	 * Check if the user asked to cancel
+	 */
+	static bool 	requested();
+
+	/**
+	 * The default time limit of every blocking operation, in seconds
+	 * (0 means no limit)
+	 */
+	static int 		timeout;
+
+	/**
+	 * The time limits of the operations of specific commands,
+	 * overriding the default
+	 */
+	static map<string, int> 	commandTimeouts;
+
+	/**
+	 * Return the time limit of the operations of the given command
+	 */
+	static int 		timeoutFor( const string& command );
+
+};
+
+/**
+ * The point in time an operation must complete by
+ */
+class CLIDeadline {
+public:
+
+	/**
+	 * Start a deadline 'seconds' from now (0 for no deadline)
+	 */
+	CLIDeadline( int seconds = CLICancel::timeout );
+
+	/**
+	 * Check if the deadline has passed
+	 */
+	bool 		expired() const;
+
+	/**
+	 * Sleep for the given time, unless the deadline passes or the user
+	 * cancels. Returns false in that case.
+	 */
+	bool 		sleep( int ms ) const;
+
+	/**
+	 * Return the exit code for an interrupted operation
+	 */
+	int 		reason() const;
+
+private:
+
+	bool 						bounded;
+	boost::posix_time::ptime 	at;
+
+};
+
+/**
+ * Wait for the session to complete it's current task, but abort it
+ * if the deadline passes or the user cancels. Returns 0 on success or
+ * the exit code of the interruption.
+ */
+int wait_session( const HVSessionPtr& session, const CLIDeadline& deadline );
+
+#endif /* end of include guard: CLI_CANCEL_H */
@@ -0,0 +1,172 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLICompletion.h"
+#include "cli-utils.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+/**
+ * The commands and options we complete. Keep them in sync with show_help().
+ */
+static const char * COMPLETION_COMMANDS =
+	"list images install-hypervisor daemon reclaim exporter completion "
+	"setup start stop save pause resume remove snapshot snapshots restore "
+	"waitstate get set autosave stats logs exec push pull export import";
+static const char * COMPLETION_OPTIONS =
+	"--silent --parallel --host --hosts --token --record --replay --replay-speed --selector "
+	"--timeout --retries --retry-budget --wait-lock --no-wait --answers --accept-license --auto-confirm --auto-deny "
+	"--prompt-timeout --help";
+static const char * COMPLETION_SETUP_OPTIONS =
+	"--32 --fio --gui --dualnic --ram --hdd --api --context --ver --flavor --start --ssh --label";
+
+/**
+ * The global options that take a value, as a shell case pattern
+ */
+static const char * COMPLETION_VALUE_OPTIONS =
+	"-j|--parallel|--host|--hosts|--token|--record|--replay|--replay-speed|-l|--selector|--timeout|--retries|--retry-budget|"
+	"--wait-lock|--answers|--accept-license|--auto-confirm|--auto-deny|--prompt-timeout";
+
+/**
+ * The commands that don't take a session name, as a shell case pattern
+ */
+static const char * COMPLETION_NO_SESSION =
+	"list|images|install-hypervisor|daemon|reclaim|exporter";
+
+/**
+ * Replace the cached session names
+ */
+void completion_cache_update( const vector<string>& names ) {
+	vector<string> sorted( names );
+	sort( sorted.begin(), sorted.end() );
+	ostringstream oss;
+	for (vector<string>::iterator it = sorted.begin(); it != sorted.end(); ++it)
+		oss << *it << "\n";
+	string data = oss.str();
+
+	// Don't touch the file if nothing changed
+	string filename = get_cli_data_path("sessions.cache");
+	{
+		ifstream f( filename.c_str(), ios::binary );
+		if (f) {
+			ostringstream current;
+			current << f.rdbuf();
+			if (current.str().compare(data) == 0) return;
+		}
+	}
+
+	// Replace it, so the completion never sees a partial file
+	string tmpFile = filename + ".tmp";
+	{
+		ofstream f( tmpFile.c_str(), ios::trunc | ios::binary );
+		if (!f) return;
+		f << data;
+	}
+	remove( filename.c_str() );
+	rename( tmpFile.c_str(), filename.c_str() );
+}
+
+/**
+ * Write the completion script
+ */
+bool completion_script( const string& shell, ostream& os ) {
+	string cache = shell_quote( get_cli_data_path("sessions.cache") );
+
+	if (shell.compare("bash") == 0) {
+		os << "# bash completion for cernvm-cli" << endl;
+		os << "# Load it with: source <(cernvm-cli completion bash)" << endl;
+		os << "_cernvm_cli() {" << endl;
+		os << "\tlocal cur=\"${COMP_WORDS[COMP_CWORD]}\" cmd=\"\" i=1 IFS=$'\\n'" << endl;
+		os << "\twhile [ $i -lt $COMP_CWORD ]; do" << endl;
+		os << "\t\tcase \"${COMP_WORDS[i]}\" in" << endl;
+		os << "\t\t\t" << COMPLETION_VALUE_OPTIONS << ") i=$((i+1)) ;;" << endl;
+		os << "\t\t\t-*) ;;" << endl;
+		os << "\t\t\t*) cmd=\"${COMP_WORDS[i]}\"; break ;;" << endl;
+		os << "\t\tesac" << endl;
+		os << "\t\ti=$((i+1))" << endl;
+		os << "\tdone" << endl;
+		os << "\tcase \"$cmd\" in" << endl;
+		os << "\t\t\"\")" << endl;
+		os << "\t\t\tif [[ \"$cur\" == -* ]]; then" << endl;
+		os << "\t\t\t\tCOMPREPLY=( $(IFS=' '; compgen -W \"" << COMPLETION_OPTIONS << "\" -- \"$cur\") )" << endl;
+		os << "\t\t\telse" << endl;
+		os << "\t\t\t\tCOMPREPLY=( $(IFS=' '; compgen -W \"" << COMPLETION_COMMANDS << "\" -- \"$cur\") )" << endl;
+		os << "\t\t\tfi ;;" << endl;
+		os << "\t\tsetup)" << endl;
+		os << "\t\t\tCOMPREPLY=( $(IFS=' '; compgen -W \"" << COMPLETION_SETUP_OPTIONS << "\" -- \"$cur\") ) ;;" << endl;
+		os << "\t\tcompletion)" << endl;
+		os << "\t\t\tCOMPREPLY=( $(IFS=' '; compgen -W \"bash zsh\" -- \"$cur\") ) ;;" << endl;
+		os << "\t\t" << COMPLETION_NO_SESSION << ")" << endl;
+		os << "\t\t\tCOMPREPLY=() ;;" << endl;
+		os << "\t\t*)" << endl;
+		os << "\t\t\tif [[ \"$cur\" != -* ]] && [ -r " << cache << " ]; then" << endl;
+		os << "\t\t\t\tCOMPREPLY=( $(compgen -W \"$(< " << cache << ")\" -- \"$cur\") )" << endl;
+		os << "\t\t\tfi ;;" << endl;
+		os << "\tesac" << endl;
+		os << "}" << endl;
+		os << "complete -F _cernvm_cli cernvm-cli" << endl;
+		return true;
+
+	} else if (shell.compare("zsh") == 0) {
+		os << "#compdef cernvm-cli" << endl;
+		os << "# zsh completion for cernvm-cli" << endl;
+		os << "# Load it with: source <(cernvm-cli completion zsh)" << endl;
+		os << "_cernvm_cli() {" << endl;
+		os << "\tlocal cmd=\"\" i=2" << endl;
+		os << "\tlocal -a sessions" << endl;
+		os << "\twhile (( i < CURRENT )); do" << endl;
+		os << "\t\tcase \"${words[i]}\" in" << endl;
+		os << "\t\t\t(" << COMPLETION_VALUE_OPTIONS << ") (( i++ )) ;;" << endl;
+		os << "\t\t\t(-*) ;;" << endl;
+		os << "\t\t\t(*) cmd=\"${words[i]}\"; break ;;" << endl;
+		os << "\t\tesac" << endl;
+		os << "\t\t(( i++ ))" << endl;
+		os << "\tdone" << endl;
+		os << "\tcase \"$cmd\" in" << endl;
+		os << "\t\t(\"\")" << endl;
+		os << "\t\t\tif [[ \"$PREFIX\" == -* ]]; then" << endl;
+		os << "\t\t\t\tcompadd -- " << COMPLETION_OPTIONS << endl;
+		os << "\t\t\telse" << endl;
+		os << "\t\t\t\tcompadd -- " << COMPLETION_COMMANDS << endl;
+		os << "\t\t\tfi ;;" << endl;
+		os << "\t\t(setup)" << endl;
+		os << "\t\t\tcompadd -- " << COMPLETION_SETUP_OPTIONS << " ;;" << endl;
+		os << "\t\t(completion)" << endl;
+		os << "\t\t\tcompadd -- bash zsh ;;" << endl;
+		os << "\t\t(" << COMPLETION_NO_SESSION << ")" << endl;
+		os << "\t\t\t;;" << endl;
+		os << "\t\t(*)" << endl;
+		os << "\t\t\tif [[ \"$PREFIX\" != -* ]] && [[ -r " << cache << " ]]; then" << endl;
+		os << "\t\t\t\tsessions=( \"${(@f)$(< " << cache << ")}\" )" << endl;
+		os << "\t\t\t\tcompadd -a sessions" << endl;
+		os << "\t\t\tfi ;;" << endl;
+		os << "\tesac" << endl;
+		os << "}" << endl;
+		os << "compdef _cernvm_cli cernvm-cli" << endl;
+		return true;
+
+	}
+
+	return false;
+}
@@ -0,0 +1,52 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_COMPLETION_H
+#define CLI_COMPLETION_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Shell completion
+ *
+ * Asking the hypervisor for the sessions takes far too long for every
+ * key press, so the completion scripts read the session names from a
+ * cache file. The cache is refreshed by every cernvm-cli command that
+ * loads the sessions anyway.
+ */
+
+/**
+ * Replace the cached session names (only written if they changed)
+ */
+void completion_cache_update( const vector<string>& names );
+
+/**
+ * Write the completion script for the given shell ('bash' or 'zsh').
+ * Returns false if the shell is not supported.
+ */
+bool completion_script( const string& shell, ostream& os );
+
+#endif /* end of include guard: CLI_COMPLETION_H */
@@ -0,0 +1,446 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLIDownloadProvider.h"
+#include "CLIOutput.h"
+#include "cli-utils.h"
+
+#include <CernVM/Utilities.h>
+
+#include <curl/curl.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+// How many times to retry a chunk before giving up
+#define CHUNK_RETRIES 	5
+
+/**
+ * What we know about a remote file
+ */
+struct CLIRemoteInfo {
+	size_t 	length;
+	bool 	ranges;
+	string 	etag;
+};
+
+/**
+ * Where the chunk threads write to
+ */
+struct CLIChunkWriter {
+	FILE * 				file;
+	size_t 				remaining;
+	size_t 				written;
+	boost::mutex * 		mutex;
+	size_t * 			bytesDone;
+	VariableTaskPtr 	progress;
+	bool 				status;
+	size_t 				length;
+};
+
+/**
+ * Return the directory of the download cache
+ */
+static string cache_dir() {
+	string dir = get_cli_data_path( "downloads" );
+#ifdef _WIN32
+	_mkdir( dir.c_str() );
+#else
+	mkdir( dir.c_str(), 0700 );
+#endif
+	return dir;
+}
+
+/**
+ * Build the cache filename for the given URL.
+ * It's a hash of the URL, followed by the original filename.
+ */
+static string cache_key( const string& url ) {
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i=0; i<url.length(); i++) {
+		hash ^= (unsigned char) url[i];
+		hash *= 1099511628211ULL;
+	}
+
+	// Get the filename from the URL
+	string name = url.substr( 0, url.find_first_of("?#") );
+	size_t p = name.rfind('/');
+	if (p != string::npos) name = name.substr( p+1 );
+
+	ostringstream oss;
+	oss << hex << hash << "-";
+	for (size_t i=0; i<name.length(); i++) {
+		char c = name[i];
+		oss << ((isalnum(c) || (c == '.') || (c == '-') || (c == '_')) ? c : '_');
+	}
+	return oss.str();
+}
+
+/**
+ * Return the size of a file
+ */
+static long file_size( const string& filename ) {
+	ifstream f( filename.c_str(), ios::binary | ios::ate );
+	if (!f) return -1;
+	return (long) f.tellg();
+}
+
+/**
+ * Copy a file
+ */
+static bool copy_file( const string& from, const string& to ) {
+	ifstream src( from.c_str(), ios::binary );
+	ofstream dst( to.c_str(), ios::binary | ios::trunc );
+	if (!src || !dst) return false;
+	dst << src.rdbuf();
+	return dst.good();
+}
+
+/**
+ * Collect the headers of a HEAD request
+ */
+static size_t head_callback( char * buffer, size_t size, size_t count, void * userp ) {
+	CLIRemoteInfo * info = (CLIRemoteInfo *) userp;
+	string line( buffer, size * count );
+
+	// A new response starts after every redirect
+	if (line.compare(0, 5, "HTTP/") == 0) {
+		info->ranges = false;
+		info->etag = "";
+		return size * count;
+	}
+
+	// Parse header
+	size_t p = line.find(':');
+	if (p == string::npos) return size * count;
+	string key = line.substr( 0, p );
+	string value = line.substr( p+1 );
+	for (size_t i=0; i<key.length(); i++) key[i] = tolower(key[i]);
+	value.erase( 0, value.find_first_not_of(" \t") );
+	value.erase( value.find_last_not_of(" \t\r\n") + 1 );
+
+	if (key.compare("accept-ranges") == 0) {
+		info->ranges = (value.compare("bytes") == 0);
+	} else if (key.compare("etag") == 0) {
+		info->etag = value;
+	}
+	return size * count;
+}
+
+/**
+ * Ask the server for the size of the file and if it supports ranges
+ */
+static bool http_head( const string& url, CLIRemoteInfo * info ) {
+	CURL * curl = curl_easy_init();
+	if (!curl) return false;
+
+	info->length = 0;
+	info->ranges = false;
+	curl_easy_setopt( curl, CURLOPT_URL, url.c_str() );
+	curl_easy_setopt( curl, CURLOPT_NOBODY, 1L );
+	curl_easy_setopt( curl, CURLOPT_FOLLOWLOCATION, 1L );
+	curl_easy_setopt( curl, CURLOPT_NOSIGNAL, 1L );
+	curl_easy_setopt( curl, CURLOPT_CONNECTTIMEOUT, 30L );
+	curl_easy_setopt( curl, CURLOPT_HEADERFUNCTION, head_callback );
+	curl_easy_setopt( curl, CURLOPT_HEADERDATA, info );
+
+	CURLcode res = curl_easy_perform( curl );
+	long code = 0;
+	double length = -1;
+	curl_easy_getinfo( curl, CURLINFO_RESPONSE_CODE, &code );
+	curl_easy_getinfo( curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length );
+	curl_easy_cleanup( curl );
+
+	if ((res != CURLE_OK) || (code != 200) || (length <= 0))
+		return false;
+	info->length = (size_t) length;
+	return true;
+}
+
+/**
+ * Write the body of a range request at it's place in the file
+ */
+static size_t chunk_callback( char * buffer, size_t size, size_t count, void * userp ) {
+	CLIChunkWriter * w = (CLIChunkWriter *) userp;
+	size_t len = size * count;
+
+	// The server sent more than we asked for
+	if (len > w->remaining) return 0;
+	if (fwrite( buffer, 1, len, w->file ) != len) return 0;
+	w->remaining -= len;
+	w->written += len;
+
+	// Update progress
+	boost::mutex::scoped_lock lock(*w->mutex);
+	size_t before = *w->bytesDone;
+	*w->bytesDone += len;
+	if (w->progress) w->progress->update( *w->bytesDone );
+	if (w->status && (before * 100 / w->length != *w->bytesDone * 100 / w->length)) {
+		ostringstream oss;
+		oss << "Downloading " << (*w->bytesDone * 100 / w->length) << "% ";
+		CLIOutput::status( oss.str() );
+	}
+	return len;
+}
+
+/**
+ * Constructor
+ */
+CLIDownloadProvider::CLIDownloadProvider( const DownloadProviderPtr& fallback, int threads )
+	: prefetchOnly(false), cached(0), chunkSize(4*1024*1024), fallback(fallback), threads(threads), bytesDone(0), failed(false) {
+	curl_global_init( CURL_GLOBAL_ALL );
+	if (this->threads < 1) this->threads = 1;
+}
+
+/**
+ * Download text with the fallback provider
+ */
+int CLIDownloadProvider::downloadText( const std::string& url, std::string * buffer, const VariableTaskPtr & pf ) {
+	return fallback->downloadText( url, buffer, pf );
+}
+
+/**
+ * Download a file through the cache
+ */
+int CLIDownloadProvider::downloadFile( const std::string& url, const std::string& destination, const VariableTaskPtr & pf ) {
+	string cacheFile = cache_dir() + "/" + cache_key( url );
+	string partFile = cacheFile + ".part";
+	string stateFile = cacheFile + ".state";
+
+	// If we are asked for the same file again, the previous copy did
+	// not verify, so it must not come from the cache.
+	if (find( cacheFiles.begin(), cacheFiles.end(), cacheFile ) != cacheFiles.end()) {
+		remove( cacheFile.c_str() );
+	} else {
+		cacheFiles.push_back( cacheFile );
+	}
+
+	// Check what the server has. If we can't reach it, we can still
+	// use the file from the cache.
+	CLIRemoteInfo info;
+	bool online = http_head( url, &info );
+	bool valid = file_exists( cacheFile ) && (!online || (file_size(cacheFile) == (long)info.length));
+
+	if (!valid) {
+		if (online && info.ranges) {
+			// Download in chunks
+			int res = downloadChunks( url, partFile, stateFile, info.length, info.etag, pf );
+			if (prefetchOnly) CLIOutput::status( "" );
+			if (res != HVE_OK) return res;
+			remove( cacheFile.c_str() );
+			if (rename( partFile.c_str(), cacheFile.c_str() ) != 0) return HVE_IO_ERROR;
+			remove( stateFile.c_str() );
+
+		} else {
+			// The server does not support ranges, download in one go
+			string tmpFile = cacheFile + ".tmp";
+			int res = fallback->downloadFile( url, tmpFile, pf );
+			if (res != HVE_OK) {
+				remove( tmpFile.c_str() );
+				return res;
+			}
+			remove( cacheFile.c_str() );
+			if (rename( tmpFile.c_str(), cacheFile.c_str() ) != 0) return HVE_IO_ERROR;
+		}
+	}
+	cached++;
+
+	// In prefetch mode we stop here, so the caller does not go on
+	if (prefetchOnly) return HVE_NOT_SUPPORTED;
+
+	// Copy from the cache
+	if (!copy_file( cacheFile, destination )) return HVE_IO_ERROR;
+	return HVE_OK;
+}
+
+/**
+ * Remove the files downloaded by this provider from the cache
+ */
+void CLIDownloadProvider::evict() {
+	for (vector<string>::iterator it = cacheFiles.begin(); it != cacheFiles.end(); ++it) {
+		remove( (*it).c_str() );
+		remove( (*it + ".part").c_str() );
+		remove( (*it + ".state").c_str() );
+	}
+	cacheFiles.clear();
+}
+
+/**
+ * Download the missing chunks of the file in parallel
+ */
+int CLIDownloadProvider::downloadChunks( const string& url, const string& partFile, const string& stateFile, size_t length, const string& etag, const VariableTaskPtr & pf ) {
+	size_t numChunks = (length + chunkSize - 1) / chunkSize;
+	vector<bool> done( numChunks, false );
+
+	// The state file starts with what we know about the remote file.
+	// If it still matches, the chunks listed after it are already there.
+	ostringstream oss;
+	oss << length << " " << chunkSize << " " << etag;
+	string header = oss.str(), line;
+	bool resume = false;
+	ifstream fState( stateFile.c_str() );
+	if (getline(fState, line) && (line.compare(header) == 0) && file_exists(partFile)) {
+		size_t chunk;
+		while (fState >> chunk) {
+			if (chunk < numChunks) done[chunk] = true;
+		}
+		resume = true;
+	}
+	fState.close();
+
+	// Otherwise start from scratch
+	if (!resume) {
+		FILE * f = fopen( partFile.c_str(), "wb" );
+		if (f == NULL) return HVE_IO_ERROR;
+		fclose( f );
+		ofstream fNew( stateFile.c_str(), ios::trunc );
+		fNew << header << endl;
+	}
+
+	// Prepare the list of chunks to download (first chunk at the back)
+	pendingChunks.clear();
+	bytesDone = 0;
+	failed = false;
+	progress = pf;
+	for (size_t i=numChunks; i>0; i--) {
+		if (!done[i-1]) {
+			pendingChunks.push_back( i-1 );
+		} else {
+			bytesDone += ((i == numChunks) ? (length - (i-1) * chunkSize) : chunkSize);
+		}
+	}
+	if (bytesDone > 0) {
+		CLIOutputLine(CLI_STDERR) << "[wait] Resuming download with " << (bytesDone / 1024 / 1024) << " of " << (length / 1024 / 1024) << " MB in cache";
+	}
+	if (pf) {
+		pf->setMax( length );
+		pf->update( bytesDone );
+	}
+
+	// Start the chunk threads
+	boost::thread_group group;
+	size_t count = pendingChunks.size();
+	if (count > (size_t) threads) count = threads;
+	for (size_t i=0; i<count; i++) {
+		group.create_thread( boost::bind( &CLIDownloadProvider::chunkThread, this, url, partFile, stateFile, length ) );
+	}
+	group.join_all();
+	progress.reset();
+
+	return failed ? HVE_IO_ERROR : HVE_OK;
+}
+
+/**
+ * Download chunks until there are none left
+ */
+void CLIDownloadProvider::chunkThread( const string& url, const string& partFile, const string& stateFile, size_t length ) {
+	FILE * f = fopen( partFile.c_str(), "r+b" );
+	if (f == NULL) {
+		boost::mutex::scoped_lock lock(mutex);
+		failed = true;
+		return;
+	}
+
+	while (true) {
+
+		// Get the next chunk
+		size_t chunk;
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			if (failed || pendingChunks.empty()) break;
+			chunk = pendingChunks.back();
+			pendingChunks.pop_back();
+		}
+		size_t begin = chunk * chunkSize;
+		size_t end = begin + chunkSize;
+		if (end > length) end = length;
+		ostringstream range;
+		range << begin << "-" << (end - 1);
+
+		// Download it
+		bool ok = false;
+		for (int tries=0; (tries < CHUNK_RETRIES) && !ok; tries++) {
+			CLIChunkWriter w;
+			w.file = f;
+			w.remaining = end - begin;
+			w.written = 0;
+			w.mutex = &mutex;
+			w.bytesDone = &bytesDone;
+			w.progress = progress;
+			w.status = prefetchOnly;
+			w.length = length;
+			fseek( f, (long) begin, SEEK_SET );
+
+			CURL * curl = curl_easy_init();
+			if (!curl) break;
+			curl_easy_setopt( curl, CURLOPT_URL, url.c_str() );
+			curl_easy_setopt( curl, CURLOPT_RANGE, range.str().c_str() );
+			curl_easy_setopt( curl, CURLOPT_FOLLOWLOCATION, 1L );
+			curl_easy_setopt( curl, CURLOPT_FAILONERROR, 1L );
+			curl_easy_setopt( curl, CURLOPT_NOSIGNAL, 1L );
+			curl_easy_setopt( curl, CURLOPT_CONNECTTIMEOUT, 30L );
+			curl_easy_setopt( curl, CURLOPT_LOW_SPEED_LIMIT, 1L );
+			curl_easy_setopt( curl, CURLOPT_LOW_SPEED_TIME, 60L );
+			curl_easy_setopt( curl, CURLOPT_WRITEFUNCTION, chunk_callback );
+			curl_easy_setopt( curl, CURLOPT_WRITEDATA, &w );
+			CURLcode res = curl_easy_perform( curl );
+			long code = 0;
+			curl_easy_getinfo( curl, CURLINFO_RESPONSE_CODE, &code );
+			curl_easy_cleanup( curl );
+
+			ok = (res == CURLE_OK) && (code == 206) && (w.remaining == 0);
+			if (!ok) {
+				boost::mutex::scoped_lock lock(mutex);
+				bytesDone -= w.written;
+			}
+		}
+
+		// Give up on the whole download if a chunk keeps failing
+		if (!ok || (fflush(f) != 0)) {
+			boost::mutex::scoped_lock lock(mutex);
+			failed = true;
+			break;
+		}
+
+		// Mark the chunk as completed
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			ofstream fState( stateFile.c_str(), ios::app );
+			fState << chunk << endl;
+		}
+
+	}
+
+	fclose( f );
+}
@@ -0,0 +1,105 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_DOWNLOAD_PROVIDER_H
+#define CLI_DOWNLOAD_PROVIDER_H
+
+#include <CernVM/DownloadProvider.h>
+#include <CernVM/ProgressFeedback.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Download provider for large files
+ *
+ * Files are fetched with HTTP range requests in fixed-size chunks, by
+ * many threads in parallel. The chunks are written in a partial file
+ * in the CLI cache, together with the list of chunks completed so far,
+ * so an interrupted download resumes where it stopped.
+ *
+ * If the server does not support ranges, or for text downloads, the
+ * request is passed to the fallback provider.
+ */
+class CLIDownloadProvider : public DownloadProvider {
+public:
+
+	/**
+	 * Create a provider that uses up to 'threads' parallel connections
+	 */
+	CLIDownloadProvider( const DownloadProviderPtr& fallback, int threads );
+
+	/**
+	 * Text downloads are small, so they go to the fallback provider
+	 */
+	virtual int downloadText( const std::string& url, std::string * buffer, const VariableTaskPtr & pf = VariableTaskPtr() );
+
+	/**
+	 * Download a file through the cache
+	 */
+	virtual int downloadFile( const std::string& url, const std::string& destination, const VariableTaskPtr & pf = VariableTaskPtr() );
+
+	/**
+	 * Remove the files downloaded by this provider from the cache.
+	 * Used when the downloaded file failed to verify.
+	 */
+	void 		evict();
+
+	/**
+	 * When set, files are only downloaded in the cache and downloadFile
+	 * returns HVE_NOT_SUPPORTED instead of creating the destination.
+	 */
+	bool 		prefetchOnly;
+
+	/**
+	 * The number of files that were found or placed in the cache
+	 */
+	int 		cached;
+
+	/**
+	 * The size of each chunk
+	 */
+	size_t 		chunkSize;
+
+private:
+
+	int 		downloadChunks( const string& url, const string& partFile, const string& stateFile, size_t length, const string& etag, const VariableTaskPtr & pf );
+	void 		chunkThread( const string& url, const string& partFile, const string& stateFile, size_t length );
+
+	DownloadProviderPtr 	fallback;
+	int 					threads;
+	vector<string> 			cacheFiles;
+
+	// Shared state of the chunk threads
+	boost::mutex 			mutex;
+	vector<size_t> 			pendingChunks;
+	size_t 					bytesDone;
+	bool 					failed;
+	VariableTaskPtr 		progress;
+
+};
+
+#endif /* end of include guard: CLI_DOWNLOAD_PROVIDER_H */
@@ -0,0 +1,109 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+#include "CLIFloppyIO.h"
+
+#include <CernVM/Utilities.h>
+
+#include <fstream>
+#include <vector>
+
+// Floppy geometry
+#define FPIO_SIZE 				1474560
+#define FPIO_SZ_OUTPUT 			(FPIO_SIZE / 2 - 1)
+#define FPIO_SZ_INPUT 			FPIO_SZ_OUTPUT
+#define FPIO_OFS_OUTPUT 		0
+#define FPIO_OFS_INPUT 			FPIO_SZ_OUTPUT
+#define FPIO_OFS_CTRL_IN 		(FPIO_SZ_INPUT + FPIO_SZ_OUTPUT)
+#define FPIO_OFS_CTRL_OUT 		(FPIO_SZ_INPUT + FPIO_SZ_OUTPUT + 1)
+
+// Control byte values
+#define FPIO_CTRL_EMPTY 		0
+#define FPIO_CTRL_DATA 			1
+
+/**
+ * Constructor
+ */
+CLIFloppyIO::CLIFloppyIO( const string& filename ) : filename(filename) { }
+
+/**
+ * Maximum size of a message (excluding the NULL terminator)
+ */
+size_t CLIFloppyIO::capacity() {
+	return FPIO_SZ_OUTPUT - 1;
+}
+
+/**
+ * Send data to the guest
+ */
+int CLIFloppyIO::send( const string& data ) {
+	if (data.length() > capacity())
+		return HVE_USAGE_ERROR;
+
+	fstream f( filename.c_str(), ios::in | ios::out | ios::binary );
+	if (!f.is_open())
+		return HVE_IO_ERROR;
+
+	// Write the data, zero-padded to the end of the output area
+	vector<char> buf( FPIO_SZ_OUTPUT, 0 );
+	copy( data.begin(), data.end(), buf.begin() );
+	f.seekp( FPIO_OFS_OUTPUT );
+	f.write( &buf[0], buf.size() );
+
+	// Flag that there is data waiting
+	char ctrl = FPIO_CTRL_DATA;
+	f.seekp( FPIO_OFS_CTRL_OUT );
+	f.write( &ctrl, 1 );
+
+	if (f.fail())
+		return HVE_IO_ERROR;
+	return HVE_OK;
+}
+
+/**
+ * Receive the data the guest has sent
+ */
+int CLIFloppyIO::receive( string * data ) {
+	fstream f( filename.c_str(), ios::in | ios::out | ios::binary );
+	if (!f.is_open())
+		return HVE_IO_ERROR;
+
+	// Check if there is anything waiting
+	char ctrl = FPIO_CTRL_EMPTY;
+	f.seekg( FPIO_OFS_CTRL_IN );
+	f.read( &ctrl, 1 );
+	if (ctrl != FPIO_CTRL_DATA)
+		return HVE_NOT_FOUND;
+
+	// Read up to the NULL terminator
+	vector<char> buf( FPIO_SZ_INPUT + 1, 0 );
+	f.seekg( FPIO_OFS_INPUT );
+	f.read( &buf[0], FPIO_SZ_INPUT );
+	*data = string( &buf[0] );
+
+	// Acknowledge
+	ctrl = FPIO_CTRL_EMPTY;
+	f.seekp( FPIO_OFS_CTRL_IN );
+	f.write( &ctrl, 1 );
+
+	if (f.fail())
+		return HVE_IO_ERROR;
+	return HVE_OK;
+}
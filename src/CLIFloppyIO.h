@@ -0,0 +1,67 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+#pragma once
+#ifndef CLI_FLOPPYIO_H
+#define CLI_FLOPPYIO_H
+
+#include <string>
+
+using namespace std;
+
+/**
+ * Host-side access to the FloppyIO image of a VM
+ *
+ * The 1.44Mb floppy is split in two halves: the first one carries data
+ * from the host to the guest and the second one from the guest to the
+ * host. The two bytes at the end of the image are the control bytes
+ * that flag when there is data waiting on each direction.
+ *
+ * As in the original FloppyIO, the data are NULL-terminated strings.
+ */
+class CLIFloppyIO {
+public:
+
+	/**
+	 * Open the floppy image with the given filename
+	 */
+	CLIFloppyIO( const string& filename );
+
+	/**
+	 * Send data to the guest
+	 */
+	int 		send( const string& data );
+
+	/**
+	 * Receive the data the guest has sent, if any
+	 */
+	int 		receive( string * data );
+
+	/**
+	 * How much data can be sent at once
+	 */
+	size_t 		capacity();
+
+private:
+	string 		filename;
+
+};
+
+#endif /* end of include guard: CLI_FLOPPYIO_H */
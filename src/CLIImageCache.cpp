@@ -0,0 +1,239 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLIImageCache.h"
+#include "CLISessionLock.h"
+#include "cli-utils.h"
+
+#include <CernVM/Utilities.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+/**
+ * Sort images by last use, most recent first
+ */
+static bool compare_last_used( const CLIImageEntry& a, const CLIImageEntry& b ) {
+	return a.lastUsed > b.lastUsed;
+}
+
+/**
+ * Load the image index
+ */
+static void load_index( vector<CLIImageEntry> * images ) {
+	images->clear();
+	ifstream f( get_cli_data_path("images.index").c_str() );
+	string line;
+	while (getline(f, line)) {
+		CLIImageEntry e;
+		istringstream iss( line );
+		if (!(iss >> e.checksum >> e.version >> e.flavor >> e.arch >> e.lastUsed)) continue;
+		getline( iss, e.filename );
+		e.filename.erase( 0, e.filename.find_first_not_of(" ") );
+		if (!e.filename.empty()) images->push_back( e );
+	}
+}
+
+/**
+ * Save the image index
+ */
+static bool save_index( const vector<CLIImageEntry>& images ) {
+	string filename = get_cli_data_path("images.index");
+	string tmpFile = filename + ".tmp";
+	{
+		ofstream f( tmpFile.c_str(), ios::trunc );
+		if (!f) return false;
+		for (vector<CLIImageEntry>::const_iterator it = images.begin(); it != images.end(); ++it) {
+			f << it->checksum << " " << it->version << " " << it->flavor << " " << it->arch << " "
+			  << it->lastUsed << " " << it->filename << endl;
+		}
+		if (!f.good()) return false;
+	}
+	remove( filename.c_str() );
+	return (rename( tmpFile.c_str(), filename.c_str() ) == 0);
+}
+
+/**
+ * Replace a file with a hard link to another file with the same contents
+ */
+static bool link_file( const string& target, const string& filename ) {
+	string tmpFile = filename + ".link";
+	remove( tmpFile.c_str() );
+#ifdef _WIN32
+	if (!CreateHardLinkA( tmpFile.c_str(), target.c_str(), NULL )) return false;
+#else
+	if (link( target.c_str(), tmpFile.c_str() ) != 0) return false;
+#endif
+	remove( filename.c_str() );
+	return (rename( tmpFile.c_str(), filename.c_str() ) == 0);
+}
+
+/**
+ * Return the architecture name for the session flags
+ */
+string image_arch( int flags ) {
+	return ((flags & HVF_SYSTEM_64BIT) != 0) ? "x86_64" : "i386";
+}
+
+/**
+ * Make sure the image is in the cache
+ */
+int CLIImageCache::fetch( const string& version, const string& flavor, const string& arch, const FiniteTaskPtr& pf, string * filename ) {
+	string file;
+
+	// Only one of us downloads a particular image. Everybody else
+	// waits here and finds it in the cache afterwards.
+	CLISessionLock lock( "image", version + "-" + flavor + "-" + arch, true );
+	if (!lock.acquire())
+		return HVE_INVALID_STATE;
+
+	// Download if missing
+	if (hv->cernVMCached( version, flavor, arch, &file ) != HVE_OK) {
+		int res = hv->cernVMDownload( version, flavor, arch, &file, pf );
+		if (res != HVE_OK) return res;
+	}
+
+	if (filename != NULL) *filename = file;
+	return record( version, flavor, arch, file );
+}
+
+/**
+ * Update the index for the given image
+ */
+int CLIImageCache::record( const string& version, const string& flavor, const string& arch, const string& filename ) {
+	CLISessionLock lock( "image", "index", true );
+	if (!lock.acquire())
+		return HVE_INVALID_STATE;
+
+	vector<CLIImageEntry> images;
+	load_index( &images );
+
+	// Find the entry of this image
+	vector<CLIImageEntry>::iterator entry = images.end();
+	for (vector<CLIImageEntry>::iterator it = images.begin(); it != images.end(); ++it) {
+		if ((it->version == version) && (it->flavor == flavor) && (it->arch == arch)) {
+			entry = it;
+			break;
+		}
+	}
+
+	// If we know it already, just mark it as used
+	if ((entry != images.end()) && (entry->filename == filename)) {
+		entry->lastUsed = (long) time(NULL);
+		return save_index( images ) ? HVE_OK : HVE_IO_ERROR;
+	}
+
+	// Otherwise checksum the new file
+	CLIImageEntry e;
+	if (sha256_file( filename, &e.checksum ) != HVE_OK)
+		return HVE_IO_ERROR;
+	e.version = version;
+	e.flavor = flavor;
+	e.arch = arch;
+	e.lastUsed = (long) time(NULL);
+	e.filename = filename;
+
+	// If we have the same contents under another name, keep only one copy
+	for (vector<CLIImageEntry>::iterator it = images.begin(); it != images.end(); ++it) {
+		if ((it->checksum == e.checksum) && (it->filename != filename) && file_exists(it->filename)) {
+			link_file( it->filename, filename );
+			break;
+		}
+	}
+
+	if (entry != images.end()) {
+		*entry = e;
+	} else {
+		images.push_back( e );
+	}
+	return save_index( images ) ? HVE_OK : HVE_IO_ERROR;
+}
+
+/**
+ * List the images in the cache
+ */
+int CLIImageCache::list( vector<CLIImageEntry> * images ) {
+	CLISessionLock lock( "image", "index", false );
+	if (!lock.acquire())
+		return HVE_INVALID_STATE;
+
+	vector<CLIImageEntry> all;
+	load_index( &all );
+
+	// Skip the images removed behind our back
+	images->clear();
+	for (vector<CLIImageEntry>::iterator it = all.begin(); it != all.end(); ++it) {
+		if (file_exists(it->filename))
+			images->push_back( *it );
+	}
+	sort( images->begin(), images->end(), compare_last_used );
+	return HVE_OK;
+}
+
+/**
+ * Remove the least recently used images
+ */
+int CLIImageCache::gc( size_t keep, const set<string>& inUse, vector<CLIImageEntry> * removed ) {
+	CLISessionLock lock( "image", "index", true );
+	if (!lock.acquire())
+		return HVE_INVALID_STATE;
+
+	vector<CLIImageEntry> images, kept;
+	load_index( &images );
+	sort( images.begin(), images.end(), compare_last_used );
+
+	int count = 0;
+	for (vector<CLIImageEntry>::iterator it = images.begin(); it != images.end(); ++it) {
+		if (!file_exists(it->filename)) continue;
+
+		// Keep the most recent and the ones sessions are using
+		if (inUse.find(it->filename) != inUse.end()) {
+			kept.push_back( *it );
+			continue;
+		}
+		if (keep > 0) {
+			kept.push_back( *it );
+			keep--;
+			continue;
+		}
+
+		// Don't remove an image somebody is downloading right now
+		CLISessionLock imageLock( "image", it->version + "-" + it->flavor + "-" + it->arch, true );
+		if (!imageLock.acquire(0) || (remove( it->filename.c_str() ) != 0)) {
+			kept.push_back( *it );
+			continue;
+		}
+
+		if (removed != NULL) removed->push_back( *it );
+		count++;
+	}
+
+	if (!save_index( kept ))
+		return HVE_IO_ERROR;
+	return count;
+}
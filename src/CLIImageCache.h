@@ -0,0 +1,92 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_IMAGE_CACHE_H
+#define CLI_IMAGE_CACHE_H
+
+#include <CernVM/Hypervisor.h>
+#include <CernVM/ProgressFeedback.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * An image in the cache
+ */
+struct CLIImageEntry {
+	string 	checksum;
+	string 	version;
+	string 	flavor;
+	string 	arch;
+	long 	lastUsed;
+	string 	filename;
+};
+
+/**
+ * The uCernVM image cache shared by all sessions
+ *
+ * The images are downloaded by the hypervisor into it's data cache.
+ * The cache keeps an index of them by content, so images with the same
+ * contents are stored only once, and concurrent requests for the same
+ * image (from threads or from other processes) wait for a single download.
+ */
+class CLIImageCache {
+public:
+
+	/**
+	 * Create a cache that uses the given hypervisor
+	 */
+	CLIImageCache( const HVInstancePtr& hv ) : hv(hv) { };
+
+	/**
+	 * Make sure the image is in the cache, downloading it if needed
+	 */
+	int 		fetch( const string& version, const string& flavor, const string& arch, const FiniteTaskPtr& pf, string * filename = NULL );
+
+	/**
+	 * Return the images in the cache, most recently used first
+	 */
+	int 		list( vector<CLIImageEntry> * images );
+
+	/**
+	 * Remove all but the 'keep' most recently used images, except the
+	 * ones in 'inUse' (by filename). Returns the number of images removed.
+	 */
+	int 		gc( size_t keep, const set<string>& inUse, vector<CLIImageEntry> * removed = NULL );
+
+private:
+
+	int 		record( const string& version, const string& flavor, const string& arch, const string& filename );
+
+	HVInstancePtr 	hv;
+
+};
+
+/**
+ * Return the architecture name for the session flags
+ */
+string image_arch( int flags );
+
+#endif /* end of include guard: CLI_IMAGE_CACHE_H */
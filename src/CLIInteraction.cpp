@@ -19,18 +19,76 @@
  */
 
 #include "CLIInteraction.h"
+#include "cli-utils.h"
+#include "CLIOutput.h"
 
-bool prompt( const std::string& message ) {
+#include <boost/make_shared.hpp>
+
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/select.h>
+#include <unistd.h>
+#endif
+
+/**
+ * How often (in milliseconds) a prompt checks if it should stop waiting
+ */
+#define PROMPT_POLL_INTERVAL 	100
+
+/**
+ * Read a line from the standard input, waiting up to 'timeout' seconds
+ * (or forever if 0). Returns false on timeout or end of input.
+ *
+ * The wait is an interruption point of the calling thread.
+ */
+static bool read_line( std::string * line, int timeout ) {
+#ifndef _WIN32
+	// Wait in small steps, so the thread can be interrupted
+	int waited = 0;
+	while (std::cin.rdbuf()->in_avail() <= 0) {
+		boost::this_thread::interruption_point();
+		if ((timeout > 0) && (waited >= timeout * 1000))
+			return false;
+		fd_set fds;
+		FD_ZERO( &fds );
+		FD_SET( STDIN_FILENO, &fds );
+		struct timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = PROMPT_POLL_INTERVAL * 1000;
+		int res = select( STDIN_FILENO+1, &fds, NULL, NULL, &tv );
+		if (res > 0)
+			break;
+		if (res < 0)
+			return false;
+		waited += PROMPT_POLL_INTERVAL;
+	}
+#endif
+	if (!std::getline( std::cin, *line ))
+		return false;
+	return true;
+}
+
+/**
+ * Ask a yes/no question. Returns 1 for yes, 0 for no and -1 if there was no answer.
+ */
+static int prompt( const std::string& message, int timeout ) {
 	std::string line;
 	while (true) {
-		std::cout << message << " [y/n]: ";
-		std::getline( std::cin, line );
+		// Make sure the question is on screen before we block
+		CLIOutput::write(CLI_STDOUT, message + " [y/n]: ");
+		CLIOutput::flush();
+		if (!read_line( &line, timeout )) {
+			CLIOutput::line(CLI_STDOUT, "");
+			return -1;
+		}
 		if ((line.compare("y") == 0) || (line.compare("Y") == 0)) {
-			std::cout << "-----------------------------" << std::endl;
-			return true;
+			CLIOutput::line(CLI_STDOUT, "-----------------------------");
+			return 1;
 		} else if ((line.compare("n") == 0) || (line.compare("N") == 0)) {
-			std::cout << "-----------------------------" << std::endl;
-			return false;
+			CLIOutput::line(CLI_STDOUT, "-----------------------------");
+			return 0;
 		}
 	}
 
@@ -42,70 +100,213 @@ CLIInteraction::CLIInteraction() : UserInteraction() {
 	this->setLicenseHandler( boost::bind(&CLIInteraction::cli_license, this, _1, _2, _3) );
 	this->setLicenseURLHandler( boost::bind(&CLIInteraction::cli_license_url, this, _1, _2, _3) );
 	this->silent = false;
+	this->timeout = 0;
 };
 
+/**
+ * Stop the prompt thread
+ */
+CLIInteraction::~CLIInteraction() {
+	if (!thread)
+		return;
+	thread->interrupt();
+	thread->join();
+}
+
+/**
+ * Add a rule to the answers policy
+ */
+void CLIInteraction::addRule( int kind, const std::string& pattern, int answer ) {
+	CLIAnswerRule rule;
+	rule.kind = kind;
+	rule.pattern = pattern;
+	rule.answer = answer;
+	rules.push_back( rule );
+}
+
+/**
+ * Load answer rules from a file
+ */
+bool CLIInteraction::loadAnswers( const std::string& filename ) {
+	std::ifstream f( filename.c_str() );
+	if (!f.is_open())
+		return false;
+
+	std::string line, action, kind, pattern;
+	while (std::getline( f, line )) {
+		std::istringstream iss( line );
+		if (!(iss >> action) || (action[0] == '#'))
+			continue;
+
+		// The rest of the line is the pattern
+		if (!(iss >> kind) || !std::getline( iss >> std::ws, pattern ))
+			return false;
+
+		int k, answer;
+		if (action.compare("accept") == 0) {
+			answer = UI_OK;
+		} else if (action.compare("deny") == 0) {
+			answer = UI_CANCEL;
+		} else {
+			return false;
+		}
+		if (kind.compare("any") == 0) {
+			k = CLI_PROMPT_ANY;
+		} else if (kind.compare("confirm") == 0) {
+			k = CLI_PROMPT_CONFIRM;
+		} else if (kind.compare("alert") == 0) {
+			k = CLI_PROMPT_ALERT;
+		} else if (kind.compare("license") == 0) {
+			k = CLI_PROMPT_LICENSE;
+		} else {
+			return false;
+		}
+		addRule( k, pattern, answer );
+	}
+	return true;
+}
+
+/**
+ * Look for a rule that answers this prompt
+ */
+bool CLIInteraction::lookupPolicy( int kind, const std::string& title, const std::string& message, int * answer ) {
+	for (std::vector<CLIAnswerRule>::iterator it = rules.begin(); it != rules.end(); ++it) {
+		if ((it->kind != CLI_PROMPT_ANY) && (it->kind != kind))
+			continue;
+		if (match_pattern( it->pattern, title ) || match_pattern( it->pattern, message )) {
+			*answer = it->answer;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Place a prompt on the interaction queue
+ */
+void CLIInteraction::enqueue( int kind, const std::string& title, const std::string& message, const std::string& question, const callbackResult& result ) {
+	CLIPromptRequest req;
+	req.kind = kind;
+	req.title = title;
+	req.message = message;
+	req.question = question;
+	req.result = result;
+
+	boost::mutex::scoped_lock lock(queueMutex);
+	queue.push_back( req );
+
+	// Start the prompt thread when it's first needed
+	if (!thread)
+		thread = boost::make_shared<boost::thread>( boost::bind(&CLIInteraction::promptThread, this) );
+	queueCond.notify_one();
+}
+
+/**
+ * Show the queued prompts one at a time
+ */
+void CLIInteraction::promptThread() {
+	try {
+		while (true) {
+			promptNext();
+		}
+	} catch (boost::thread_interrupted &) {
+		// We are shutting down
+	}
+}
+
+/**
+ * Wait for the next prompt and show it
+ */
+void CLIInteraction::promptNext() {
+	CLIPromptRequest req;
+	{
+		boost::mutex::scoped_lock lock(queueMutex);
+		while (queue.empty())
+			queueCond.wait( lock );
+		req = queue.front();
+		queue.pop_front();
+	}
+
+	CLIOutput::line(CLI_STDOUT, "");
+	CLIOutput::line(CLI_STDOUT, "---[ " + req.title + " ]---");
+	CLIOutput::line(CLI_STDOUT, req.message);
+
+	// Alerts need no answer
+	if (req.question.empty()) {
+		CLIOutput::line(CLI_STDOUT, "-----------------------------");
+		req.result(UI_OK);
+		return;
+	}
+
+	// Ask, falling back to 'no' if nobody answers
+	int ans = prompt( req.question, timeout );
+	if (ans < 0) {
+		CLIOutput::line(CLI_STDOUT, "(No answer, assuming no)");
+		CLIOutput::line(CLI_STDOUT, "-----------------------------");
+	}
+	req.result( (ans == 1) ? UI_OK : UI_CANCEL );
+}
+
 /**
  * Confirm from the CLI
  */
 void CLIInteraction::cli_confirm(const std::string& title, const std::string& message, const callbackResult& result) {
-	if (silent) {
-		result(UI_OK);
+	int answer;
+	if (lookupPolicy(CLI_PROMPT_CONFIRM, title, message, &answer)) {
+		result(answer);
 		return;
 	}
-	std::cout << std::endl << "---[ " << title << " ]---" << std::endl;
-	std::cout << message << std::endl;
-	if (prompt("Do you confirm?")) {
+	if (silent) {
 		result(UI_OK);
-	} else {
-		result(UI_CANCEL);
+		return;
 	}
+	enqueue(CLI_PROMPT_CONFIRM, title, message, "Do you confirm?", result);
 }
 
 /**
  * Alert from the CLI
  */
 void CLIInteraction::cli_alert(const std::string& title, const std::string& message, const callbackResult& result) {
+	int answer;
+	if (lookupPolicy(CLI_PROMPT_ALERT, title, message, &answer)) {
+		result(answer);
+		return;
+	}
 	if (silent) {
 		result(UI_OK);
 		return;
 	}
-	std::cout << std::endl << "---[ " << title << " ]---" << std::endl;
-	std::cout << message << std::endl;
-	std::cout << "-----------------------------" << std::endl;
+	enqueue(CLI_PROMPT_ALERT, title, message, "", result);
 }
 
 /**
  * Confirm licese from the CLI
  */
 void CLIInteraction::cli_license(const std::string& title, const std::string& message, const callbackResult& result) {
-	if (silent) {
-		result(UI_OK);
+	int answer;
+	if (lookupPolicy(CLI_PROMPT_LICENSE, title, message, &answer)) {
+		result(answer);
 		return;
 	}
-	std::cout << std::endl << "---[ " << title << " ]---" << std::endl;
-	std::cout << message << std::endl;
-	if (prompt("Do you accept the above license?")) {
+	if (silent) {
 		result(UI_OK);
-	} else {
-		result(UI_CANCEL);
+		return;
 	}
+	enqueue(CLI_PROMPT_LICENSE, title, message, "Do you accept the above license?", result);
 }
 
 /**
  * Confirm licese by URL from the CLI
  */
 void CLIInteraction::cli_license_url(const std::string& title, const std::string& url, const callbackResult& result) {
-	if (silent) {
-		result(UI_OK);
+	int answer;
+	if (lookupPolicy(CLI_PROMPT_LICENSE, title, url, &answer)) {
+		result(answer);
 		return;
 	}
-	std::cout << std::endl << "---[ " << title << " ]---" << std::endl;
-	std::cout << "See the license here: " << url << std::endl;
-	if (prompt("Do you accept the above license?")) {
+	if (silent) {
 		result(UI_OK);
-	} else {
-		result(UI_CANCEL);
+		return;
 	}
+	enqueue(CLI_PROMPT_LICENSE, title, "See the license here: " + url, "Do you accept the above license?", result);
 }
-
-
@@ -25,13 +25,52 @@
 #include <CernVM/UserInteraction.h>
 
 #include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include <iostream>
+#include <list>
+#include <string>
+#include <vector>
+
+/**
+ * Kinds of prompts an answer rule can apply to
+ */
+#define CLI_PROMPT_ANY 			0
+#define CLI_PROMPT_CONFIRM 		1
+#define CLI_PROMPT_ALERT 		2
+#define CLI_PROMPT_LICENSE 		3
+
+/**
+ * A rule of the answers policy
+ */
+struct CLIAnswerRule {
+	int 			kind;
+	std::string 	pattern;
+	int 			answer;
+};
+
+/**
+ * A prompt waiting in the interaction queue
+ */
+struct CLIPromptRequest {
+	int 			kind;
+	std::string 	title;
+	std::string 	message;
+	std::string 	question;
+	callbackResult 	result;
+};
 
 /**
  * A class through interaction with the user can happen
  *
  * This implementation does command-line interaction.
+ *
+ * The answers policy is consulted before prompting. Prompts that need
+ * the user are queued and answered one at a time by a single thread,
+ * so only the task that asked is waiting for the answer.
  */
 class CLIInteraction: public UserInteraction {
 public:
@@ -41,6 +80,11 @@ public:
 	 */
 	CLIInteraction();
 
+	/**
+	 * Stop the prompt thread
+	 */
+	~CLIInteraction();
+
 	/**
 	 * Confirm from the CLI
 	 */
@@ -61,11 +105,40 @@ public:
 	 */
 	void cli_license_url(const std::string& title, const std::string& url, const callbackResult& result);
 
+	/**
+	 * Add a rule to the answers policy (first matching rule wins)
+	 */
+	void addRule( int kind, const std::string& pattern, int answer );
+
+	/**
+	 * Load answer rules from a file with '<accept|deny> <any|confirm|alert|license> <pattern>' lines
+	 */
+	bool loadAnswers( const std::string& filename );
+
 	/**
 	 * Automatically accept messages
 	 */
 	bool 	silent;
 
+	/**
+	 * How many seconds to wait for an answer before using the default (0 waits forever)
+	 */
+	int 	timeout;
+
+private:
+
+	bool 	lookupPolicy( int kind, const std::string& title, const std::string& message, int * answer );
+	void 	enqueue( int kind, const std::string& title, const std::string& message, const std::string& question, const callbackResult& result );
+	void 	promptThread();
+	void 	promptNext();
+
+	std::vector<CLIAnswerRule> 			rules;
+
+	boost::mutex 						queueMutex;
+	boost::condition_variable 			queueCond;
+	std::list<CLIPromptRequest> 		queue;
+	boost::shared_ptr<boost::thread> 	thread;
+
 };
 
 #endif /* end of include guard: CLI_INTERACTION_H */
@@ -0,0 +1,146 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLIJournal.h"
+#include "CLISessionLock.h"
+#include "cli-utils.h"
+
+#include <cstdio>
+#include <sys/stat.h>
+
+/**
+ * How many seconds a writer waits for a rotation to complete
+ */
+#define JOURNAL_LOCK_TIMEOUT 	5
+
+/**
+ * Prepare to read the given journal
+ */
+CLIJournal::CLIJournal( const string& name ) : offset(0), inode(0) {
+	filename = get_cli_data_path( name );
+}
+
+/**
+ * Append a record to the journal
+ */
+void CLIJournal::append( const string& name, const string& line ) {
+	string filename = get_cli_data_path( name );
+	string record = line + "\n";
+	long size;
+
+	// Writers share the lock, so they only wait for a rotation
+	{
+		CLISessionLock lock( "journal", name, false );
+		lock.acquire( JOURNAL_LOCK_TIMEOUT );
+
+		FILE * f = fopen( filename.c_str(), "a" );
+		if (f == NULL) return;
+		fwrite( record.c_str(), 1, record.length(), f );
+		size = ftell( f );
+		fclose( f );
+	}
+	if (size < CLI_JOURNAL_MAX_SIZE)
+		return;
+
+	// Rotate, unless somebody is still writing. The next writer
+	// will try again.
+	CLISessionLock lock( "journal", name, true );
+	if (!lock.acquire( 0 ))
+		return;
+	struct stat st;
+	if ((stat( filename.c_str(), &st ) != 0) || (st.st_size < CLI_JOURNAL_MAX_SIZE))
+		return;
+	string rotated = filename + ".1";
+#ifdef _WIN32
+	remove( rotated.c_str() );
+#endif
+	rename( filename.c_str(), rotated.c_str() );
+}
+
+/**
+ * Skip the records written so far
+ */
+void CLIJournal::skip() {
+	struct stat st;
+	if (stat( filename.c_str(), &st ) != 0)
+		return;
+	inode = (unsigned long) st.st_ino;
+	offset = (long) st.st_size;
+}
+
+/**
+ * Read the new records
+ */
+void CLIJournal::read( vector<string> * lines ) {
+	struct stat st;
+	bool exists = (stat( filename.c_str(), &st ) == 0);
+
+	// The journal was rotated since we last read it, so finish
+	// the old one first
+	if ((inode != 0) && (!exists || ((unsigned long) st.st_ino != inode))) {
+		struct stat old;
+		string rotated = filename + ".1";
+		if ((stat( rotated.c_str(), &old ) == 0) && ((unsigned long) old.st_ino == inode))
+			readFrom( rotated, inode, lines );
+		offset = 0;
+		inode = 0;
+	}
+	if (!exists)
+		return;
+
+	// Start over if the journal was truncated
+	if (st.st_size < offset)
+		offset = 0;
+	inode = (unsigned long) st.st_ino;
+	readFrom( filename, inode, lines );
+}
+
+/**
+ * Read the complete lines of the given file, starting at our offset
+ */
+void CLIJournal::readFrom( const string& path, unsigned long expected, vector<string> * lines ) {
+	FILE * f = fopen( path.c_str(), "r" );
+	if (f == NULL) return;
+
+#ifndef _WIN32
+	// Make sure it was not rotated while we were looking
+	struct stat st;
+	if ((fstat( fileno(f), &st ) != 0) || ((unsigned long) st.st_ino != expected)) {
+		fclose( f );
+		return;
+	}
+#endif
+
+	// Process only complete lines
+	fseek( f, offset, SEEK_SET );
+	char buf[512];
+	string line;
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		line += buf;
+		if (line[line.length()-1] != '\n')
+			continue;
+		offset = ftell( f );
+		lines->push_back( line.substr(0, line.length()-1) );
+		line.clear();
+	}
+
+	fclose( f );
+}
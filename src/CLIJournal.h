@@ -0,0 +1,78 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_JOURNAL_H
+#define CLI_JOURNAL_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * The size after which a journal is rotated
+ */
+#define CLI_JOURNAL_MAX_SIZE 	1048576
+
+/**
+ * Line-based journal shared by all the cernvm-cli processes
+ *
+ * Every record is written with a single append, so concurrent writers
+ * do not interleave their lines. When the journal grows over
+ * CLI_JOURNAL_MAX_SIZE it's renamed to '<name>.1', replacing the
+ * previous one, and a new journal is started. A reader that is behind
+ * finishes the rotated journal before moving on to the new one.
+ */
+class CLIJournal {
+public:
+
+	/**
+	 * Prepare to read the given journal from the beginning
+	 */
+	CLIJournal( const string& name );
+
+	/**
+	 * Append a record to the given journal
+	 */
+	static void 	append( const string& name, const string& line );
+
+	/**
+	 * Skip the records written so far
+	 */
+	void 			skip();
+
+	/**
+	 * Read the complete records written since the last call
+	 */
+	void 			read( vector<string> * lines );
+
+private:
+
+	void 			readFrom( const string& path, unsigned long expected, vector<string> * lines );
+
+	string 			filename;
+	long 			offset;
+	unsigned long 	inode;
+
+};
+
+#endif /* end of include guard: CLI_JOURNAL_H */
@@ -0,0 +1,174 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLILabels.h"
+#include "CLISessionLock.h"
+#include "cli-utils.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+/**
+ * Return the index file of a label
+ */
+static string index_file( const string& label ) {
+	string dir = get_cli_data_path( "labels" );
+#ifdef _WIN32
+	_mkdir( dir.c_str() );
+#else
+	mkdir( dir.c_str(), 0700 );
+#endif
+	return dir + "/" + encode_filename( label );
+}
+
+/**
+ * Read the sessions of a label
+ */
+static void read_index( const string& label, set<string> * sessions ) {
+	sessions->clear();
+	ifstream f( index_file(label).c_str() );
+	string line;
+	while (getline(f, line)) {
+		if (!line.empty()) sessions->insert( line );
+	}
+}
+
+/**
+ * Write the sessions of a label
+ */
+static void write_index( const string& label, const set<string>& sessions ) {
+	string filename = index_file( label );
+	if (sessions.empty()) {
+		remove( filename.c_str() );
+		return;
+	}
+	string tmpFile = filename + ".tmp";
+	{
+		ofstream f( tmpFile.c_str(), ios::trunc );
+		for (set<string>::const_iterator it = sessions.begin(); it != sessions.end(); ++it)
+			f << *it << endl;
+	}
+	remove( filename.c_str() );
+	rename( tmpFile.c_str(), filename.c_str() );
+}
+
+/**
+ * Add or remove a session from the index of it's labels
+ */
+static void update_index( const string& session, const string& labels, bool add ) {
+	vector<string> list;
+	label_split( labels, &list );
+	for (vector<string>::iterator it = list.begin(); it != list.end(); ++it) {
+		CLISessionLock lock( "label", *it, true );
+		lock.acquire( -1 );
+
+		set<string> sessions;
+		read_index( *it, &sessions );
+		if (add) {
+			sessions.insert( session );
+		} else {
+			sessions.erase( session );
+		}
+		write_index( *it, sessions );
+	}
+}
+
+/**
+ * Check if the label is in key=value format
+ */
+bool label_valid( const string& label ) {
+	size_t p = label.find('=');
+	return (p != string::npos) && (p > 0) && (label.find(',') == string::npos);
+}
+
+/**
+ * Split the 'labels' parameter of a session
+ */
+void label_split( const string& labels, vector<string> * out ) {
+	out->clear();
+	size_t start = 0;
+	while (start < labels.length()) {
+		size_t end = labels.find( ',', start );
+		if (end == string::npos) end = labels.length();
+		if (end > start) out->push_back( labels.substr(start, end - start) );
+		start = end + 1;
+	}
+}
+
+/**
+ * Check if the 'labels' parameter has all the labels of the selector
+ */
+bool label_matches( const string& labels, const vector<string>& selector ) {
+	vector<string> list;
+	label_split( labels, &list );
+	for (vector<string>::const_iterator it = selector.begin(); it != selector.end(); ++it) {
+		if (find( list.begin(), list.end(), *it ) == list.end())
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Add the session to the index
+ */
+void label_index_add( const string& session, const string& labels ) {
+	update_index( session, labels, true );
+}
+
+/**
+ * Remove the session from the index
+ */
+void label_index_remove( const string& session, const string& labels ) {
+	update_index( session, labels, false );
+}
+
+/**
+ * Find the sessions that have all the labels of the selector
+ */
+void label_index_select( const vector<string>& selector, vector<string> * sessions ) {
+	sessions->clear();
+	set<string> result;
+	for (vector<string>::const_iterator it = selector.begin(); it != selector.end(); ++it) {
+		CLISessionLock lock( "label", *it, false );
+		lock.acquire( -1 );
+
+		set<string> matches;
+		read_index( *it, &matches );
+		if (it == selector.begin()) {
+			result.swap( matches );
+		} else {
+			set<string> both;
+			set_intersection( result.begin(), result.end(), matches.begin(), matches.end(), inserter(both, both.begin()) );
+			result.swap( both );
+		}
+		if (result.empty()) break;
+	}
+	sessions->assign( result.begin(), result.end() );
+}
@@ -0,0 +1,71 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_LABELS_H
+#define CLI_LABELS_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Session labels
+ *
+ * A session has any number of key=value labels, kept in it's 'labels'
+ * parameter as a comma-separated list. The label index keeps a file
+ * for every label, listing the sessions that have it, so a selector
+ * is resolved by reading only the files of it's labels.
+ */
+
+/**
+ * Check if the label is in key=value format
+ */
+bool label_valid( const string& label );
+
+/**
+ * Split the 'labels' parameter of a session
+ */
+void label_split( const string& labels, vector<string> * out );
+
+/**
+ * Check if the 'labels' parameter has all the labels of the selector
+ */
+bool label_matches( const string& labels, const vector<string>& selector );
+
+/**
+ * Add the session to the index of each of it's labels
+ */
+void label_index_add( const string& session, const string& labels );
+
+/**
+ * Remove the session from the index of each of it's labels
+ */
+void label_index_remove( const string& session, const string& labels );
+
+/**
+ * Find the sessions that have all the labels of the selector
+ */
+void label_index_select( const vector<string>& selector, vector<string> * sessions );
+
+#endif /* end of include guard: CLI_LABELS_H */
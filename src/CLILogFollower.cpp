@@ -0,0 +1,225 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLILogFollower.h"
+#include "CLICancel.h"
+#include "CLIOutput.h"
+
+#include <deque>
+#include <map>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+/**
+ * How often to check the files where there are no notifications
+ */
+#define LOG_POLL_INTERVAL 	500
+
+/**
+ * Constructor for the follower
+ */
+CLILogFollower::CLILogFollower() : fd(-1) {
+}
+
+/**
+ * Close the notification handle
+ */
+CLILogFollower::~CLILogFollower() {
+#ifdef __linux__
+	if (fd >= 0) close( fd );
+#endif
+}
+
+/**
+ * Add a log file
+ */
+void CLILogFollower::add( const string& prefix, const string& path ) {
+	source src;
+	src.prefix = prefix;
+	src.path = path;
+	src.offset = 0;
+	src.inode = 0;
+
+	size_t sep = path.find_last_of("/\\");
+	if (sep == string::npos) {
+		src.folder = ".";
+		src.file = path;
+	} else {
+		src.folder = path.substr( 0, sep );
+		src.file = path.substr( sep + 1 );
+	}
+	sources.push_back( src );
+}
+
+/**
+ * Print the new lines of a file, or the last 'lines' of them
+ */
+void CLILogFollower::read( source& src, int lines ) {
+	struct stat st;
+	if (stat( src.path.c_str(), &st ) != 0)
+		return;
+
+	// Start over if the file was replaced or truncated
+	if (((unsigned long) st.st_ino != src.inode) || (st.st_size < src.offset)) {
+		src.inode = (unsigned long) st.st_ino;
+		src.offset = 0;
+		src.partial.clear();
+	}
+	if (st.st_size == src.offset)
+		return;
+
+	FILE * f = fopen( src.path.c_str(), "rb" );
+	if (f == NULL) return;
+	fseek( f, src.offset, SEEK_SET );
+
+	// Split the new data in lines, keeping the incomplete one for later
+	deque<string> tail;
+	char buf[65536];
+	size_t len;
+	while ((len = fread( buf, 1, sizeof(buf), f )) > 0) {
+		src.offset += len;
+		src.partial.append( buf, len );
+
+		size_t start = 0, eol;
+		while ((eol = src.partial.find('\n', start)) != string::npos) {
+			size_t end = ((eol > start) && (src.partial[eol-1] == '\r')) ? eol - 1 : eol;
+			string line = src.partial.substr( start, end - start );
+			start = eol + 1;
+			if (lines < 0) {
+				CLIOutputLine(CLI_STDOUT) << src.prefix << line;
+			} else if (lines > 0) {
+				tail.push_back( line );
+				if (tail.size() > (size_t)lines) tail.pop_front();
+			}
+		}
+		src.partial.erase( 0, start );
+	}
+	fclose( f );
+
+	for (deque<string>::iterator it = tail.begin(); it != tail.end(); ++it)
+		CLIOutputLine(CLI_STDOUT) << src.prefix << *it;
+}
+
+/**
+ * Print the last lines of every file
+ */
+void CLILogFollower::dump( int lines ) {
+	for (vector<source>::iterator it = sources.begin(); it != sources.end(); ++it)
+		read( *it, lines );
+}
+
+/**
+ * Print the incomplete lines at the end of the files
+ */
+void CLILogFollower::finish() {
+	for (vector<source>::iterator it = sources.begin(); it != sources.end(); ++it) {
+		if (!it->partial.empty())
+			CLIOutputLine(CLI_STDOUT) << it->prefix << it->partial;
+		it->partial.clear();
+	}
+}
+
+/**
+ * Print the lines appended to the files until the user cancels
+ */
+int CLILogFollower::follow() {
+	CLIDeadline deadline( 0 );
+
+#ifdef __linux__
+	// Watch the folders, so we notice when the files are replaced
+	map< int, vector<size_t> > watches;
+	vector<size_t> unwatched;
+	fd = inotify_init1( IN_CLOEXEC );
+	if (fd >= 0) {
+		for (size_t i=0; i<sources.size(); i++) {
+			int wd = inotify_add_watch( fd, sources[i].folder.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO );
+			if (wd < 0) {
+				CLIOutputLine(CLI_STDERR) << "[warn] Unable to watch " << sources[i].folder << " (" << strerror(errno) << "), checking it every " << LOG_POLL_INTERVAL << "ms";
+				unwatched.push_back( i );
+				continue;
+			}
+			watches[wd].push_back( i );
+		}
+
+		// If nothing could be watched, just poll all of them
+		if (watches.empty()) {
+			close( fd );
+			fd = -1;
+		}
+	}
+	if (fd >= 0) {
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+		struct timespec now, lastPoll;
+		clock_gettime( CLOCK_MONOTONIC, &lastPoll );
+		while (!CLICancel::requested()) {
+
+			// Check the files we could not watch in regular intervals
+			clock_gettime( CLOCK_MONOTONIC, &now );
+			if ((now.tv_sec - lastPoll.tv_sec) * 1000 + (now.tv_nsec - lastPoll.tv_nsec) / 1000000 >= LOG_POLL_INTERVAL) {
+				lastPoll = now;
+				for (vector<size_t>::iterator it = unwatched.begin(); it != unwatched.end(); ++it)
+					read( sources[*it], -1 );
+			}
+
+			// Wake up regularly to check for Ctrl-C
+			pfd.revents = 0;
+			if (poll( &pfd, 1, 100 ) <= 0)
+				continue;
+			ssize_t len = ::read( fd, buf, sizeof(buf) );
+			if (len <= 0)
+				continue;
+
+			// Read the files that changed
+			for (char * ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event *) ptr)->len) {
+				const struct inotify_event * ev = (const struct inotify_event *) ptr;
+				if ((ev->len == 0) || (watches.find(ev->wd) == watches.end()))
+					continue;
+				vector<size_t>& ids = watches[ev->wd];
+				for (vector<size_t>::iterator it = ids.begin(); it != ids.end(); ++it) {
+					if (sources[*it].file.compare(ev->name) == 0)
+						read( sources[*it], -1 );
+				}
+			}
+		}
+		return CLI_EXIT_CANCELLED;
+	}
+#endif
+
+	// Without notifications, check the files in regular intervals
+	while (deadline.sleep( LOG_POLL_INTERVAL )) {
+		for (vector<source>::iterator it = sources.begin(); it != sources.end(); ++it)
+			read( *it, -1 );
+	}
+	return CLI_EXIT_CANCELLED;
+}
@@ -0,0 +1,92 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_LOG_FOLLOWER_H
+#define CLI_LOG_FOLLOWER_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Prints log files and follows the lines appended to them
+ *
+ * All the files are followed by a single thread: on linux the folders
+ * of the files are watched with inotify, so nothing is read until the
+ * hypervisor writes something. Replaced or truncated files (like the
+ * logs VirtualBox rotates on every start) are read again from the top.
+ */
+class CLILogFollower {
+public:
+
+	/**
+	 * Constructor for the follower
+	 */
+	CLILogFollower();
+
+	/**
+	 * Close the notification handle
+	 */
+	~CLILogFollower();
+
+	/**
+	 * Add a log file, prefixing it's lines with the given string
+	 */
+	void 	add( const string& prefix, const string& path );
+
+	/**
+	 * Print the last 'lines' lines of every file (or all of them if negative)
+	 */
+	void 	dump( int lines );
+
+	/**
+	 * Print the lines appended to the files until the user cancels,
+	 * then return CLI_EXIT_CANCELLED
+	 */
+	int 	follow();
+
+	/**
+	 * Print the incomplete lines at the end of the files
+	 */
+	void 	finish();
+
+private:
+
+	struct source {
+		string 			prefix;
+		string 			path;
+		string 			folder;
+		string 			file;
+		long 			offset;
+		unsigned long 	inode;
+		string 			partial;
+	};
+
+	void 	read( source& src, int lines );
+
+	vector<source> 	sources;
+	int 			fd;
+
+};
+
+#endif /* end of include guard: CLI_LOG_FOLLOWER_H */
@@ -0,0 +1,357 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+#include "CLIMetrics.h"
+#include "CLIOutput.h"
+#include "cli-utils.h"
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+
+#include <iostream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+using boost::asio::ip::tcp;
+
+/**
+ * How many seconds to wait for the request of a scraper
+ */
+#define METRICS_READ_TIMEOUT 	10
+
+/**
+ * The largest request we accept
+ */
+#define METRICS_MAX_REQUEST 	8192
+
+/**
+ * Upper bounds (in seconds) of the latency histogram buckets
+ */
+static const double LATENCY_BUCKETS[] = { 0.5, 1, 2.5, 5, 10, 30, 60, 120, 300 };
+static const size_t LATENCY_BUCKET_COUNT = sizeof(LATENCY_BUCKETS) / sizeof(double);
+
+/**
+ * The operations we are tracking
+ */
+static const char * METRIC_OPERATIONS[] = { "start", "stop", "save", "resume" };
+static const size_t METRIC_OPERATION_COUNT = sizeof(METRIC_OPERATIONS) / sizeof(char *);
+
+/**
+ * Escape a label value for the prometheus text format
+ */
+static string escape_label( const string& value ) {
+	string ans;
+	for (size_t i=0; i<value.length(); i++) {
+		char c = value[i];
+		if (c == '\\') {
+			ans += "\\\\";
+		} else if (c == '"') {
+			ans += "\\\"";
+		} else if (c == '\n') {
+			ans += "\\n";
+		} else {
+			ans += c;
+		}
+	}
+	return ans;
+}
+
+/**
+ * Append the duration of an operation to the latency journal
+ */
+void metrics_record_latency( const string& operation, double seconds ) {
+	ostringstream oss;
+	oss << operation << " " << seconds;
+	CLIJournal::append( "latency.log", oss.str() );
+}
+
+/**
+ * Constructor for the exporter
+ */
+CLIMetricsExporter::CLIMetricsExporter( const HVInstancePtr& hv, const boost::shared_ptr<CLIRegistryWatcher>& watcher, int refreshInterval )
+	: hv(hv), watcher(watcher), refreshInterval(refreshInterval), journal("latency.log") {
+
+	// Prepare empty histograms for the operations we know
+	for (size_t i=0; i<METRIC_OPERATION_COUNT; i++) {
+		CLIMetricsHistogram h;
+		h.buckets.resize( LATENCY_BUCKET_COUNT, 0 );
+		h.count = 0;
+		h.sum = 0;
+		histograms[ METRIC_OPERATIONS[i] ] = h;
+	}
+
+	// Start with an empty snapshot
+	snapshotData = boost::make_shared<const string>( "" );
+
+}
+
+/**
+ * Start the background refresh thread
+ */
+void CLIMetricsExporter::start() {
+	// Render the first snapshot before we start serving
+	refresh( NULL );
+	thread = boost::make_shared<boost::thread>( boost::bind(&CLIMetricsExporter::refreshThread, this) );
+}
+
+/**
+ * Return the last rendered snapshot
+ */
+boost::shared_ptr<const string> CLIMetricsExporter::snapshot() {
+	boost::mutex::scoped_lock lock(snapshotMutex);
+	return snapshotData;
+}
+
+/**
+ * Periodically re-render the snapshot
+ */
+void CLIMetricsExporter::refreshThread() {
+	set<string> changed, removed;
+	while (true) {
+		changed.clear();
+		removed.clear();
+		watcher->wait( refreshInterval * 1000, &changed, &removed );
+		refresh( &changed );
+	}
+}
+
+/**
+ * Consume the new entries of the latency journal
+ */
+void CLIMetricsExporter::readJournal() {
+	vector<string> lines;
+	journal.read( &lines );
+	for (vector<string>::iterator it = lines.begin(); it != lines.end(); ++it) {
+
+		// Parse '<operation> <seconds>'
+		istringstream iss( *it );
+		string operation;
+		double seconds = 0;
+		if (!(iss >> operation >> seconds))
+			continue;
+		if (histograms.find(operation) == histograms.end())
+			continue;
+
+		// Update histogram
+		CLIMetricsHistogram& h = histograms[operation];
+		for (size_t i=0; i<LATENCY_BUCKET_COUNT; i++) {
+			if (seconds <= LATENCY_BUCKETS[i])
+				h.buckets[i]++;
+		}
+		h.count++;
+		h.sum += seconds;
+	}
+}
+
+/**
+ * Render the latency histograms
+ */
+void CLIMetricsExporter::renderHistograms( ostringstream& oss ) {
+	oss << "# HELP cernvm_cli_operation_duration_seconds Duration of the session operations performed by cernvm-cli" << endl;
+	oss << "# TYPE cernvm_cli_operation_duration_seconds histogram" << endl;
+	for (map< string, CLIMetricsHistogram >::iterator it = histograms.begin(); it != histograms.end(); ++it) {
+		const string& op = it->first;
+		CLIMetricsHistogram& h = it->second;
+		for (size_t i=0; i<LATENCY_BUCKET_COUNT; i++) {
+			oss << "cernvm_cli_operation_duration_seconds_bucket{operation=\"" << op << "\",le=\"" << LATENCY_BUCKETS[i] << "\"} " << h.buckets[i] << endl;
+		}
+		oss << "cernvm_cli_operation_duration_seconds_bucket{operation=\"" << op << "\",le=\"+Inf\"} " << h.count << endl;
+		oss << "cernvm_cli_operation_duration_seconds_sum{operation=\"" << op << "\"} " << h.sum << endl;
+		oss << "cernvm_cli_operation_duration_seconds_count{operation=\"" << op << "\"} " << h.count << endl;
+	}
+}
+
+/**
+ * Re-render the metrics snapshot, synchronizing the state of the
+ * sessions in 'changed' (or of all of them if NULL)
+ */
+void CLIMetricsExporter::refresh( const set<string> * changed ) {
+	ostringstream oss, ossState, ossRam, ossCpus, ossDisk;
+
+	// Collect the per-session metrics
+	for (std::map< std::string, HVSessionPtr >::iterator it = hv->sessions.begin(); it != hv->sessions.end(); ++it) {
+		HVSessionPtr sess = (*it).second;
+
+		// Synchronize state
+		const string name = sess->parameters->get("name", "");
+		if ((changed == NULL) || (changed->find(name) != changed->end()))
+			sess->update();
+
+		string labels = "session=\"" + escape_label(name) + "\",uuid=\"" + escape_label((*it).first) + "\"";
+		int state = sess->local->getNum<int>( "state", -1 );
+		for (int s=SS_MISSING; s<=SS_RUNNING; s++) {
+			ossState << "cernvm_session_state{" << labels << ",state=\"" << get_state_name(s) << "\"} " << (state == s ? 1 : 0) << endl;
+		}
+		ossRam   << "cernvm_session_ram_megabytes{" << labels << "} " << sess->parameters->get("ram", "512") << endl;
+		ossCpus  << "cernvm_session_cpus{" << labels << "} " << sess->parameters->get("cpus", "1") << endl;
+		ossDisk  << "cernvm_session_disk_megabytes{" << labels << "} " << sess->parameters->get("disk", "1024") << endl;
+	}
+
+	// Render everything
+	oss << "# HELP cernvm_sessions Number of sessions registered with libCernVM" << endl;
+	oss << "# TYPE cernvm_sessions gauge" << endl;
+	oss << "cernvm_sessions " << hv->sessions.size() << endl;
+	oss << "# HELP cernvm_session_state Current state of the session" << endl;
+	oss << "# TYPE cernvm_session_state gauge" << endl;
+	oss << ossState.str();
+	oss << "# HELP cernvm_session_ram_megabytes Memory configured for the session" << endl;
+	oss << "# TYPE cernvm_session_ram_megabytes gauge" << endl;
+	oss << ossRam.str();
+	oss << "# HELP cernvm_session_cpus Number of CPUs configured for the session" << endl;
+	oss << "# TYPE cernvm_session_cpus gauge" << endl;
+	oss << ossCpus.str();
+	oss << "# HELP cernvm_session_disk_megabytes Disk size configured for the session" << endl;
+	oss << "# TYPE cernvm_session_disk_megabytes gauge" << endl;
+	oss << ossDisk.str();
+
+	// Update and render histograms
+	readJournal();
+	renderHistograms( oss );
+
+	// Timestamp of the snapshot
+	boost::posix_time::time_duration t = boost::posix_time::second_clock::universal_time() - boost::posix_time::ptime(boost::gregorian::date(1970,1,1));
+	oss << "# HELP cernvm_exporter_last_refresh_timestamp_seconds When the metrics were last collected" << endl;
+	oss << "# TYPE cernvm_exporter_last_refresh_timestamp_seconds gauge" << endl;
+	oss << "cernvm_exporter_last_refresh_timestamp_seconds " << t.total_seconds() << endl;
+
+	// Swap snapshot
+	boost::shared_ptr<const string> data = boost::make_shared<const string>( oss.str() );
+	boost::mutex::scoped_lock lock(snapshotMutex);
+	snapshotData = data;
+}
+
+/**
+ * A connection of a scraper, with it's own I/O service so it
+ * can be served by it's own thread
+ */
+struct CLIMetricsRequest {
+	boost::asio::io_service 	io;
+	tcp::socket 				socket;
+
+	CLIMetricsRequest() : socket(io) { };
+};
+
+/**
+ * The scraper did not send it's request in time
+ */
+static void request_timeout( tcp::socket * socket, const boost::system::error_code& ec ) {
+	boost::system::error_code ignored;
+	if (ec != boost::asio::error::operation_aborted)
+		socket->close( ignored );
+}
+
+/**
+ * The request of the scraper was received
+ */
+static void request_received( boost::asio::deadline_timer * timer, boost::system::error_code * result, const boost::system::error_code& ec ) {
+	*result = ec;
+	timer->cancel();
+}
+
+/**
+ * Answer a single scrape
+ */
+static void serve_request( boost::shared_ptr<CLIMetricsRequest> req, CLIMetricsExporter * exporter ) {
+	tcp::socket * socket = &req->socket;
+	boost::system::error_code ec;
+
+	// Read request headers, but don't let a client that never
+	// completes it's request hold the thread forever
+	boost::asio::streambuf request( METRICS_MAX_REQUEST );
+	boost::asio::deadline_timer timer( req->io, boost::posix_time::seconds(METRICS_READ_TIMEOUT) );
+	timer.async_wait( boost::bind(&request_timeout, socket, boost::asio::placeholders::error) );
+	boost::asio::async_read_until( *socket, request, "\r\n\r\n",
+		boost::bind(&request_received, &timer, &ec, boost::asio::placeholders::error) );
+	req->io.run();
+	if (ec) {
+		socket->close( ec );
+		return;
+	}
+
+	// Parse request line
+	istream is( &request );
+	string method, path;
+	is >> method >> path;
+
+	// Build response
+	ostringstream oss;
+	boost::shared_ptr<const string> body;
+	if ((method.compare("GET") == 0) && (path.compare("/metrics") == 0)) {
+		body = exporter->snapshot();
+		oss << "HTTP/1.0 200 OK\r\n";
+		oss << "Content-Type: text/plain; version=0.0.4\r\n";
+	} else {
+		body = boost::make_shared<const string>( "Not found\n" );
+		oss << "HTTP/1.0 404 Not Found\r\n";
+		oss << "Content-Type: text/plain\r\n";
+	}
+	oss << "Content-Length: " << body->length() << "\r\n";
+	oss << "Connection: close\r\n\r\n";
+
+	// Send response
+	string headers = oss.str();
+	boost::asio::write( *socket, boost::asio::buffer(headers), ec );
+	if (!ec) boost::asio::write( *socket, boost::asio::buffer(*body), ec );
+	socket->close( ec );
+}
+
+/**
+ * Serve the /metrics endpoint on the given address
+ */
+int CLIMetricsExporter::serve( const string& host, int port ) {
+	boost::asio::io_service io;
+	boost::system::error_code ec;
+
+	// Bind on the specified address
+	tcp::acceptor acceptor( io );
+	tcp::endpoint endpoint( boost::asio::ip::address::from_string(host, ec), port );
+	if (ec) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: Invalid listen address '" << host << "'";
+		return 5;
+	}
+	acceptor.open( endpoint.protocol(), ec );
+	if (!ec) acceptor.set_option( tcp::acceptor::reuse_address(true), ec );
+	if (!ec) acceptor.bind( endpoint, ec );
+	if (!ec) acceptor.listen( boost::asio::socket_base::max_connections, ec );
+	if (ec) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: Unable to listen on " << host << ":" << port << " (" << ec.message() << ")";
+		return 3;
+	}
+
+#ifndef _WIN32
+	// Scrapers that go away should not kill us
+	signal( SIGPIPE, SIG_IGN );
+#endif
+
+	// Every scrape is served by it's own thread, so a slow client
+	// does not block the others
+	while (true) {
+		boost::shared_ptr<CLIMetricsRequest> req = boost::make_shared<CLIMetricsRequest>();
+		acceptor.accept( req->socket, ec );
+		if (ec) continue;
+		boost::thread( boost::bind(&serve_request, req, this) ).detach();
+	}
+
+	return 0;
+}
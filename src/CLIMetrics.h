@@ -0,0 +1,131 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+#pragma once
+#ifndef CLI_METRICS_H
+#define CLI_METRICS_H
+
+#include <CernVM/Hypervisor.h>
+#include "CLIRegistryWatcher.h"
+#include "CLIJournal.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Append the duration of an operation to the latency journal.
+ *
+ * The journal is shared by all the cernvm-cli processes and it's
+ * consumed by the metrics exporter.
+ */
+void metrics_record_latency( const string& operation, double seconds );
+
+/**
+ * Measures the time spent in the current scope and records it
+ * in the latency journal upon destruction.
+ */
+class CLIMetricsTimer {
+public:
+
+	CLIMetricsTimer( const string& operation )
+		: operation(operation), started(boost::posix_time::microsec_clock::universal_time()) { };
+
+	~CLIMetricsTimer() {
+		boost::posix_time::time_duration d = boost::posix_time::microsec_clock::universal_time() - started;
+		metrics_record_latency( operation, d.total_microseconds() / 1000000.0 );
+	};
+
+private:
+	string 						operation;
+	boost::posix_time::ptime 	started;
+
+};
+
+/**
+ * Cumulative latency histogram of a single operation
+ */
+struct CLIMetricsHistogram {
+	vector<unsigned long> 		buckets;
+	unsigned long 				count;
+	double 						sum;
+};
+
+/**
+ * Prometheus-format metrics exporter
+ *
+ * The metrics are rendered by a background thread in regular intervals,
+ * so the cost of a scrape does not depend on the number of sessions.
+ * After the first refresh, only the sessions the registry watcher
+ * reports as changed are synchronized with the hypervisor.
+ */
+class CLIMetricsExporter {
+public:
+
+	/**
+	 * Constructor for the exporter
+	 */
+	CLIMetricsExporter( const HVInstancePtr& hv, const boost::shared_ptr<CLIRegistryWatcher>& watcher, int refreshInterval );
+
+	/**
+	 * Start the background refresh thread
+	 */
+	void 	start();
+
+	/**
+	 * Serve the /metrics endpoint on the given address (blocking)
+	 */
+	int 	serve( const string& host, int port );
+
+	/**
+	 * Return the last rendered snapshot
+	 */
+	boost::shared_ptr<const string> 	snapshot();
+
+private:
+
+	void 	refreshThread();
+	void 	refresh( const set<string> * changed );
+	void 	readJournal();
+	void 	renderHistograms( ostringstream& oss );
+
+	HVInstancePtr 						hv;
+	boost::shared_ptr<CLIRegistryWatcher> 	watcher;
+	int 								refreshInterval;
+
+	boost::mutex 						snapshotMutex;
+	boost::shared_ptr<const string> 	snapshotData;
+
+	map< string, CLIMetricsHistogram > 	histograms;
+	CLIJournal 							journal;
+
+	boost::shared_ptr<boost::thread> 	thread;
+
+};
+
+#endif /* end of include guard: CLI_METRICS_H */
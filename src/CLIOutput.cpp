@@ -0,0 +1,275 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+#include "CLIOutput.h"
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <iostream>
+
+// Event types
+#define EV_LINE 		0
+#define EV_WRITE 		1
+#define EV_STATUS 		2
+#define EV_FLUSH 		3
+
+/**
+ * Used by flush() to wait for the output thread
+ */
+struct CLIOutputFlushToken {
+	boost::mutex 				mutex;
+	boost::condition_variable 	cond;
+	bool 						done;
+};
+
+/**
+ * An event on the output queue
+ */
+struct CLIOutputEvent {
+	int 										type;
+	int 										stream;
+	std::string 								text;
+	boost::shared_ptr<CLIOutputFlushToken> 		token;
+	CLIOutputEvent * 							next;
+};
+
+/**
+ * The queue is a lock-free stack the producers push to. The output
+ * thread takes the whole stack at once and reverses it to get the
+ * events in the order they were posted.
+ */
+static boost::atomic<CLIOutputEvent *> 	queueHead( (CLIOutputEvent *) NULL );
+
+// Wake-up of the output thread (producers never wait on it)
+static boost::mutex 					wakeMutex;
+static boost::condition_variable 		wakeCond;
+
+// Output thread state
+static boost::shared_ptr<boost::thread> outputThread;
+static boost::atomic<bool> 				running( false );
+static size_t 							statusLength = 0;
+
+// Only one thread writes to the terminal at a time. That's always the
+// output thread while it's running, so this is only contended on stop.
+static boost::mutex 					renderMutex;
+
+/**
+ * Remove the status message from the terminal
+ */
+static void clear_status() {
+	if (statusLength == 0) return;
+	size_t i;
+	for (i=0; i<statusLength; i++) { std::cerr << "\b"; };
+	for (i=0; i<statusLength; i++) { std::cerr << " "; };
+	for (i=0; i<statusLength; i++) { std::cerr << "\b"; };
+	std::cerr.flush();
+	statusLength = 0;
+}
+
+/**
+ * Write an event to the terminal
+ */
+static void render( CLIOutputEvent * ev ) {
+	std::ostream & os = (ev->stream == CLI_STDOUT) ? std::cout : std::cerr;
+	switch (ev->type) {
+		case EV_LINE:
+			clear_status();
+			os << ev->text << std::endl;
+			break;
+
+		case EV_WRITE:
+			clear_status();
+			os << ev->text;
+			os.flush();
+			break;
+
+		case EV_STATUS:
+			clear_status();
+			std::cerr << ev->text;
+			std::cerr.flush();
+			statusLength = ev->text.length();
+			break;
+
+		case EV_FLUSH:
+			std::cout.flush();
+			std::cerr.flush();
+			{
+				boost::mutex::scoped_lock lock(ev->token->mutex);
+				ev->token->done = true;
+			}
+			ev->token->cond.notify_all();
+			break;
+	}
+}
+
+/**
+ * Write out everything on the queue. Returns false if it was empty.
+ */
+static bool drain() {
+	boost::mutex::scoped_lock lock(renderMutex);
+	CLIOutputEvent * ev = queueHead.exchange( NULL );
+	if (ev == NULL)
+		return false;
+
+	// Reverse to get the order they were posted in
+	CLIOutputEvent * ordered = NULL;
+	while (ev != NULL) {
+		CLIOutputEvent * next = ev->next;
+		ev->next = ordered;
+		ordered = ev;
+		ev = next;
+	}
+
+	// Render
+	while (ordered != NULL) {
+		CLIOutputEvent * next = ordered->next;
+		render( ordered );
+		delete ordered;
+		ordered = next;
+	}
+	return true;
+}
+
+/**
+ * Push an event on the queue
+ */
+static void post( CLIOutputEvent * ev ) {
+
+	// Write directly if there is no output thread, after anything
+	// that is still on the queue
+	if (!running) {
+		drain();
+		boost::mutex::scoped_lock lock(renderMutex);
+		render( ev );
+		delete ev;
+		return;
+	}
+
+	// Push on the lock-free stack. This and the exchange in drain() are
+	// sequentially consistent with 'running', so the check below sees
+	// if the output thread could have missed the event.
+	CLIOutputEvent * head = queueHead.load( boost::memory_order_relaxed );
+	do {
+		ev->next = head;
+	} while (!queueHead.compare_exchange_weak( head, ev ));
+
+	// stop() came in between and the output thread might have already
+	// drained for the last time, so write it out ourselves
+	if (!running) {
+		drain();
+		return;
+	}
+
+	// Wake up the output thread (a missed wake-up only costs a short delay)
+	wakeCond.notify_one();
+}
+
+/**
+ * The output thread
+ */
+static void output_thread() {
+	while (running) {
+		if (!drain()) {
+			boost::mutex::scoped_lock lock(wakeMutex);
+			wakeCond.timed_wait( lock, boost::posix_time::milliseconds(50) );
+		}
+	}
+	drain();
+}
+
+/**
+ * Start the output thread
+ */
+void CLIOutput::start() {
+	if (running) return;
+	running = true;
+	outputThread = boost::make_shared<boost::thread>( &output_thread );
+}
+
+/**
+ * Stop the output thread
+ */
+void CLIOutput::stop() {
+	if (!running) return;
+	running = false;
+	wakeCond.notify_one();
+	outputThread->join();
+	outputThread.reset();
+	drain();
+	boost::mutex::scoped_lock lock(renderMutex);
+	clear_status();
+}
+
+/**
+ * Print a line
+ */
+void CLIOutput::line( int stream, const std::string& text ) {
+	CLIOutputEvent * ev = new CLIOutputEvent();
+	ev->type = EV_LINE;
+	ev->stream = stream;
+	ev->text = text;
+	post( ev );
+}
+
+/**
+ * Print text
+ */
+void CLIOutput::write( int stream, const std::string& text ) {
+	CLIOutputEvent * ev = new CLIOutputEvent();
+	ev->type = EV_WRITE;
+	ev->stream = stream;
+	ev->text = text;
+	post( ev );
+}
+
+/**
+ * Show a status message
+ */
+void CLIOutput::status( const std::string& text ) {
+	CLIOutputEvent * ev = new CLIOutputEvent();
+	ev->type = EV_STATUS;
+	ev->stream = CLI_STDERR;
+	ev->text = text;
+	post( ev );
+}
+
+/**
+ * Wait for everything to be written out
+ */
+void CLIOutput::flush() {
+	CLIOutputEvent * ev = new CLIOutputEvent();
+	boost::shared_ptr<CLIOutputFlushToken> token = boost::make_shared<CLIOutputFlushToken>();
+	token->done = false;
+	ev->type = EV_FLUSH;
+	ev->stream = CLI_STDERR;
+	ev->token = token;
+	post( ev );
+
+	// Wait for the output thread to reach it
+	boost::mutex::scoped_lock lock(token->mutex);
+	while (!token->done)
+		token->cond.wait( lock );
+}
@@ -0,0 +1,108 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+#pragma once
+#ifndef CLI_OUTPUT_H
+#define CLI_OUTPUT_H
+
+#include <sstream>
+#include <string>
+
+/**
+ * Output streams
+ */
+#define CLI_STDOUT 		1
+#define CLI_STDERR 		2
+
+/**
+ * The single owner of the terminal
+ *
+ * Any thread can post output events without blocking: they are pushed
+ * on a lock-free queue and written out in order by the output thread.
+ * Until the output thread is started, events are written directly.
+ */
+class CLIOutput {
+public:
+
+	/**
+	 * Start the output thread
+	 */
+	static void 	start();
+
+	/**
+	 * Write out everything pending and stop the output thread
+	 */
+	static void 	stop();
+
+	/**
+	 * Print a complete line on the given stream
+	 */
+	static void 	line( int stream, const std::string& text );
+
+	/**
+	 * Print text on the given stream, without a new line
+	 */
+	static void 	write( int stream, const std::string& text );
+
+	/**
+	 * Show a transient status message on stderr, that is replaced by
+	 * the next status or output line
+	 */
+	static void 	status( const std::string& text );
+
+	/**
+	 * Block until all the events posted so far are written out
+	 */
+	static void 	flush();
+
+};
+
+/**
+ * Collects a line with the stream operators and prints it when destroyed:
+ *
+ *   CLIOutputLine(CLI_STDERR) << "[ ok ] " << name;
+ */
+class CLIOutputLine {
+public:
+	CLIOutputLine( int stream ) : stream(stream) { };
+	~CLIOutputLine() { CLIOutput::line( stream, oss.str() ); };
+
+	template <typename T>
+	CLIOutputLine& operator<< ( const T& value ) {
+		oss << value;
+		return *this;
+	};
+
+private:
+	int 				stream;
+	std::ostringstream 	oss;
+
+};
+
+/**
+ * Keeps the output thread running while in scope
+ */
+class CLIOutputScope {
+public:
+	CLIOutputScope() 	{ CLIOutput::start(); };
+	~CLIOutputScope() 	{ CLIOutput::stop(); };
+};
+
+#endif /* end of include guard: CLI_OUTPUT_H */
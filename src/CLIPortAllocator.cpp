@@ -0,0 +1,179 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLIPortAllocator.h"
+#include "CLISessionLock.h"
+#include "cli-utils.h"
+
+#include <fstream>
+#include <map>
+#include <stdio.h>
+
+#define BITS_PER_WORD 	(sizeof(unsigned long) * 8)
+
+/**
+ * Constructor
+ */
+CLIPortAllocator::CLIPortAllocator( int first, int last ) : first(first), last(last), cursor(0) {
+	bitmap.resize( (last - first) / BITS_PER_WORD + 1, 0 );
+
+	// Mark the bits after the end of the range as used
+	size_t count = last - first + 1;
+	for (size_t i = count; i < bitmap.size() * BITS_PER_WORD; i++)
+		bitmap[i / BITS_PER_WORD] |= (1UL << (i % BITS_PER_WORD));
+}
+
+/**
+ * Mark the port as used
+ */
+void CLIPortAllocator::reserve( int port ) {
+	if ((port < first) || (port > last)) return;
+	size_t i = port - first;
+	bitmap[i / BITS_PER_WORD] |= (1UL << (i % BITS_PER_WORD));
+}
+
+/**
+ * Mark the port as free
+ */
+void CLIPortAllocator::release( int port ) {
+	if ((port < first) || (port > last)) return;
+	size_t i = port - first;
+	bitmap[i / BITS_PER_WORD] &= ~(1UL << (i % BITS_PER_WORD));
+	if (i / BITS_PER_WORD < cursor)
+		cursor = i / BITS_PER_WORD;
+}
+
+/**
+ * Check if the port is used
+ */
+bool CLIPortAllocator::used( int port ) const {
+	if ((port < first) || (port > last)) return false;
+	size_t i = port - first;
+	return (bitmap[i / BITS_PER_WORD] & (1UL << (i % BITS_PER_WORD))) != 0;
+}
+
+/**
+ * Return a free port
+ */
+int CLIPortAllocator::allocate() {
+	// Skip the full words
+	while ((cursor < bitmap.size()) && (bitmap[cursor] == ~0UL))
+		cursor++;
+	if (cursor >= bitmap.size())
+		return -1;
+
+	// Take the lowest free bit of the word
+	unsigned long avail = ~bitmap[cursor];
+	unsigned long lowest = avail & (~avail + 1);
+	size_t bit = 0;
+	while ((lowest >> bit) != 1) bit++;
+	bitmap[cursor] |= lowest;
+	return first + (int)(cursor * BITS_PER_WORD + bit);
+}
+
+/**
+ * Read the port index
+ */
+static void read_index( map<string, int> * ports ) {
+	ports->clear();
+	ifstream f( get_cli_data_path("ports.index").c_str() );
+	string line;
+	while (getline(f, line)) {
+		// '<port> <session>', where the name is the rest of the line
+		size_t pos = line.find(' ');
+		if ((pos == string::npos) || (pos + 1 >= line.length()))
+			continue;
+		int port = ston<int>( line.substr(0, pos) );
+		if (port > 0)
+			(*ports)[ line.substr(pos + 1) ] = port;
+	}
+}
+
+/**
+ * Write the port index, replacing the previous one only if all of it
+ * was written. Returns false if the index was not updated.
+ */
+static bool write_index( const map<string, int>& ports ) {
+	string filename = get_cli_data_path( "ports.index" );
+	string tmpFile = filename + ".tmp";
+	{
+		ofstream f( tmpFile.c_str(), ios::trunc );
+		for (map<string, int>::const_iterator it = ports.begin(); it != ports.end(); ++it)
+			f << (*it).second << " " << (*it).first << "\n";
+		f.close();
+		if (f.fail()) {
+			remove( tmpFile.c_str() );
+			return false;
+		}
+	}
+#ifdef _WIN32
+	// rename() does not replace existing files on windows
+	remove( filename.c_str() );
+#endif
+	if (rename( tmpFile.c_str(), filename.c_str() ) != 0) {
+		remove( tmpFile.c_str() );
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Allocate a host port for the session
+ */
+int port_index_allocate( const string& session, const vector<int>& inUse ) {
+	CLISessionLock lock( "port", "index", true );
+	lock.acquire( -1 );
+
+	map<string, int> ports;
+	read_index( &ports );
+	if (ports.find(session) != ports.end())
+		return ports[session];
+
+	// Mark everything we know about as used
+	CLIPortAllocator allocator;
+	for (map<string, int>::iterator it = ports.begin(); it != ports.end(); ++it)
+		allocator.reserve( (*it).second );
+	for (vector<int>::const_iterator it = inUse.begin(); it != inUse.end(); ++it)
+		allocator.reserve( *it );
+
+	int port = allocator.allocate();
+	if (port < 0)
+		return -1;
+
+	// A port that is not in the index could be given out again
+	ports[session] = port;
+	if (!write_index( ports ))
+		return -1;
+	return port;
+}
+
+/**
+ * Remove the port of the session from the port index
+ */
+void port_index_release( const string& session ) {
+	CLISessionLock lock( "port", "index", true );
+	lock.acquire( -1 );
+
+	map<string, int> ports;
+	read_index( &ports );
+	if (ports.erase(session) > 0)
+		write_index( ports );
+}
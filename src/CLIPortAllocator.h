@@ -0,0 +1,96 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_PORT_ALLOCATOR_H
+#define CLI_PORT_ALLOCATOR_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * The range of host ports given to the API forwarding of the sessions
+ */
+#define CLI_PORT_FIRST 		20000
+#define CLI_PORT_LAST 		29999
+
+/**
+ * Bitmap of the used ports in a range
+ *
+ * Ports are handed out from the lowest free one. A cursor points to
+ * the first word that might have a free bit, so allocation does not
+ * scan the words that are already full.
+ */
+class CLIPortAllocator {
+public:
+
+	/**
+	 * Create an allocator for the ports in [first, last]
+	 */
+	CLIPortAllocator( int first = CLI_PORT_FIRST, int last = CLI_PORT_LAST );
+
+	/**
+	 * Mark the port as used (ports out of the range are ignored)
+	 */
+	void 	reserve( int port );
+
+	/**
+	 * Mark the port as free
+	 */
+	void 	release( int port );
+
+	/**
+	 * Check if the port is used
+	 */
+	bool 	used( int port ) const;
+
+	/**
+	 * Return a free port and mark it as used, or -1 if all are used
+	 */
+	int 	allocate();
+
+private:
+
+	int 					first;
+	int 					last;
+	vector<unsigned long> 	bitmap;
+	size_t 					cursor;
+
+};
+
+/**
+ * Allocate a host port for the session, that is not in the port index
+ * nor in 'inUse'. The port is recorded in the index, which is locked
+ * so that concurrent processes never get the same port.
+ *
+ * If the session already has a port in the index, that port is returned.
+ * Returns -1 if there are no free ports or the index can't be written.
+ */
+int port_index_allocate( const string& session, const vector<int>& inUse );
+
+/**
+ * Remove the port of the session from the port index
+ */
+void port_index_release( const string& session );
+
+#endif /* end of include guard: CLI_PORT_ALLOCATOR_H */
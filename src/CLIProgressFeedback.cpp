@@ -19,6 +19,7 @@
  */
 
 #include "CLIProgressFeedback.h"
+#include "CLIOutput.h"
 #include <math.h>
 
 void CLIProgessFeedback::bindTo( const FiniteTaskPtr & pf ) {
@@ -32,22 +33,22 @@ void CLIProgessFeedback::bindTo( const FiniteTaskPtr & pf ) {
 void CLIProgessFeedback::fb_started(VariantArgList& args) {
 	if (silent) return;
 	std::ostringstream oss;
-	oss << "[----] " << boost::get<string>( args[0] );
-	showMessage(oss);
+	oss << "[----] " << prefix << boost::get<string>( args[0] );
+	CLIOutput::status(oss.str());
 }
 
 void CLIProgessFeedback::fb_completed(VariantArgList& args) {
 	if (silent) return;
-	clearMessage();
-    cerr << "[ ok ] " << boost::get<string>( args[0] ) << endl;
+	std::ostringstream oss;
+	oss << "[ ok ] " << prefix << boost::get<string>( args[0] );
+	CLIOutput::line(CLI_STDERR, oss.str());
 }
 
 void CLIProgessFeedback::fb_failed(VariantArgList& args) {
 	if (silent) return;
 	std::ostringstream oss;
-	oss << "[!!!!] " << boost::get<string>( args[0] );
-	showMessage(oss);
-	cerr << endl;
+	oss << "[!!!!] " << prefix << boost::get<string>( args[0] );
+	CLIOutput::line(CLI_STDERR, oss.str());
 }
 
 void CLIProgessFeedback::fb_progress(VariantArgList& args) {
@@ -59,30 +60,6 @@ void CLIProgessFeedback::fb_progress(VariantArgList& args) {
 	if (percentInt < 100) { oss << " "; }
 	if (percentInt < 10) { oss << " "; }
 
-	oss << "%] " << boost::get<string>( args[0] );
-	showMessage(oss);
-}
-
-void CLIProgessFeedback::showMessage(const std::ostringstream& ss) {
-	if (silent) return;
-	std::string msg = ss.str();
-	if (messageLength > 0)
-		clearMessage();
-	messageLength = msg.length();
-	cerr << msg;
-	cerr.flush();
-}
-
-void CLIProgessFeedback::clearMessage() {
-	if (silent) return;
-	if (messageLength <= 0) return;
-	// Clear area
-	int i;
-	for (i=0; i<messageLength; i++) { cerr << "\b"; };
-	for (i=0; i<messageLength; i++) { cerr << " "; };
-	// Rewind cursor
-	for (i=0; i<messageLength; i++) { cerr << "\b"; };
-	// Reset
-	cerr.flush();
-	messageLength = 0;
+	oss << "%] " << prefix << boost::get<string>( args[0] );
+	CLIOutput::status(oss.str());
 }
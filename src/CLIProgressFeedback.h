@@ -37,15 +37,15 @@ using namespace std;
 /**
  * A class through interaction with the user can happen
  *
- * This implementation does command-line interaction.
+ * This implementation does command-line interaction. The messages are
+ * posted to CLIOutput, so the callbacks can fire from any thread.
  */
 class CLIProgessFeedback {
 public:
 
 	// Constructor
-	CLIProgessFeedback() {
+	CLIProgessFeedback( const std::string& prefix = "" ) : prefix(prefix) {
 		silent = false;
-        messageLength = 0;
 	}
 
 	void 	bindTo( const FiniteTaskPtr & pf );
@@ -62,9 +62,7 @@ private:
 
 	void 	fb_progress(VariantArgList& args);
 
-	int 	messageLength;
-	void 	showMessage(const std::ostringstream& ss);
-	void 	clearMessage();
+	std::string 	prefix;
 
 };
 
@@ -0,0 +1,210 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLIReclaimer.h"
+#include "CLISessionLock.h"
+#include "CLICancel.h"
+#include "cli-utils.h"
+
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+// Size of a truncation step
+#define RECLAIM_STEP 		(64LL * 1024 * 1024)
+
+/**
+ * Return the queue folder
+ */
+static string queue_dir() {
+	string dir = get_cli_data_path( "reclaim" );
+#ifdef _WIN32
+	_mkdir( dir.c_str() );
+#else
+	mkdir( dir.c_str(), 0700 );
+#endif
+	return dir;
+}
+
+/**
+ * List the entries of a folder (without '.' and '..')
+ */
+static void list_dir( const string& path, vector<string> * entries ) {
+	entries->clear();
+#ifdef _WIN32
+	WIN32_FIND_DATAA data;
+	HANDLE h = FindFirstFileA( (path + "\\*").c_str(), &data );
+	if (h == INVALID_HANDLE_VALUE) return;
+	do {
+		string name = data.cFileName;
+		if ((name.compare(".") != 0) && (name.compare("..") != 0))
+			entries->push_back( name );
+	} while (FindNextFileA( h, &data ));
+	FindClose( h );
+#else
+	DIR * d = opendir( path.c_str() );
+	if (d == NULL) return;
+	struct dirent * ent;
+	while ((ent = readdir(d)) != NULL) {
+		string name = ent->d_name;
+		if ((name.compare(".") != 0) && (name.compare("..") != 0))
+			entries->push_back( name );
+	}
+	closedir( d );
+#endif
+}
+
+/**
+ * Delete a file, giving it's space back at up to 'rate' bytes/s
+ */
+static bool reclaim_file( const string& path, long long rate ) {
+#ifndef _WIN32
+	struct stat st;
+	if (lstat( path.c_str(), &st ) != 0)
+		return false;
+
+	// Shrink large files in steps, so the filesystem frees the
+	// blocks gradually instead of in one long burst
+	if (S_ISREG(st.st_mode)) {
+		long long size = st.st_size;
+		while (size > RECLAIM_STEP) {
+			size -= RECLAIM_STEP;
+			if (truncate( path.c_str(), size ) != 0)
+				break;
+			boost::this_thread::sleep( boost::posix_time::milliseconds( RECLAIM_STEP * 1000 / rate ) );
+			if (CLICancel::requested())
+				return false;
+		}
+	}
+#endif
+	return (remove( path.c_str() ) == 0);
+}
+
+/**
+ * Delete a folder and everything in it
+ */
+static bool reclaim_path( const string& path, long long rate ) {
+#ifdef _WIN32
+	DWORD attr = GetFileAttributesA( path.c_str() );
+	if (attr == INVALID_FILE_ATTRIBUTES)
+		return true;
+	bool isDir = (attr & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+	struct stat st;
+	if (lstat( path.c_str(), &st ) != 0)
+		return true;
+	bool isDir = S_ISDIR(st.st_mode);
+#endif
+	if (!isDir)
+		return reclaim_file( path, rate );
+
+	vector<string> entries;
+	list_dir( path, &entries );
+	for (vector<string>::iterator it = entries.begin(); it != entries.end(); ++it) {
+		if (!reclaim_path( path + "/" + *it, rate ))
+			return false;
+	}
+#ifdef _WIN32
+	return (_rmdir( path.c_str() ) == 0);
+#else
+	return (rmdir( path.c_str() ) == 0);
+#endif
+}
+
+/**
+ * Queue the folder of a removed session
+ */
+int reclaim_queue( const string& session, const string& path ) {
+	ostringstream oss;
+	oss << queue_dir() << "/" << (boost::posix_time::microsec_clock::universal_time() - boost::posix_time::ptime(boost::gregorian::date(1970,1,1))).total_milliseconds()
+		<< "-" << encode_filename( session );
+
+	// Write the job and then make it visible to the worker
+	string tmpFile = oss.str() + ".tmp";
+	{
+		ofstream f( tmpFile.c_str(), ios::trunc );
+		f << path << endl;
+		if (!f.good()) return -1;
+	}
+	return rename( tmpFile.c_str(), oss.str().c_str() );
+}
+
+/**
+ * Process the queue
+ */
+int reclaim_run( int rate ) {
+	long long bytesRate = (long long)(rate > 0 ? rate : CLI_RECLAIM_RATE) * 1024 * 1024;
+	string dir = queue_dir();
+	int failed;
+
+	while (true) {
+		CLISessionLock lock( "reclaim", "worker", true );
+		if (!lock.acquire( 0 ))
+			return 0;
+		failed = 0;
+
+		// Process the jobs in the order they were queued
+		vector<string> jobs;
+		list_dir( dir, &jobs );
+		sort( jobs.begin(), jobs.end() );
+		for (vector<string>::iterator it = jobs.begin(); it != jobs.end(); ++it) {
+			if (it->find(".tmp") != string::npos) continue;
+			string job = dir + "/" + *it, path;
+			{
+				ifstream f( job.c_str() );
+				getline( f, path );
+			}
+			if (CLICancel::requested())
+				return CLI_EXIT_CANCELLED;
+			if (!path.empty() && !reclaim_path( path, bytesRate )) {
+				failed++;
+				continue;
+			}
+			remove( job.c_str() );
+		}
+		lock.release();
+
+		// A job queued while we were releasing the lock would be
+		// missed by the worker that was started for it
+		list_dir( dir, &jobs );
+		size_t pending = 0;
+		for (vector<string>::iterator it = jobs.begin(); it != jobs.end(); ++it)
+			if (it->find(".tmp") == string::npos) pending++;
+		if (pending <= (size_t)failed)
+			break;
+	}
+	return (failed == 0) ? 0 : 3;
+}
@@ -0,0 +1,57 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_RECLAIMER_H
+#define CLI_RECLAIMER_H
+
+#include <string>
+
+using namespace std;
+
+/**
+ * Default rate (in MB/s) the disk space is given back to the filesystem
+ */
+#define CLI_RECLAIM_RATE 		200
+
+/**
+ * Background reclamation of the disks of removed sessions
+ *
+ * Deleting the disk of a VM can take a long time and saturate the disk,
+ * so 'remove --async' only unregisters the VM and queues it's folder
+ * here. The reclaimer shrinks the files in steps, keeping the I/O
+ * under the given rate, and then deletes them.
+ */
+
+/**
+ * Queue the folder of a removed session for deletion
+ */
+int reclaim_queue( const string& session, const string& path );
+
+/**
+ * Delete everything in the queue, at up to 'rate' MB/s.
+ *
+ * Only one process works on the queue: if another one does already,
+ * this returns immediately.
+ */
+int reclaim_run( int rate );
+
+#endif /* end of include guard: CLI_RECLAIMER_H */
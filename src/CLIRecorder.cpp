@@ -0,0 +1,646 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLIRecorder.h"
+#include "CLICancel.h"
+
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <sstream>
+#include <stdlib.h>
+
+/**
+ * Escape a field of the log
+ */
+static string escape_field( const string& str ) {
+	string ans;
+	for (size_t i=0; i<str.length(); i++) {
+		switch (str[i]) {
+			case '\\': ans += "\\\\"; break;
+			case '\t': ans += "\\t"; break;
+			case '\n': ans += "\\n"; break;
+			case '\r': ans += "\\r"; break;
+			default: ans += str[i];
+		}
+	}
+	return ans;
+}
+
+/**
+ * Unescape a field of the log
+ */
+static string unescape_field( const string& str ) {
+	string ans;
+	for (size_t i=0; i<str.length(); i++) {
+		if ((str[i] == '\\') && (i+1 < str.length())) {
+			switch (str[++i]) {
+				case 't': ans += '\t'; break;
+				case 'n': ans += '\n'; break;
+				case 'r': ans += '\r'; break;
+				default: ans += str[i];
+			}
+		} else {
+			ans += str[i];
+		}
+	}
+	return ans;
+}
+
+/**
+ * Encode a parameter map as key=value lines
+ */
+static string encode_map( const ParameterMapPtr& params ) {
+	map<string, string> values;
+	params->toMap( &values );
+	string ans;
+	for (map<string, string>::iterator it = values.begin(); it != values.end(); ++it)
+		ans += escape_field( (*it).first + "=" + (*it).second ) + "\n";
+	return ans;
+}
+
+/**
+ * Decode key=value lines into a parameter map
+ */
+static void decode_map( const string& str, const ParameterMapPtr& params ) {
+	istringstream iss( str );
+	string line;
+	while (getline(iss, line)) {
+		line = unescape_field( line );
+		size_t eq = line.find('=');
+		if (eq != string::npos)
+			params->set( line.substr(0, eq), line.substr(eq + 1) );
+	}
+}
+
+/**
+ * Convert a result to string
+ */
+static string int_to_string( int value ) {
+	ostringstream oss;
+	oss << value;
+	return oss.str();
+}
+
+/**
+ * Record of a single call on a session
+ */
+class CLIRecordCall {
+public:
+
+	CLIRecordCall( CLIRecordSession * session, const string& call, const string& args = "" ) : session(session) {
+		entry.time = session->log->now();
+		entry.call = call;
+		entry.target = session->parameters->get("name", "");
+		entry.args = args;
+		if (session->log->replaying)
+			session->aborted = false;
+	};
+
+	/**
+	 * Log the result of the libcernvm call
+	 */
+	int done( int res ) {
+		finish( int_to_string(res) );
+		return res;
+	};
+	bool done( bool res ) {
+		finish( res ? "1" : "0" );
+		return res;
+	};
+	string done( const string& res ) {
+		finish( res );
+		return res;
+	};
+
+	/**
+	 * Answer the call from the log
+	 */
+	int replay( int def ) {
+		return answer() ? atoi( entry.result.c_str() ) : def;
+	};
+	bool replay( bool def ) {
+		return answer() ? (entry.result.compare("1") == 0) : def;
+	};
+	string replay( const string& def ) {
+		return answer() ? entry.result : def;
+	};
+
+private:
+
+	void finish( const string& result ) {
+		entry.result = result;
+		entry.duration = session->log->now() - entry.time;
+		entry.state = encode_map( session->local );
+		session->log->write( entry );
+	};
+
+	bool answer() {
+		if (!session->log->next( entry.call, entry.target, &entry ))
+			return false;
+
+		// Take as long as the recorded call, unless aborted
+		long long remaining = (long long)(entry.duration * session->log->speed);
+		while ((remaining > 0) && !session->aborted && !CLICancel::requested()) {
+			long long step = (remaining > 50) ? 50 : remaining;
+			boost::this_thread::sleep( boost::posix_time::milliseconds(step) );
+			remaining -= step;
+		}
+
+		decode_map( entry.state, session->local );
+		return true;
+	};
+
+	CLIRecordSession * 	session;
+	CLIRecordEntry 		entry;
+
+};
+
+/**
+ * Open a log for recording
+ */
+bool CLIRecordLog::record( const string& filename ) {
+	replaying = false;
+	speed = 1.0;
+	started = 0;
+	started = now();
+	out.open( filename.c_str(), ios::trunc );
+	return out.good();
+}
+
+/**
+ * Load a log for replaying
+ */
+bool CLIRecordLog::replay( const string& filename, double speed ) {
+	replaying = true;
+	this->speed = speed;
+	started = 0;
+	started = now();
+
+	ifstream in( filename.c_str() );
+	if (!in.good()) return false;
+	string line;
+	while (getline(in, line)) {
+		vector<string> fields;
+		size_t start = 0, end;
+		while ((end = line.find('\t', start)) != string::npos) {
+			fields.push_back( unescape_field( line.substr(start, end - start) ) );
+			start = end + 1;
+		}
+		fields.push_back( unescape_field( line.substr(start) ) );
+		if (fields.size() != 7) continue;
+
+		CLIRecordEntry e;
+		e.time = atol( fields[0].c_str() );
+		e.duration = atol( fields[1].c_str() );
+		e.call = fields[2];
+		e.target = fields[3];
+		e.args = fields[4];
+		e.result = fields[5];
+		e.state = fields[6];
+		calls[ e.call + "\t" + e.target ].push_back( e );
+		entries.push_back( e );
+	}
+	return !entries.empty();
+}
+
+/**
+ * Append an entry to the log
+ */
+void CLIRecordLog::write( CLIRecordEntry& entry ) {
+	boost::mutex::scoped_lock lock(mutex);
+	out << entry.time << "\t" << entry.duration << "\t" << escape_field(entry.call) << "\t"
+		<< escape_field(entry.target) << "\t" << escape_field(entry.args) << "\t"
+		<< escape_field(entry.result) << "\t" << escape_field(entry.state) << endl;
+}
+
+/**
+ * Find the next recorded answer of the call
+ */
+bool CLIRecordLog::next( const string& call, const string& target, CLIRecordEntry * entry ) {
+	boost::mutex::scoped_lock lock(mutex);
+	map< string, deque<CLIRecordEntry> >::iterator it = calls.find( call + "\t" + target );
+	if ((it == calls.end()) || (*it).second.empty())
+		return false;
+	*entry = (*it).second.front();
+	if ((*it).second.size() > 1)
+		(*it).second.pop_front();
+	return true;
+}
+
+/**
+ * All the recorded entries of the call
+ */
+vector<CLIRecordEntry> CLIRecordLog::all( const string& call ) {
+	vector<CLIRecordEntry> ans;
+	for (vector<CLIRecordEntry>::iterator it = entries.begin(); it != entries.end(); ++it)
+		if (it->call.compare(call) == 0) ans.push_back( *it );
+	return ans;
+}
+
+/**
+ * Milliseconds since the log was opened
+ */
+long long CLIRecordLog::now() {
+	return (boost::posix_time::microsec_clock::universal_time() - boost::posix_time::ptime(boost::gregorian::date(1970,1,1))).total_milliseconds() - started;
+}
+
+/**
+ * Constructor
+ */
+CLIRecordSession::CLIRecordSession( const CLIRecordLogPtr& log, const HVSessionPtr& real ) : real(real), log(log), aborted(false) {
+	if (real) {
+		parameters = real->parameters;
+		local = real->local;
+	} else {
+		parameters = ParameterMap::instance();
+		local = ParameterMap::instance();
+	}
+}
+
+/**
+ * The session calls. They all look the same: answer from the log
+ * when replaying, otherwise forward to libcernvm and log the result.
+ */
+int CLIRecordSession::pause() {
+	CLIRecordCall call( this, "pause" );
+	if (!real) return call.replay( HVE_OK );
+	return call.done( real->pause() );
+}
+int CLIRecordSession::close( bool unmonitored ) {
+	CLIRecordCall call( this, "close" );
+	if (!real) return call.replay( HVE_OK );
+	return call.done( real->close(unmonitored) );
+}
+int CLIRecordSession::resume() {
+	CLIRecordCall call( this, "resume" );
+	if (!real) return call.replay( HVE_OK );
+	return call.done( real->resume() );
+}
+int CLIRecordSession::reset() {
+	CLIRecordCall call( this, "reset" );
+	if (!real) return call.replay( HVE_OK );
+	return call.done( real->reset() );
+}
+int CLIRecordSession::stop() {
+	CLIRecordCall call( this, "stop" );
+	if (!real) return call.replay( HVE_OK );
+	return call.done( real->stop() );
+}
+int CLIRecordSession::hibernate() {
+	CLIRecordCall call( this, "hibernate" );
+	if (!real) return call.replay( HVE_OK );
+	return call.done( real->hibernate() );
+}
+int CLIRecordSession::open() {
+	CLIRecordCall call( this, "open" );
+	if (!real) return call.replay( HVE_OK );
+	return call.done( real->open() );
+}
+int CLIRecordSession::start( const ParameterMapPtr& userData ) {
+	CLIRecordCall call( this, "start", encode_map(userData) );
+	if (!real) return call.replay( HVE_OK );
+	return call.done( real->start(userData) );
+}
+int CLIRecordSession::setExecutionCap( int cap ) {
+	CLIRecordCall call( this, "setExecutionCap", int_to_string(cap) );
+	if (!real) return call.replay( HVE_OK );
+	return call.done( real->setExecutionCap(cap) );
+}
+int CLIRecordSession::setProperty( const std::string& name, const std::string& value ) {
+	CLIRecordCall call( this, "setProperty", name + "=" + value );
+	if (!real) return call.replay( HVE_OK );
+	return call.done( real->setProperty(name, value) );
+}
+std::string CLIRecordSession::getProperty( const std::string& name ) {
+	CLIRecordCall call( this, "getProperty", name );
+	if (!real) return call.replay( string("") );
+	return call.done( real->getProperty(name) );
+}
+std::string CLIRecordSession::getAPIHost() {
+	CLIRecordCall call( this, "getAPIHost" );
+	if (!real) return call.replay( string("127.0.0.1") );
+	return call.done( real->getAPIHost() );
+}
+int CLIRecordSession::getAPIPort() {
+	CLIRecordCall call( this, "getAPIPort" );
+	if (!real) return call.replay( 0 );
+	return call.done( real->getAPIPort() );
+}
+std::string CLIRecordSession::getExtraInfo( int extraInfo ) {
+	CLIRecordCall call( this, "getExtraInfo", int_to_string(extraInfo) );
+	if (!real) return call.replay( string("") );
+	return call.done( real->getExtraInfo(extraInfo) );
+}
+int CLIRecordSession::update( bool waitTillInactive ) {
+	CLIRecordCall call( this, "update" );
+	if (!real) return call.replay( HVE_OK );
+	return call.done( real->update(waitTillInactive) );
+}
+int CLIRecordSession::wait() {
+	CLIRecordCall call( this, "wait" );
+	if (!real) return call.replay( HVE_OK );
+	return call.done( real->wait() );
+}
+bool CLIRecordSession::isAPIAlive( unsigned char handshake, int timeoutSec ) {
+	CLIRecordCall call( this, "isAPIAlive" );
+	if (!real) return call.replay( false );
+	return call.done( real->isAPIAlive(handshake, timeoutSec) );
+}
+
+/**
+ * Abort is not answered from the log, it only cuts short the
+ * replayed call in progress
+ */
+void CLIRecordSession::abort() {
+	aborted = true;
+	if (real) real->abort();
+}
+
+/**
+ * Constructor
+ */
+CLIRecordInstance::CLIRecordInstance( const CLIRecordLogPtr& log, const HVInstancePtr& real ) : real(real), log(log) {
+	CLIRecordEntry entry;
+	entry.time = log->now();
+	entry.duration = 0;
+
+	if (real) {
+
+		// Log the hypervisor and the sessions we start with
+		type = real->type;
+		hvRoot = real->hvRoot;
+		hvBinary = real->hvBinary;
+		dirData = real->dirData;
+		dirDataCache = real->dirDataCache;
+
+		ostringstream oss;
+		oss << "type=" << type << "\n" << escape_field("hvRoot=" + hvRoot) << "\n" << escape_field("hvBinary=" + hvBinary) << "\n"
+			<< escape_field("dirData=" + dirData) << "\n" << escape_field("dirDataCache=" + dirDataCache) << "\n";
+		entry.call = "hypervisor";
+		entry.args = oss.str();
+		log->write( entry );
+
+		for (std::map< std::string, HVSessionPtr >::iterator it = real->sessions.begin(); it != real->sessions.end(); ++it) {
+			sessions[ (*it).first ] = wrap( (*it).second );
+			entry.call = "session";
+			entry.target = (*it).second->parameters->get("name", "");
+			entry.args = encode_map( (*it).second->parameters );
+			entry.result = (*it).first;
+			entry.state = encode_map( (*it).second->local );
+			log->write( entry );
+		}
+
+	} else {
+
+		// Restore them from the log
+		vector<CLIRecordEntry> entries = log->all( "hypervisor" );
+		if (!entries.empty()) {
+			ParameterMapPtr info = ParameterMap::instance();
+			decode_map( entries[0].args, info );
+			type = info->getNum<int>( "type", HV_NONE );
+			hvRoot = info->get( "hvRoot", "" );
+			hvBinary = info->get( "hvBinary", "" );
+			dirData = info->get( "dirData", "" );
+			dirDataCache = info->get( "dirDataCache", "" );
+		}
+
+		entries = log->all( "session" );
+		for (vector<CLIRecordEntry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+			CLIRecordSessionPtr session = boost::make_shared<CLIRecordSession>( log, HVSessionPtr() );
+			decode_map( it->args, session->parameters );
+			decode_map( it->state, session->local );
+			sessions[ it->result ] = session;
+		}
+
+	}
+}
+
+/**
+ * Wrap a libcernvm session, reusing the wrapper we already have
+ */
+HVSessionPtr CLIRecordInstance::wrap( const HVSessionPtr& session ) {
+	if (!session) return session;
+	for (std::map< std::string, HVSessionPtr >::iterator it = sessions.begin(); it != sessions.end(); ++it) {
+		CLIRecordSession * wrapper = dynamic_cast<CLIRecordSession *>( (*it).second.get() );
+		if ((wrapper != NULL) && (wrapper->real == session))
+			return (*it).second;
+	}
+	return boost::make_shared<CLIRecordSession>( log, session );
+}
+
+/**
+ * Open a session
+ */
+HVSessionPtr CLIRecordInstance::sessionOpen( const ParameterMapPtr& parameters, const FiniteTaskPtr& pf ) {
+	CLIRecordEntry entry;
+	entry.time = log->now();
+	entry.call = "sessionOpen";
+	entry.target = parameters->get("name", "");
+	entry.args = encode_map( parameters );
+
+	// Replay
+	if (!real) {
+		HVSessionPtr session = sessionByName( entry.target );
+		if (!log->next( entry.call, entry.target, &entry ))
+			return session;
+		if (!session) {
+			session = boost::make_shared<CLIRecordSession>( log, HVSessionPtr() );
+			session->parameters = parameters;
+			sessions[ entry.result ] = session;
+		}
+		decode_map( entry.state, session->local );
+		return session;
+	}
+
+	// Record
+	HVSessionPtr session = real->sessionOpen( parameters, pf );
+	if (!session) return session;
+	HVSessionPtr wrapper = wrap( session );
+	for (std::map< std::string, HVSessionPtr >::iterator it = real->sessions.begin(); it != real->sessions.end(); ++it) {
+		if ((*it).second == session) {
+			sessions[ (*it).first ] = wrapper;
+			entry.result = (*it).first;
+		}
+	}
+	entry.duration = log->now() - entry.time;
+	entry.state = encode_map( session->local );
+	log->write( entry );
+	return wrapper;
+}
+
+/**
+ * Validate a session
+ */
+int CLIRecordInstance::sessionValidate( const ParameterMapPtr& parameters ) {
+	CLIRecordEntry entry;
+	entry.time = log->now();
+	entry.call = "sessionValidate";
+	entry.target = parameters->get("name", "");
+
+	if (!real)
+		return log->next( entry.call, entry.target, &entry ) ? atoi( entry.result.c_str() ) : 0;
+
+	int res = real->sessionValidate( parameters );
+	entry.duration = log->now() - entry.time;
+	entry.result = int_to_string( res );
+	log->write( entry );
+	return res;
+}
+
+/**
+ * Delete a session
+ */
+void CLIRecordInstance::sessionDelete( const HVSessionPtr& session ) {
+	CLIRecordEntry entry;
+	entry.time = log->now();
+	entry.call = "sessionDelete";
+	entry.target = session->parameters->get("name", "");
+
+	CLIRecordSession * wrapper = dynamic_cast<CLIRecordSession *>( session.get() );
+	if (real && (wrapper != NULL))
+		real->sessionDelete( wrapper->real );
+	for (std::map< std::string, HVSessionPtr >::iterator it = sessions.begin(); it != sessions.end(); ++it) {
+		if ((*it).second == session) {
+			sessions.erase( it );
+			break;
+		}
+	}
+
+	if (real) {
+		entry.duration = log->now() - entry.time;
+		log->write( entry );
+	}
+}
+
+/**
+ * Find a session by name
+ */
+HVSessionPtr CLIRecordInstance::sessionByName( const std::string& name ) {
+	for (std::map< std::string, HVSessionPtr >::iterator it = sessions.begin(); it != sessions.end(); ++it) {
+		if ((*it).second->parameters->get("name", "").compare(name) == 0)
+			return (*it).second;
+	}
+	return HVSessionPtr();
+}
+
+/**
+ * Wait for the hypervisor
+ */
+bool CLIRecordInstance::waitTillReady( DomainKeystore& keystore, const FiniteTaskPtr& pf, const UserInteractionPtr& ui ) {
+	CLIRecordEntry entry;
+	entry.time = log->now();
+	entry.call = "waitTillReady";
+
+	if (!real)
+		return log->next( entry.call, entry.target, &entry ) ? (entry.result.compare("1") == 0) : true;
+
+	bool res = real->waitTillReady( keystore, pf, ui );
+	entry.duration = log->now() - entry.time;
+	entry.result = res ? "1" : "0";
+	log->write( entry );
+	return res;
+}
+
+/**
+ * Abort everything in progress
+ */
+void CLIRecordInstance::abort() {
+	if (real) real->abort();
+}
+
+/**
+ * Run a hypervisor command
+ */
+int CLIRecordInstance::execRecorded( const string& args, vector<string> * lines, string * err, const SysExecConfig& config ) {
+	CLIRecordEntry entry;
+	entry.time = log->now();
+	entry.call = "exec";
+	entry.target = args;
+
+	// Replay
+	if (!real) {
+		if (!log->next( entry.call, entry.target, &entry ))
+			return HVE_NOT_SUPPORTED;
+		long long remaining = (long long)(entry.duration * log->speed);
+		if ((remaining > 0) && !CLICancel::requested())
+			boost::this_thread::sleep( boost::posix_time::milliseconds(remaining) );
+		if (lines != NULL) {
+			lines->clear();
+			istringstream iss( entry.state );
+			string line;
+			while (getline(iss, line))
+				lines->push_back( line );
+		}
+		return atoi( entry.result.c_str() );
+	}
+
+	// Record
+	vector<string> output;
+	int res = real->exec( args, &output, err, config );
+	for (vector<string>::iterator it = output.begin(); it != output.end(); ++it)
+		entry.state += *it + "\n";
+	if (lines != NULL)
+		lines->insert( lines->end(), output.begin(), output.end() );
+	entry.duration = log->now() - entry.time;
+	entry.result = int_to_string( res );
+	log->write( entry );
+	return res;
+}
+
+/**
+ * Start recording
+ */
+HVInstancePtr record_hypervisor( const HVInstancePtr& hv, const string& filename ) {
+	CLIRecordLogPtr log = boost::make_shared<CLIRecordLog>();
+	if (!log->record( filename ))
+		return HVInstancePtr();
+	return boost::make_shared<CLIRecordInstance>( log, hv );
+}
+
+/**
+ * Start replaying
+ */
+HVInstancePtr replay_hypervisor( const string& filename, double speed ) {
+	CLIRecordLogPtr log = boost::make_shared<CLIRecordLog>();
+	if (!log->replay( filename, speed ))
+		return HVInstancePtr();
+	return boost::make_shared<CLIRecordInstance>( log, HVInstancePtr() );
+}
+
+/**
+ * Run a hypervisor command
+ */
+int hv_exec( const HVInstancePtr& hv, const string& args, vector<string> * lines, string * err, const SysExecConfig& config ) {
+	CLIRecordInstance * recorder = dynamic_cast<CLIRecordInstance *>( hv.get() );
+	if (recorder != NULL)
+		return recorder->execRecorded( args, lines, err, config );
+	return hv->exec( args, lines, err, config );
+}
+
+/**
+ * Check if the hypervisor is replayed
+ */
+bool hv_replaying( const HVInstancePtr& hv ) {
+	CLIRecordInstance * recorder = dynamic_cast<CLIRecordInstance *>( hv.get() );
+	return (recorder != NULL) && !recorder->real;
+}
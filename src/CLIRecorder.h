@@ -0,0 +1,214 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_RECORDER_H
+#define CLI_RECORDER_H
+
+#include <CernVM/Hypervisor.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <deque>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Record and replay of the hypervisor
+ *
+ * When recording, the hypervisor and it's sessions are wrapped by
+ * objects that forward every call to libcernvm and log the arguments,
+ * the result, the duration and the session state after the call.
+ *
+ * When replaying, the same objects answer the calls from the log,
+ * taking as long as the recorded call did (times the replay speed),
+ * so the CLI can be benchmarked on machines without a hypervisor.
+ *
+ * The log has a line for every call, with tab-separated fields:
+ *
+ *   <time> <duration> <call> <target> <args> <result> <state>
+ *
+ * Times are in milliseconds. Tabs, new lines and backslashes in the
+ * fields are escaped with a backslash.
+ */
+
+/**
+ * A line of the log
+ */
+struct CLIRecordEntry {
+	long long 	time;
+	long long 	duration;
+	string 		call;
+	string 		target;
+	string 		args;
+	string 		result;
+	string 		state;
+};
+
+/**
+ * The log being recorded or replayed
+ */
+class CLIRecordLog {
+public:
+
+	/**
+	 * Open a log for recording
+	 */
+	bool 			record( const string& filename );
+
+	/**
+	 * Load a log for replaying, at the given speed (0 does not wait at all)
+	 */
+	bool 			replay( const string& filename, double speed );
+
+	/**
+	 * Append an entry to the log
+	 */
+	void 			write( CLIRecordEntry& entry );
+
+	/**
+	 * Find the next recorded answer of the call and wait for as long
+	 * as it took. The last answer of a call is repeated if it's called
+	 * more times than recorded. Returns false if it was never recorded.
+	 */
+	bool 			next( const string& call, const string& target, CLIRecordEntry * entry );
+
+	/**
+	 * All the recorded entries of the call
+	 */
+	vector<CLIRecordEntry> 	all( const string& call );
+
+	/**
+	 * Milliseconds since the log was opened
+	 */
+	long long 		now();
+
+	bool 			replaying;
+	double 			speed;
+
+private:
+	boost::mutex 								mutex;
+	ofstream 									out;
+	long long 									started;
+	map< string, deque<CLIRecordEntry> > 		calls;
+	vector<CLIRecordEntry> 						entries;
+
+};
+
+typedef boost::shared_ptr<CLIRecordLog> 	CLIRecordLogPtr;
+
+/**
+ * A session that is recorded or replayed
+ */
+class CLIRecordSession : public HVSession {
+public:
+
+	CLIRecordSession( const CLIRecordLogPtr& log, const HVSessionPtr& real );
+
+	virtual int 	pause();
+	virtual int 	close( bool unmonitored = false );
+	virtual int 	resume();
+	virtual int 	reset();
+	virtual int 	stop();
+	virtual int 	hibernate();
+	virtual int 	open();
+	virtual int 	start( const ParameterMapPtr& userData );
+	virtual int 	setExecutionCap( int cap );
+	virtual int 	setProperty( const std::string& name, const std::string& value );
+	virtual std::string 	getProperty( const std::string& name );
+	virtual std::string 	getAPIHost();
+	virtual int 	getAPIPort();
+	virtual std::string 	getExtraInfo( int extraInfo );
+	virtual int 	update( bool waitTillInactive = true );
+	virtual void 	abort();
+	virtual int 	wait();
+	virtual bool 	isAPIAlive( unsigned char handshake = HSK_HTTP, int timeoutSec = 1 );
+
+	/**
+	 * The libcernvm session (empty when replaying)
+	 */
+	HVSessionPtr 	real;
+
+private:
+	friend class CLIRecordCall;
+	CLIRecordLogPtr log;
+	volatile bool 	aborted;
+
+};
+
+typedef boost::shared_ptr<CLIRecordSession> 	CLIRecordSessionPtr;
+
+/**
+ * A hypervisor that is recorded or replayed
+ */
+class CLIRecordInstance : public HVInstance {
+public:
+
+	CLIRecordInstance( const CLIRecordLogPtr& log, const HVInstancePtr& real );
+
+	virtual HVSessionPtr 	sessionOpen( const ParameterMapPtr& parameters, const FiniteTaskPtr& pf );
+	virtual int 			sessionValidate( const ParameterMapPtr& parameters );
+	virtual void 			sessionDelete( const HVSessionPtr& session );
+	virtual HVSessionPtr 	sessionByName( const std::string& name );
+	virtual bool 			waitTillReady( DomainKeystore& keystore, const FiniteTaskPtr& pf = FiniteTaskPtr(), const UserInteractionPtr& ui = UserInteractionPtr() );
+	virtual void 			abort();
+
+	/**
+	 * Run a hypervisor command (like hv->exec)
+	 */
+	int 					execRecorded( const string& args, vector<string> * lines, string * err, const SysExecConfig& config );
+
+	/**
+	 * The libcernvm hypervisor (empty when replaying)
+	 */
+	HVInstancePtr 			real;
+	CLIRecordLogPtr 		log;
+
+private:
+	HVSessionPtr 			wrap( const HVSessionPtr& session );
+
+};
+
+/**
+ * Start recording the calls to the hypervisor in the given file
+ */
+HVInstancePtr record_hypervisor( const HVInstancePtr& hv, const string& filename );
+
+/**
+ * Create a hypervisor that replays the given file
+ */
+HVInstancePtr replay_hypervisor( const string& filename, double speed );
+
+/**
+ * Run a hypervisor command, going through the recorder if there is one
+ */
+int hv_exec( const HVInstancePtr& hv, const string& args, vector<string> * lines, string * err, const SysExecConfig& config );
+
+/**
+ * Check if the hypervisor is replayed
+ */
+bool hv_replaying( const HVInstancePtr& hv );
+
+#endif /* end of include guard: CLI_RECORDER_H */
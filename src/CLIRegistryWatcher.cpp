@@ -0,0 +1,202 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLIRegistryWatcher.h"
+#include "CLICancel.h"
+#include "cli-utils.h"
+
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+
+/**
+ * The events that indicate a change in the configuration of a VM.
+ * VirtualBox writes the settings in a temporary file and renames it.
+ */
+#define VM_FOLDER_EVENTS 	(IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF)
+#endif
+
+/**
+ * Append a change to the registry journal
+ */
+void registry_journal( const string& operation, const string& name ) {
+	CLIJournal::append( "registry.log", operation + " " + name );
+}
+
+/**
+ * Constructor for the watcher
+ */
+CLIRegistryWatcher::CLIRegistryWatcher( const HVInstancePtr& hv ) : hv(hv), journal("registry.log"), fd(-1) {
+
+	// The sessions in memory already reflect the journal up to now
+	journal.skip();
+
+	// Start with the sessions we have
+	for (std::map< std::string, HVSessionPtr >::iterator it = hv->sessions.begin(); it != hv->sessions.end(); ++it) {
+		names.insert( (*it).second->parameters->get("name", "") );
+	}
+
+#ifdef __linux__
+	fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+#endif
+
+}
+
+/**
+ * Close the notification handle
+ */
+CLIRegistryWatcher::~CLIRegistryWatcher() {
+#ifdef __linux__
+	if (fd >= 0) close( fd );
+#endif
+}
+
+/**
+ * Returns true if changes are notified by the OS
+ */
+bool CLIRegistryWatcher::active() const {
+	return (fd >= 0);
+}
+
+/**
+ * Watch the VM folder of the given session
+ */
+void CLIRegistryWatcher::watch( const string& name, const string& folder ) {
+	names.insert( name );
+#ifdef __linux__
+	if (fd < 0) return;
+	int wd = inotify_add_watch( fd, folder.c_str(), VM_FOLDER_EVENTS );
+	if (wd >= 0) watches[wd] = name;
+#endif
+}
+
+/**
+ * Stop watching the VM folder of the given session
+ */
+void CLIRegistryWatcher::unwatch( const string& name ) {
+	for (map<int, string>::iterator it = watches.begin(); it != watches.end(); ++it) {
+		if ((*it).second.compare(name) != 0) continue;
+#ifdef __linux__
+		inotify_rm_watch( fd, (*it).first );
+#endif
+		watches.erase( it );
+		return;
+	}
+}
+
+/**
+ * Read the pending notifications
+ */
+void CLIRegistryWatcher::readEvents( set<string> * changed ) {
+#ifdef __linux__
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = read( fd, buf, sizeof(buf) )) > 0) {
+		for (char * ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event *) ptr)->len) {
+			const struct inotify_event * ev = (const struct inotify_event *) ptr;
+
+			// We lost events, so everything might have changed
+			if (ev->mask & IN_Q_OVERFLOW) {
+				changed->insert( names.begin(), names.end() );
+				continue;
+			}
+
+			map<int, string>::iterator it = watches.find( ev->wd );
+			if (it == watches.end()) continue;
+			changed->insert( (*it).second );
+
+			// The folder is gone and the kernel dropped the watch
+			if (ev->mask & IN_IGNORED)
+				watches.erase( it );
+		}
+	}
+#endif
+}
+
+/**
+ * Consume the new entries of the registry journal
+ */
+void CLIRegistryWatcher::readJournal( set<string> * changed, set<string> * removed ) {
+	vector<string> lines;
+	journal.read( &lines );
+	for (vector<string>::iterator line = lines.begin(); line != lines.end(); ++line) {
+
+		// Parse '<operation> <name>'
+		size_t pos = line->find(' ');
+		if (pos == string::npos) continue;
+		string operation = line->substr( 0, pos );
+		string name = line->substr( pos + 1 );
+		if ((operation.compare("remove") != 0) || (names.erase(name) == 0))
+			continue;
+
+		// Drop the session from memory
+		for (std::map< std::string, HVSessionPtr >::iterator it = hv->sessions.begin(); it != hv->sessions.end(); ++it) {
+			if ((*it).second->parameters->get("name", "").compare(name) == 0) {
+				hv->sessions.erase( it );
+				break;
+			}
+		}
+		unwatch( name );
+		changed->erase( name );
+		removed->insert( name );
+	}
+}
+
+/**
+ * Collect the changes for the given time
+ */
+bool CLIRegistryWatcher::wait( int timeout, set<string> * changed, set<string> * removed ) {
+	bool cancelled = false;
+
+	if (fd < 0) {
+		// Without notifications we have to assume everything changed
+		cancelled = !CLIDeadline(0).sleep( timeout );
+		changed->insert( names.begin(), names.end() );
+
+	} else {
+#ifdef __linux__
+		// Poll in small steps, checking for cancellation
+		boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(timeout);
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		while (true) {
+			if (CLICancel::requested()) {
+				cancelled = true;
+				break;
+			}
+			long ms = (deadline - boost::posix_time::microsec_clock::universal_time()).total_milliseconds();
+			if (ms <= 0) break;
+			pfd.revents = 0;
+			if (poll( &pfd, 1, (ms > 100) ? 100 : (int)ms ) > 0)
+				readEvents( changed );
+		}
+#endif
+	}
+
+	readJournal( changed, removed );
+	return !cancelled && !CLICancel::requested();
+}
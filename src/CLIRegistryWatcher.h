@@ -0,0 +1,102 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_REGISTRY_WATCHER_H
+#define CLI_REGISTRY_WATCHER_H
+
+#include <CernVM/Hypervisor.h>
+#include "CLIJournal.h"
+
+#include <map>
+#include <set>
+#include <string>
+
+using namespace std;
+
+/**
+ * Append a change of the session registry to the registry journal.
+ *
+ * The journal is shared by all the cernvm-cli processes and it's
+ * consumed by the long-running commands, that keep their sessions in
+ * memory and would otherwise not know about sessions removed by others.
+ */
+void registry_journal( const string& operation, const string& name );
+
+/**
+ * Keeps the sessions of a long-running command up to date
+ *
+ * The sessions are enumerated once at start-up. After that, the watcher
+ * uses inotify on the folder of every VM and on the registry journal,
+ * so the caller only has to update the sessions that actually changed,
+ * instead of querying the hypervisor for all of them in every interval.
+ *
+ * On platforms without inotify every session is reported as changed
+ * when the interval expires.
+ */
+class CLIRegistryWatcher {
+public:
+
+	/**
+	 * Constructor for the watcher
+	 */
+	CLIRegistryWatcher( const HVInstancePtr& hv );
+
+	/**
+	 * Close the notification handle
+	 */
+	~CLIRegistryWatcher();
+
+	/**
+	 * Watch the VM folder of the given session
+	 */
+	void 	watch( const string& name, const string& folder );
+
+	/**
+	 * Collect the changes for 'timeout' milliseconds. The names of the sessions
+	 * that changed are placed in 'changed' and the ones removed by other
+	 * processes (already dropped from hv->sessions) in 'removed'.
+	 *
+	 * Returns false if the user cancelled while waiting.
+	 */
+	bool 	wait( int timeout, set<string> * changed, set<string> * removed );
+
+	/**
+	 * Returns true if changes are notified by the OS
+	 */
+	bool 	active() const;
+
+private:
+
+	void 	readJournal( set<string> * changed, set<string> * removed );
+	void 	readEvents( set<string> * changed );
+	void 	unwatch( const string& name );
+
+	HVInstancePtr 		hv;
+	CLIJournal 			journal;
+	set<string> 		names;
+
+	int 				fd;
+	map<int, string> 	watches;
+
+};
+
+#endif /* end of include guard: CLI_REGISTRY_WATCHER_H */
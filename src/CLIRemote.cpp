@@ -0,0 +1,470 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLIRemote.h"
+#include "CLIOutput.h"
+#include "cli-utils.h"
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
+
+using boost::asio::ip::tcp;
+
+/**
+ * How many seconds to wait for the request of a client
+ */
+#define DAEMON_READ_TIMEOUT 	10
+
+/**
+ * The largest request we accept
+ */
+#define DAEMON_MAX_REQUEST 		65536
+
+/**
+ * The most arguments a request can carry
+ */
+#define DAEMON_MAX_ARGS 		256
+
+/**
+ * Escape an argument so it fits on a line
+ */
+static string escape_arg( const string& str ) {
+	string ans;
+	for (size_t i=0; i<str.length(); i++) {
+		if (str[i] == '\\') ans += "\\\\";
+		else if (str[i] == '\n') ans += "\\n";
+		else ans += str[i];
+	}
+	return ans;
+}
+
+/**
+ * Unescape an argument
+ */
+static string unescape_arg( const string& str ) {
+	string ans;
+	for (size_t i=0; i<str.length(); i++) {
+		if ((str[i] == '\\') && (i+1 < str.length())) {
+			ans += (str[++i] == 'n') ? '\n' : str[i];
+		} else {
+			ans += str[i];
+		}
+	}
+	return ans;
+}
+
+/**
+ * Compare the token of the client, taking the same time regardless
+ * of where the first difference is
+ */
+static bool token_equal( const string& token, const string& peerToken ) {
+	unsigned char diff = (token.length() == peerToken.length()) ? 0 : 1;
+	for (size_t i=0; i<token.length(); i++) {
+		diff |= token[i] ^ (i < peerToken.length() ? peerToken[i] : 0);
+	}
+	return (diff == 0) && !token.empty();
+}
+
+/**
+ * Read a line from the socket
+ */
+static bool read_line( tcp::socket& socket, boost::asio::streambuf& buf, string * line ) {
+	boost::system::error_code ec;
+	boost::asio::read_until( socket, buf, "\n", ec );
+	if (ec && (buf.size() == 0)) return false;
+	istream is( &buf );
+	if (!getline( is, *line )) return false;
+	if (!line->empty() && ((*line)[line->length()-1] == '\r'))
+		line->erase( line->length()-1 );
+	return true;
+}
+
+/**
+ * Write a line to the socket (from any thread)
+ */
+static bool write_line( tcp::socket& socket, boost::mutex& mutex, const string& line ) {
+	boost::mutex::scoped_lock lock(mutex);
+	boost::system::error_code ec;
+	boost::asio::write( socket, boost::asio::buffer(line + "\n"), ec );
+	return !ec;
+}
+
+#ifndef _WIN32
+
+/**
+ * Forward the lines of a pipe to the socket
+ */
+static void forward_pipe( int fd, int stream, tcp::socket * socket, boost::mutex * mutex, pid_t child ) {
+	FILE * f = fdopen( fd, "r" );
+	char buf[4096];
+	string line;
+	bool connected = true;
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		line += buf;
+		if (line[line.length()-1] != '\n') continue;
+		line.erase( line.length()-1 );
+		ostringstream oss;
+		oss << stream << " " << line;
+		line = "";
+
+		// Stop the command if the client went away
+		if (connected && !write_line( *socket, *mutex, oss.str() )) {
+			connected = false;
+			kill( child, SIGTERM );
+		}
+	}
+	if (!line.empty() && connected) {
+		ostringstream oss;
+		oss << stream << " " << line;
+		write_line( *socket, *mutex, oss.str() );
+	}
+	fclose( f );
+}
+
+/**
+ * Run the command and stream it's output to the client
+ */
+static int run_command( const string& program, const vector<string>& args, tcp::socket& socket, boost::mutex& mutex ) {
+	int out[2], err[2];
+	if (pipe(out) != 0) return -1;
+	if (pipe(err) != 0) {
+		close( out[0] ); close( out[1] );
+		return -1;
+	}
+
+	// Prepare the arguments before forking. With '--remote' the child
+	// runs silently and takes everything after it as the command and
+	// it's own arguments, never as global options.
+	vector<char *> argv;
+	argv.push_back( const_cast<char *>(program.c_str()) );
+	argv.push_back( const_cast<char *>("--remote") );
+	for (vector<string>::const_iterator it = args.begin(); it != args.end(); ++it)
+		argv.push_back( const_cast<char *>(it->c_str()) );
+	argv.push_back( NULL );
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		close( out[0] ); close( out[1] ); close( err[0] ); close( err[1] );
+		return -1;
+	}
+	if (pid == 0) {
+		int null = open( "/dev/null", O_RDONLY );
+		dup2( null, 0 );
+		dup2( out[1], 1 );
+		dup2( err[1], 2 );
+		close( out[0] ); close( out[1] ); close( err[0] ); close( err[1] ); close( null );
+		execv( program.c_str(), &argv[0] );
+		_exit( 127 );
+	}
+	close( out[1] );
+	close( err[1] );
+
+	// Forward both streams until the command exits
+	boost::thread errThread( boost::bind(&forward_pipe, err[0], 2, &socket, &mutex, pid) );
+	forward_pipe( out[0], 1, &socket, &mutex, pid );
+	errThread.join();
+
+	int status;
+	if (waitpid( pid, &status, 0 ) < 0) return -1;
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+#endif
+
+/**
+ * A connection of a client, with it's own I/O service so it
+ * can be served by it's own thread
+ */
+struct CLIDaemonClient {
+	boost::asio::io_service 	io;
+	tcp::socket 				socket;
+
+	CLIDaemonClient() : socket(io) { };
+};
+
+/**
+ * The client did not send it's request in time
+ */
+static void request_timeout( tcp::socket * socket, const boost::system::error_code& ec ) {
+	boost::system::error_code ignored;
+	if (ec != boost::asio::error::operation_aborted)
+		socket->close( ignored );
+}
+
+/**
+ * The request of the client was received
+ */
+static void request_received( boost::asio::deadline_timer * timer, boost::system::error_code * result, const boost::system::error_code& ec ) {
+	*result = ec;
+	timer->cancel();
+}
+
+/**
+ * Handle a client
+ */
+static void serve_client( boost::shared_ptr<CLIDaemonClient> client, string token, string program ) {
+	tcp::socket * socket = &client->socket;
+	boost::mutex mutex;
+	string line, peerToken;
+	vector<string> args;
+	boost::system::error_code ec;
+
+	// Read the whole request before looking at it, but don't let
+	// a client that never completes it, or sends too much, hold
+	// the thread or the memory of the daemon
+	boost::asio::streambuf buf( DAEMON_MAX_REQUEST );
+	boost::asio::deadline_timer timer( client->io, boost::posix_time::seconds(DAEMON_READ_TIMEOUT) );
+	timer.async_wait( boost::bind(&request_timeout, socket, boost::asio::placeholders::error) );
+	boost::asio::async_read_until( *socket, buf, "\nRUN\n",
+		boost::bind(&request_received, &timer, &ec, boost::asio::placeholders::error) );
+	client->io.run();
+	if (ec) {
+		socket->close( ec );
+		return;
+	}
+
+	// Parse the request
+	istream is( &buf );
+	if (!getline( is, line ) || (line.compare("CERNVM-CLI 1") != 0)) {
+		socket->close( ec );
+		return;
+	}
+	while (getline( is, line ) && (line.compare("RUN") != 0)) {
+		if (line.compare(0, 4, "ARG ") == 0) {
+			if (args.size() >= DAEMON_MAX_ARGS) {
+				write_line( *socket, mutex, "2 ERROR: Too many arguments" );
+				write_line( *socket, mutex, "EXIT 5" );
+				socket->close( ec );
+				return;
+			}
+			args.push_back( unescape_arg( line.substr(4) ) );
+		} else if (line.compare(0, 6, "TOKEN ") == 0) {
+			peerToken = line.substr(6);
+		}
+	}
+	if (line.compare("RUN") != 0) {
+		socket->close( ec );
+		return;
+	}
+	if (!token_equal( token, peerToken )) {
+		write_line( *socket, mutex, "2 ERROR: Invalid token" );
+		write_line( *socket, mutex, "EXIT 5" );
+		socket->close( ec );
+		return;
+	}
+
+	// The daemon itself can not be started remotely
+	if (args.empty() || (args.front().compare("daemon") == 0)) {
+		write_line( *socket, mutex, "2 ERROR: Invalid command" );
+		write_line( *socket, mutex, "EXIT 5" );
+		socket->close( ec );
+		return;
+	}
+
+#ifdef _WIN32
+	int res = -1;
+	write_line( *socket, mutex, "2 ERROR: Remote commands are not supported on this platform" );
+#else
+	int res = run_command( program, args, *socket, mutex );
+	if (res < 0)
+		write_line( *socket, mutex, "2 ERROR: Unable to run the command" );
+#endif
+	ostringstream oss;
+	oss << "EXIT " << (res < 0 ? 3 : res);
+	write_line( *socket, mutex, oss.str() );
+	socket->close( ec );
+}
+
+/**
+ * Serve commands on the given address
+ */
+int daemon_serve( const string& host, int port, const string& token, const string& program ) {
+	boost::asio::io_service io;
+	boost::system::error_code ec;
+
+	// Bind on the specified address
+	tcp::acceptor acceptor( io );
+	tcp::endpoint endpoint( boost::asio::ip::address::from_string(host, ec), port );
+	if (ec) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: Invalid listen address '" << host << "'";
+		return 5;
+	}
+	acceptor.open( endpoint.protocol(), ec );
+	if (!ec) acceptor.set_option( tcp::acceptor::reuse_address(true), ec );
+	if (!ec) acceptor.bind( endpoint, ec );
+	if (!ec) acceptor.listen( boost::asio::socket_base::max_connections, ec );
+	if (ec) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: Unable to listen on " << host << ":" << port << " (" << ec.message() << ")";
+		return 3;
+	}
+#ifndef _WIN32
+	// Clients that go away should not kill us
+	signal( SIGPIPE, SIG_IGN );
+#endif
+
+	// Every client is served by it's own thread
+	while (true) {
+		boost::shared_ptr<CLIDaemonClient> client = boost::make_shared<CLIDaemonClient>();
+		acceptor.accept( client->socket, ec );
+		if (ec) continue;
+		boost::thread( boost::bind(&serve_client, client, token, program) ).detach();
+	}
+
+	return 0;
+}
+
+/**
+ * Generate a token for the daemon
+ */
+bool daemon_generate_token( string * token ) {
+#ifdef _WIN32
+	return false;
+#else
+	unsigned char buf[16];
+	int fd = open( "/dev/urandom", O_RDONLY | O_CLOEXEC );
+	if (fd < 0) return false;
+	ssize_t len = read( fd, buf, sizeof(buf) );
+	close( fd );
+	if (len != (ssize_t)sizeof(buf)) return false;
+
+	static const char * hex = "0123456789abcdef";
+	token->clear();
+	for (size_t i=0; i<sizeof(buf); i++) {
+		*token += hex[buf[i] >> 4];
+		*token += hex[buf[i] & 0x0f];
+	}
+
+	// Replace the previous token, creating the file only for us
+	string filename = get_cli_data_path( CLI_DAEMON_TOKEN_FILE );
+	unlink( filename.c_str() );
+	fd = open( filename.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600 );
+	if (fd < 0) return false;
+	string line = *token + "\n";
+	bool ok = (write( fd, line.c_str(), line.length() ) == (ssize_t)line.length());
+	close( fd );
+	return ok;
+#endif
+}
+
+/**
+ * Read the token of the daemon
+ */
+bool daemon_read_token( string * token ) {
+	ifstream f( get_cli_data_path( CLI_DAEMON_TOKEN_FILE ).c_str() );
+	if (!f.good()) return false;
+	if (!getline( f, *token )) return false;
+	return !token->empty();
+}
+
+/**
+ * Run a command on a remote daemon
+ */
+int remote_run( const string& address, const vector<string>& args, const string& token, vector<string> * output ) {
+	boost::asio::io_service io;
+	boost::system::error_code ec;
+
+	// Split address
+	string host = address, port;
+	size_t pos = address.rfind(':');
+	if ((pos != string::npos) && (address.find(']') == string::npos || pos > address.find(']'))) {
+		host = address.substr(0, pos);
+		port = address.substr(pos + 1);
+	} else {
+		ostringstream oss;
+		oss << CLI_DAEMON_PORT;
+		port = oss.str();
+	}
+	if ((host.length() > 1) && (host[0] == '['))
+		host = host.substr( 1, host.length() - 2 );
+
+	// Connect
+	tcp::resolver resolver( io );
+	tcp::resolver::iterator endpoints = resolver.resolve( tcp::resolver::query(host, port), ec );
+	tcp::socket socket( io );
+	if (!ec) boost::asio::connect( socket, endpoints, ec );
+	if (ec) {
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << address << ": Unable to connect (" << ec.message() << ")";
+		return 3;
+	}
+
+	// Send the request
+	ostringstream oss;
+	oss << "CERNVM-CLI 1\n";
+	oss << "TOKEN " << token << "\n";
+	for (vector<string>::const_iterator it = args.begin(); it != args.end(); ++it)
+		oss << "ARG " << escape_arg(*it) << "\n";
+	oss << "RUN\n";
+	boost::asio::write( socket, boost::asio::buffer(oss.str()), ec );
+	if (ec) {
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << address << ": Unable to send the command (" << ec.message() << ")";
+		return 3;
+	}
+
+	// Print the output until we get the exit code
+	boost::asio::streambuf buf;
+	string line;
+	while (read_line( socket, buf, &line )) {
+		if (line.compare(0, 5, "EXIT ") == 0)
+			return atoi( line.c_str() + 5 );
+		if (line.length() < 2) continue;
+		if (output && (line[0] == '1')) {
+			output->push_back( line.substr(2) );
+			continue;
+		}
+		CLIOutputLine( (line[0] == '1') ? CLI_STDOUT : CLI_STDERR ) << address << ": " << line.substr(2);
+	}
+
+	CLIOutputLine(CLI_STDERR) << "[!!!!] " << address << ": The connection was closed before the command completed";
+	return 3;
+}
+
+/**
+ * Read a hosts file
+ */
+bool read_hosts_file( const string& filename, vector<string> * hosts ) {
+	ifstream f( filename.c_str() );
+	if (!f.good()) return false;
+	string line;
+	while (getline(f, line)) {
+		size_t hash = line.find('#');
+		if (hash != string::npos) line = line.substr(0, hash);
+		size_t start = line.find_first_not_of(" \t\r");
+		if (start == string::npos) continue;
+		size_t end = line.find_last_not_of(" \t\r");
+		hosts->push_back( line.substr(start, end - start + 1) );
+	}
+	return true;
+}
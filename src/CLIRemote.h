@@ -0,0 +1,97 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_REMOTE_H
+#define CLI_REMOTE_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * The default port of the daemon
+ */
+#define CLI_DAEMON_PORT 		9118
+
+/**
+ * Running commands on other hosts
+ *
+ * The daemon accepts commands over TCP and runs each one as a new
+ * cernvm-cli process, streaming back it's output. The protocol is
+ * line-based:
+ *
+ *   client: CERNVM-CLI 1
+ *   client: TOKEN <secret>
+ *   client: ARG <argument>           (one for every argument)
+ *   client: RUN
+ *   daemon: 1 <line>                 (a line on stdout)
+ *   daemon: 2 <line>                 (a line on stderr)
+ *   daemon: EXIT <code>
+ *
+ * Backslashes and new lines in the arguments are escaped. The arguments
+ * may start with the global options that are safe to use remotely
+ * (-l, -j, --timeout, -s), followed by the command. Everything after the
+ * command is passed to it as-is. Any other global option (--record,
+ * --answers, --host etc.) is refused with exit code 5.
+ *
+ * The whole request must arrive within 10 seconds, be at most 64KB and
+ * carry at most 256 arguments, otherwise it's dropped before the token
+ * is even checked.
+ */
+
+/**
+ * The file holding the token generated for the daemon
+ */
+#define CLI_DAEMON_TOKEN_FILE 	"daemon.token"
+
+/**
+ * Serve commands on the given address (blocking)
+ */
+int daemon_serve( const string& host, int port, const string& token, const string& program );
+
+/**
+ * Generate a new random token and save it in CLI_DAEMON_TOKEN_FILE,
+ * readable only by the current user
+ */
+bool daemon_generate_token( string * token );
+
+/**
+ * Read the token from CLI_DAEMON_TOKEN_FILE
+ */
+bool daemon_read_token( string * token );
+
+/**
+ * Run a command on the daemon at <host>[:<port>], printing it's output
+ * prefixed with the address. Returns the exit code of the command.
+ *
+ * If 'output' is given, the lines the command prints on stdout are
+ * collected there instead of being printed.
+ */
+int remote_run( const string& address, const vector<string>& args, const string& token, vector<string> * output = NULL );
+
+/**
+ * Read the addresses of a hosts file (one per line, '#' for comments)
+ */
+bool read_hosts_file( const string& filename, vector<string> * hosts );
+
+#endif /* end of include guard: CLI_REMOTE_H */
@@ -0,0 +1,117 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLIRetry.h"
+#include "CLIOutput.h"
+
+#include <CernVM/Utilities.h>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+
+int CLIRetry::retries = 3;
+int CLIRetry::budget = 300;
+
+// Jitter source, shared by the parallel workers
+static boost::mutex 		jitterMutex;
+static boost::random::mt19937 	jitterSource( (unsigned int) time(NULL) );
+
+/**
+ * Pick a delay for the given retry: exponential, with the
+ * lower half randomized so parallel workers don't retry in sync.
+ */
+static int backoff_delay( int retry ) {
+	int delay = CLI_RETRY_BASE_DELAY;
+	for (int i=1; (i<retry) && (delay < CLI_RETRY_MAX_DELAY); i++)
+		delay *= 2;
+	if (delay > CLI_RETRY_MAX_DELAY)
+		delay = CLI_RETRY_MAX_DELAY;
+
+	boost::mutex::scoped_lock lock(jitterMutex);
+	boost::random::uniform_int_distribution<> jitter( delay / 2, delay );
+	return jitter( jitterSource );
+}
+
+/**
+ * Check if an error might go away if we try again
+ */
+bool CLIRetry::transient( int error ) {
+	switch (error) {
+		case HVE_MODIFY_ERROR:
+		case HVE_CONTROL_ERROR:
+		case HVE_QUERY_ERROR:
+		case HVE_IO_ERROR:
+		case HVE_EXTERNAL_ERROR:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/**
+ * Return the exit code for an error of the hypervisor
+ */
+int CLIRetry::exitCode( int error ) {
+	switch (error) {
+		case HVE_INVALID_STATE:
+		case HVE_NOT_ALLOWED:
+			return 4;
+		case HVE_USAGE_ERROR:
+			return 5;
+		default:
+			return transient(error) ? CLI_EXIT_TRANSIENT : 3;
+	}
+}
+
+/**
+ * Run the action, retrying it on transient errors
+ */
+int CLIRetry::run( const string& name, const string& operation, const retryAction& action, const CLIDeadline& deadline ) {
+	boost::posix_time::ptime giveUp = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds( budget );
+	int res;
+
+	for (int retry=1; ; retry++) {
+		res = action();
+		if (res >= 0)
+			return res;
+		if (!transient(res) || (retry > retries))
+			break;
+
+		// Don't start a retry we would not have time to finish
+		int delay = backoff_delay( retry );
+		if (boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(delay) >= giveUp)
+			break;
+		ostringstream oss;
+		oss << fixed << setprecision(1) << delay / 1000.0;
+		CLIOutputLine(CLI_STDERR) << "[warn] " << name << ": Unable to " << operation << " (error " << res << "), retrying in "
+		                          << oss.str() << "s (" << retry << " of " << retries << ")";
+		if (!deadline.sleep( delay ))
+			return deadline.reason();
+	}
+
+	CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": Unable to " << operation << " (error " << res << ")";
+	return exitCode( res );
+}
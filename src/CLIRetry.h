@@ -0,0 +1,91 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_RETRY_H
+#define CLI_RETRY_H
+
+#include "CLICancel.h"
+
+#include <boost/function.hpp>
+
+#include <string>
+
+using namespace std;
+
+/**
+ * Exit code of an operation that kept failing with transient
+ * errors until the retries ran out. Running it again might work.
+ */
+#define CLI_EXIT_TRANSIENT 	9
+
+/**
+ * Backoff between the attempts (in milliseconds)
+ */
+#define CLI_RETRY_BASE_DELAY 	1000
+#define CLI_RETRY_MAX_DELAY 	30000
+
+/**
+ * An attempt of an operation. Returns 0 on success, a negative HVE_* error
+ * of the hypervisor, or an exit code if it should not be attempted again.
+ */
+typedef boost::function< int () > 	retryAction;
+
+/**
+ * Retries the session operations that fail for transient reasons
+ *
+ * Under heavy load the hypervisor occasionally fails to control a VM,
+ * for example because another process holds the VM lock. Such errors
+ * are retried with jittered exponential backoff, while the errors that
+ * would only fail again (invalid state, missing VM) are reported right away.
+ */
+class CLIRetry {
+public:
+
+	/**
+	 * Run the action, retrying it on transient errors. Returns 0 on
+	 * success or the exit code of the failure.
+	 */
+	static int 		run( const string& name, const string& operation, const retryAction& action, const CLIDeadline& deadline );
+
+	/**
+	 * Check if an error of the hypervisor might go away if we try again
+	 */
+	static bool 	transient( int error );
+
+	/**
+	 * Return the exit code for an error of the hypervisor
+	 */
+	static int 		exitCode( int error );
+
+	/**
+	 * How many times to retry an operation
+	 */
+	static int 		retries;
+
+	/**
+	 * For how long to keep retrying an operation, in seconds
+	 */
+	static int 		budget;
+
+};
+
+#endif /* end of include guard: CLI_RETRY_H */
@@ -0,0 +1,147 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+#include "CLISessionLock.h"
+#include "CLICancel.h"
+#include "cli-utils.h"
+
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#ifndef _WIN32
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+int CLISessionLock::waitTimeout = -1;
+
+/**
+ * Constructor
+ */
+CLISessionLock::CLISessionLock( const string& session, bool exclusive ) : exclusive(exclusive), locked(false) {
+	if (session.empty()) {
+		filename = get_cli_data_path( "registry.lock" );
+	} else {
+		filename = get_cli_data_path( "session-" + encode_filename(session) + ".lock" );
+	}
+	init();
+}
+
+/**
+ * Constructor for named resources
+ */
+CLISessionLock::CLISessionLock( const string& kind, const string& name, bool exclusive ) : exclusive(exclusive), locked(false) {
+	filename = get_cli_data_path( kind + "-" + encode_filename(name) + ".lock" );
+	init();
+}
+
+/**
+ * Reset the file handle
+ */
+void CLISessionLock::init() {
+#ifdef _WIN32
+	handle = INVALID_HANDLE_VALUE;
+#else
+	fd = -1;
+#endif
+}
+
+/**
+ * Destructor
+ */
+CLISessionLock::~CLISessionLock() {
+	release();
+}
+
+/**
+ * Try to lock without blocking
+ */
+bool CLISessionLock::tryLock() {
+#ifdef _WIN32
+	if (handle == INVALID_HANDLE_VALUE) {
+		handle = CreateFileA( filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+			NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+		if (handle == INVALID_HANDLE_VALUE) return false;
+	}
+	OVERLAPPED ov;
+	ZeroMemory( &ov, sizeof(ov) );
+	DWORD flags = LOCKFILE_FAIL_IMMEDIATELY | (exclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0);
+	return (LockFileEx( handle, flags, 0, 1, 0, &ov ) != 0);
+#else
+	if (fd < 0) {
+		fd = open( filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600 );
+		if (fd < 0) return false;
+	}
+	return (flock( fd, (exclusive ? LOCK_EX : LOCK_SH) | LOCK_NB ) == 0);
+#endif
+}
+
+/**
+ * Acquire the lock
+ */
+bool CLISessionLock::acquire() {
+	return wait( waitTimeout, true );
+}
+
+/**
+ * Acquire the lock with the given timeout
+ */
+bool CLISessionLock::acquire( int timeout ) {
+	return wait( timeout, false );
+}
+
+/**
+ * Poll until we get the lock, run out of time or the user cancels
+ */
+bool CLISessionLock::wait( int timeout, bool cancellable ) {
+	if (locked) return true;
+
+	boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(timeout);
+	while (!tryLock()) {
+		if (((timeout >= 0) && (boost::posix_time::microsec_clock::universal_time() >= deadline)) ||
+			(cancellable && CLICancel::requested())) {
+			release();
+			return false;
+		}
+		boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+	}
+
+	locked = true;
+	return true;
+}
+
+/**
+ * Release the lock
+ */
+void CLISessionLock::release() {
+	locked = false;
+#ifdef _WIN32
+	if (handle != INVALID_HANDLE_VALUE) {
+		CloseHandle( handle );
+		handle = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (fd >= 0) {
+		close( fd );
+		fd = -1;
+	}
+#endif
+}
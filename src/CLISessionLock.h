@@ -0,0 +1,103 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+#pragma once
+#ifndef CLI_SESSION_LOCK_H
+#define CLI_SESSION_LOCK_H
+
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+using namespace std;
+
+/**
+ * Advisory file lock that coordinates concurrent cernvm-cli processes
+ *
+ * Every session has it's own lock file, so operations on different
+ * sessions never wait for each other. Operations that only read from
+ * a session take the lock shared. The registry lock is only held for
+ * the short time a session is created or deleted.
+ *
+ * The lock is released when the object is destroyed.
+ */
+class CLISessionLock {
+public:
+
+	/**
+	 * Prepare a lock on the given session (or on the registry if empty)
+	 */
+	CLISessionLock( const string& session, bool exclusive );
+
+	/**
+	 * Prepare a lock on any other named resource
+	 */
+	CLISessionLock( const string& kind, const string& name, bool exclusive );
+
+	/**
+	 * Release the lock
+	 */
+	~CLISessionLock();
+
+	/**
+	 * Acquire the lock, waiting according to waitTimeout.
+	 * Returns false if the lock is held by somebody else, or if
+	 * the user pressed Ctrl-C while waiting (see CLICancel).
+	 */
+	bool 	acquire();
+
+	/**
+	 * Acquire the lock, waiting up to 'timeout' seconds. This wait
+	 * is not interrupted by Ctrl-C, so it's meant for the short
+	 * critical sections that must complete.
+	 */
+	bool 	acquire( int timeout );
+
+	/**
+	 * Release the lock
+	 */
+	void 	release();
+
+	/**
+	 * How many seconds to wait for a lock (-1 waits forever, 0 does not wait)
+	 */
+	static int 	waitTimeout;
+
+private:
+
+	void 	init();
+	bool 	tryLock();
+	bool 	wait( int timeout, bool cancellable );
+
+	string 	filename;
+	bool 	exclusive;
+	bool 	locked;
+
+#ifdef _WIN32
+	HANDLE 	handle;
+#else
+	int 	fd;
+#endif
+
+};
+
+#endif /* end of include guard: CLI_SESSION_LOCK_H */
@@ -0,0 +1,155 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#include "CLIStats.h"
+#include "CLIRecorder.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <stdlib.h>
+
+/**
+ * Constructor
+ */
+CLIStatsRing::CLIStatsRing( size_t capacity ) : samples( capacity < 2 ? 2 : capacity ), head(0), count(0) { }
+
+/**
+ * Add a sample, overwriting the oldest one when full
+ */
+void CLIStatsRing::push( const CLIStatsSample& sample ) {
+	samples[head] = sample;
+	head = (head + 1) % samples.size();
+	if (count < samples.size()) count++;
+}
+
+/**
+ * Return the i-th sample, starting from the oldest
+ */
+const CLIStatsSample& CLIStatsRing::at( size_t i ) const {
+	return samples[ (head + samples.size() - count + i) % samples.size() ];
+}
+
+/**
+ * Calculate the usage between consecutive samples
+ */
+void CLIStatsRing::rates( vector<CLIStatsRates> * rates ) const {
+	rates->clear();
+	for (size_t i=1; i<count; i++) {
+		const CLIStatsSample& a = at(i-1);
+		const CLIStatsSample& b = at(i);
+		double dt = b.time - a.time;
+		if (dt <= 0) continue;
+
+		// Counters restart when the VM does
+		CLIStatsRates r;
+		r.cpu = b.cpu;
+		r.ram = b.ram;
+		r.diskRead = (b.diskRead >= a.diskRead) ? (b.diskRead - a.diskRead) / dt : 0;
+		r.diskWrite = (b.diskWrite >= a.diskWrite) ? (b.diskWrite - a.diskWrite) / dt : 0;
+		r.netRx = (b.netRx >= a.netRx) ? (b.netRx - a.netRx) / dt : 0;
+		r.netTx = (b.netTx >= a.netTx) ? (b.netTx - a.netTx) / dt : 0;
+		rates->push_back( r );
+	}
+}
+
+/**
+ * Nearest-rank percentile
+ */
+double stats_percentile( vector<double> values, double p ) {
+	if (values.empty()) return 0;
+	sort( values.begin(), values.end() );
+	size_t rank = (size_t)( p / 100.0 * values.size() + 0.5 );
+	if (rank < 1) rank = 1;
+	if (rank > values.size()) rank = values.size();
+	return values[rank - 1];
+}
+
+/**
+ * Constructor
+ */
+CLIStatsSampler::CLIStatsSampler( const HVInstancePtr& hv, const HVSessionPtr& session, size_t window )
+	: ring(window), hv(hv), session(session), ready(false) { }
+
+/**
+ * Take a sample
+ */
+bool CLIStatsSampler::sample() {
+	if (hv->type != HV_VIRTUALBOX)
+		return false;
+	string vboxid = session->parameters->get("vboxid"), err;
+	vector<string> lines;
+	SysExecConfig config;
+
+	// The CPU and memory metrics must be enabled once
+	if (!ready) {
+		if (hv_exec( hv, "metrics setup " + vboxid + " CPU/Load,RAM/Usage", &lines, &err, config ) != 0)
+			return false;
+		ready = true;
+	}
+
+	CLIStatsSample s;
+	s.time = (boost::posix_time::microsec_clock::universal_time() - boost::posix_time::ptime(boost::gregorian::date(1970,1,1))).total_milliseconds() / 1000.0;
+	s.cpu = s.ram = s.diskRead = s.diskWrite = s.netRx = s.netTx = 0;
+
+	// CPU and memory, for example:
+	// myvm            CPU/Load/User        2.00%
+	// myvm            RAM/Usage/Used       524288 kB
+	lines.clear();
+	if (hv_exec( hv, "metrics query " + vboxid + " CPU/Load/User,CPU/Load/Kernel,RAM/Usage/Used", &lines, &err, config ) != 0)
+		return false;
+	for (vector<string>::iterator it = lines.begin(); it != lines.end(); ++it) {
+		istringstream iss( *it );
+		string object, metric, value;
+		if (!(iss >> object >> metric >> value)) continue;
+		if ((metric.compare("CPU/Load/User") == 0) || (metric.compare("CPU/Load/Kernel") == 0)) {
+			s.cpu += atof( value.c_str() );
+		} else if (metric.compare("RAM/Usage/Used") == 0) {
+			s.ram = atof( value.c_str() ) / 1024.0;
+		}
+	}
+
+	// Disk and network counters, for example:
+	// <Counter c="1234" unit="bytes" name="/Public/NetAdapter/0/BytesReceived"/>
+	lines.clear();
+	if (hv_exec( hv, "debugvm " + vboxid + " statistics --pattern \"/Public/*\"", &lines, &err, config ) != 0)
+		return false;
+	for (vector<string>::iterator it = lines.begin(); it != lines.end(); ++it) {
+		size_t c = it->find("c=\"");
+		size_t n = it->find("name=\"");
+		if ((c == string::npos) || (n == string::npos)) continue;
+		double value = atof( it->c_str() + c + 3 );
+		string name = it->substr( n + 6, it->find('"', n + 6) - n - 6 );
+
+		if (name.compare(0, 19, "/Public/NetAdapter/") == 0) {
+			if (name.find("/BytesReceived") != string::npos) s.netRx += value;
+			else if (name.find("/BytesTransmitted") != string::npos) s.netTx += value;
+		} else if (name.compare(0, 16, "/Public/Storage/") == 0) {
+			if (name.find("/BytesRead") != string::npos) s.diskRead += value;
+			else if (name.find("/BytesWritten") != string::npos) s.diskWrite += value;
+		}
+	}
+
+	boost::mutex::scoped_lock lock(mutex);
+	ring.push( s );
+	return true;
+}
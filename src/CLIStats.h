@@ -0,0 +1,131 @@
+/**
+ * This file is part of CernVM Command Line Interface.
+ *
+ * CernVM-Cli is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * CernVM-Cli is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with CernVM-Cli. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Developed by Ioannis Charalampidis 2013
+ * Contact: <ioannis.charalampidis[at]cern.ch>
+ */
+
+
+#pragma once
+#ifndef CLI_STATS_H
+#define CLI_STATS_H
+
+#include <CernVM/Hypervisor.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * A resource usage sample of a session. The disk and network
+ * values are counters since the VM was started.
+ */
+struct CLIStatsSample {
+	double 	time;
+	double 	cpu;
+	double 	ram;
+	double 	diskRead;
+	double 	diskWrite;
+	double 	netRx;
+	double 	netTx;
+};
+
+/**
+ * The usage between two samples: CPU in %, RAM in MB and the
+ * disk and network rates in bytes per second
+ */
+struct CLIStatsRates {
+	double 	cpu;
+	double 	ram;
+	double 	diskRead;
+	double 	diskWrite;
+	double 	netRx;
+	double 	netTx;
+};
+
+/**
+ * Fixed-size ring buffer of samples. When it's full the oldest
+ * sample is overwritten.
+ */
+class CLIStatsRing {
+public:
+
+	CLIStatsRing( size_t capacity );
+
+	/**
+	 * Add a sample
+	 */
+	void 		push( const CLIStatsSample& sample );
+
+	/**
+	 * The number of samples in the buffer
+	 */
+	size_t 		size() const { return count; };
+
+	/**
+	 * Return the i-th sample, starting from the oldest
+	 */
+	const CLIStatsSample& 	at( size_t i ) const;
+
+	/**
+	 * Return the usage between every two consecutive samples
+	 */
+	void 		rates( vector<CLIStatsRates> * rates ) const;
+
+private:
+	vector<CLIStatsSample> 	samples;
+	size_t 					head;
+	size_t 					count;
+
+};
+
+/**
+ * Return the p-th percentile (0-100) of the values
+ */
+double stats_percentile( vector<double> values, double p );
+
+/**
+ * Samples the resource usage of a session from the hypervisor
+ */
+class CLIStatsSampler {
+public:
+
+	CLIStatsSampler( const HVInstancePtr& hv, const HVSessionPtr& session, size_t window );
+
+	/**
+	 * Take a sample and add it to the ring buffer.
+	 * Returns false if the hypervisor could not provide one.
+	 */
+	bool 			sample();
+
+	/**
+	 * The samples collected so far (protected by mutex)
+	 */
+	CLIStatsRing 	ring;
+	boost::mutex 	mutex;
+
+private:
+
+	HVInstancePtr 	hv;
+	HVSessionPtr 	session;
+	bool 			ready;
+
+};
+
+#endif /* end of include guard: CLI_STATS_H */
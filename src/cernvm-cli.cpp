@@ -22,17 +22,50 @@
 #include <CernVM/Utilities.h>
 #include <CernVM/DomainKeystore.h>
 
+#include <boost/atomic.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
 
 #include "CLIInteraction.h"
 #include "CLIProgressFeedback.h"
+#include "CLIOutput.h"
+#include "CLIMetrics.h"
+#include "CLIAdmissionControl.h"
+#include "CLIFloppyIO.h"
+#include "CLISessionLock.h"
+#include "CLIDownloadProvider.h"
+#include "CLIImageCache.h"
+#include "CLICancel.h"
+#include "CLIStats.h"
+#include "CLILabels.h"
+#include "CLIPortAllocator.h"
+#include "CLIReclaimer.h"
+#include "CLIBundle.h"
+#include "CLIRecorder.h"
+#include "CLIRemote.h"
+#include "CLIRegistryWatcher.h"
+#include "CLICompletion.h"
+#include "CLIRetry.h"
+#include "CLILogFollower.h"
 #include "cli-utils.h"
 
 #include <map>
+#include <set>
+#include <vector>
 #include <iostream>
+#include <iomanip>
+#include <fstream>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 #include <sstream>
 #include <string>
 #include <list>
@@ -45,65 +78,485 @@ using namespace std;
 HVInstancePtr 						hv;
 boost::shared_ptr<CLIInteraction> 	userInteraction;
 FiniteTaskPtr	 					progressTask;
+int 								maxParallel = 4;
+vector<string> 						labelSelector;
+string 								selfPath;
+string 								remoteToken;
+
+// The rate of the reclaimer to start when the command completes (0 for none)
+boost::atomic<int> 					reclaimRate( 0 );
+
+// The progress task of the session handled by the current thread,
+// when a command runs on many sessions at once
+boost::thread_specific_ptr<FiniteTaskPtr> 	sessionTask;
+
+/**
+ * Parameters that can be changed with the SET command
+ */
+struct settable_parameter {
+	const char * 	name;
+	const char * 	vboxArg;	// The 'modifyvm' argument, or NULL if libCernVM applies it on start
+	bool 			hot;		// If it can be applied while the VM is running
+	int 			minValue;	// The range of numeric parameters (both 0 for the rest)
+	int 			maxValue;
+};
+static const settable_parameter SETTABLE_PARAMETERS[] = {
+	{ "ram", 			"--memory", false, 	128, 	1048576 },
+	{ "cpus", 			"--cpus", 	false, 	1, 		64 },
+	{ "executionCap", 	NULL, 		true, 	1, 		100 },
+	{ "userData", 		NULL, 		false, 	0, 		0 },
+	{ "cernvmVersion", 	NULL, 		false, 	0, 		0 },
+	{ "cernvmFlavor", 	NULL, 		false, 	0, 		0 }
+};
+static const size_t SETTABLE_PARAMETER_COUNT = sizeof(SETTABLE_PARAMETERS) / sizeof(settable_parameter);
 
 void show_help( const string& error ) {
 	if (!error.empty()) {
-		cerr << "ERROR: " << error << endl;
-	}
-	cerr << "CernVM Command Line Interface - v1.0" << endl;
-	cerr << "(C) 2014 Ioannis Charalampidis, PH/TH & CernVM Group, CERN" << endl;
-	cerr << endl;
-    cerr << "Usage:" << endl;
-	cerr << endl;
-	cerr << "   cernvm-cli [<options>] <command> [<session> [<arguments>]]" << endl;
-	cerr << endl;
-	cerr << "Options:" << endl;
-	cerr << endl;
-	cerr << "   -s | --silent                           Do not display any message" << endl;
-	cerr << "   -h | --help                             Show this help screen" << endl;
-	cerr << endl;
-	cerr << "Commands without arguments:" << endl;
-	cerr << endl;
-	cerr << "   list                                    List the registered machines" << endl;
-	cerr << endl;
-	cerr << "Commands:" << endl;
-	cerr << endl;
-	cerr << "   setup     <session>                     The name of the new session" << endl;
-	cerr << "             [--32]                        Use 32-bit CPU (default is 64-bit)" << endl;
-	cerr << "             [--fio]                       Use FloppyIO for data exchange" << endl;
-	cerr << "             [--gui]                       Enable GUI additions" << endl;
-	cerr << "             [--dualnic]                   Use two NICs instead of NATing through one" << endl;
-	cerr << "             [--ram <MB>]                  How much RAM to allocate on the new VM (default 512M)" << endl;
-	cerr << "             [--hdd <MB>]                  How much disk to allocate on the new VM (default 80Gb)" << endl;
-	cerr << "             [--api <num>]                 Define the API port to use (default " << DEFAULT_API_PORT << ")" << endl;
-	cerr << "             [--context <uuid>]            The ContextID for CernVM-Online to boot" << endl;
-	cerr << "             [--ver <ver>]                 The uCernVM version to use (default " << DEFAULT_CERNVM_VERSION << ")" << endl;
-    cerr << "             [--flavor devel|testing|prod] The uCernVM flavor to use (default " << DEFAULT_CERNVM_FLAVOR <<")" << endl;
-	cerr << "             [--start]                     Start the VM after configuration" << endl;
-	cerr << "             [--ssh]                       Synonym of --api 22" << endl;
-	cerr << endl;
-	cerr << "   start     <session>                     Start the VM" << endl;
-	cerr << "   stop      <session>                     Stop the VM" << endl;
-	cerr << "   save      <session>                     Save the VM on disk" << endl;
-	cerr << "   pause     <session>                     Pause the VM on memory" << endl;
-	cerr << "   resume    <session>                     Resume the VM" << endl;
-	cerr << "   remove    <session>                     Destroy and remove the VM" << endl;
-	cerr << "   get       <session> <parm> [<param>...] Get one or more configuration parameter values" << endl;
-	cerr << "   waitstate <session> [<state>]           Wait until the session state changes (optionally to the given state)" << endl;
-	cerr << endl;
-	cerr << "Examples:" << endl;
-	cerr << endl;
-	cerr << "   Before you use a session, you must first set it up, using the 'setup' command," << endl;
-	cerr << "   like this:" << endl;
-	cerr << endl;
-	cerr << "      cernvm-cli setup myvm --gui" << endl;
-	cerr << endl;
-	cerr << "   Then you can control it using the control commands like this:" << endl;
-	cerr << endl;
-	cerr << "      cernvm-cli start myvm" << endl;
-	cerr << endl;
+		CLIOutputLine(CLI_STDERR) << "ERROR: " << error;
+	}
+	CLIOutputLine(CLI_STDERR) << "CernVM Command Line Interface - v1.0";
+	CLIOutputLine(CLI_STDERR) << "(C) 2014 Ioannis Charalampidis, PH/TH & CernVM Group, CERN";
+	CLIOutputLine(CLI_STDERR);
+    CLIOutputLine(CLI_STDERR) << "Usage:";
+	CLIOutputLine(CLI_STDERR);
+	CLIOutputLine(CLI_STDERR) << "   cernvm-cli [<options>] <command> [<session> [<arguments>]]";
+	CLIOutputLine(CLI_STDERR);
+	CLIOutputLine(CLI_STDERR) << "Options:";
+	CLIOutputLine(CLI_STDERR);
+	CLIOutputLine(CLI_STDERR) << "   -s | --silent                           Do not display any message";
+	CLIOutputLine(CLI_STDERR) << "   -j | --parallel <num>                   How many sessions to handle concurrently (default 4)";
+	CLIOutputLine(CLI_STDERR) << "   --host <host>[:<port>]                  Run the command on the daemon of that host (repeatable)";
+	CLIOutputLine(CLI_STDERR) << "   --hosts <file>                          Run the command on the daemons of all the hosts in the file";
+	CLIOutputLine(CLI_STDERR) << "                                           (list, get and waitstate print one table for all the hosts)";
+	CLIOutputLine(CLI_STDERR) << "   --token <secret>                        The secret shared between the daemon and it's clients";
+	CLIOutputLine(CLI_STDERR) << "                                           (if missing, the daemon generates one in " CLI_DAEMON_TOKEN_FILE ")";
+	CLIOutputLine(CLI_STDERR) << "   --record <file>                         Log the calls to the hypervisor, with their results and timing";
+	CLIOutputLine(CLI_STDERR) << "   --replay <file>                         Answer the calls to the hypervisor from a recording";
+	CLIOutputLine(CLI_STDERR) << "   --replay-speed <factor>                 Scale the recorded timing (default 1, 0 does not wait)";
+	CLIOutputLine(CLI_STDERR) << "   -l | --selector <key>=<value>           Run the command on the sessions with this label (repeatable)";
+	CLIOutputLine(CLI_STDERR) << "   --timeout <sec>                         Give up on any operation that takes longer, per session";
+	CLIOutputLine(CLI_STDERR) << "   --timeout <command>=<sec>               Use a different limit for the operations of a command (repeatable)";
+	CLIOutputLine(CLI_STDERR) << "   --retries <num>                         Retry the operations that fail for transient reasons (default " << CLIRetry::retries << ")";
+	CLIOutputLine(CLI_STDERR) << "   --retry-budget <sec>                    Stop retrying an operation after <sec> seconds (default " << CLIRetry::budget << ")";
+	CLIOutputLine(CLI_STDERR) << "   --wait-lock <sec>                       Wait up to <sec> for a session used by another process";
+	CLIOutputLine(CLI_STDERR) << "   --no-wait                               Fail immediately if a session is used by another process";
+	CLIOutputLine(CLI_STDERR) << "   --answers <file>                        Answer prompts using the rules in the file, one per line:";
+	CLIOutputLine(CLI_STDERR) << "                                           <accept|deny> <any|confirm|alert|license> <pattern>";
+	CLIOutputLine(CLI_STDERR) << "   --accept-license <pattern>              Accept the licenses whose title matches the pattern";
+	CLIOutputLine(CLI_STDERR) << "   --auto-confirm <pattern>                Confirm the questions whose title matches the pattern";
+	CLIOutputLine(CLI_STDERR) << "   --auto-deny <pattern>                   Deny the prompts whose title matches the pattern";
+	CLIOutputLine(CLI_STDERR) << "   --prompt-timeout <sec>                  Assume 'no' if a prompt is not answered in time";
+	CLIOutputLine(CLI_STDERR) << "   -h | --help                             Show this help screen";
+	CLIOutputLine(CLI_STDERR);
+	CLIOutputLine(CLI_STDERR) << "Commands without arguments:";
+	CLIOutputLine(CLI_STDERR);
+	CLIOutputLine(CLI_STDERR) << "   list                                    List the registered machines";
+	CLIOutputLine(CLI_STDERR) << "   images    prefetch                      Download a uCernVM image in the shared image cache";
+	CLIOutputLine(CLI_STDERR) << "             [--ver <ver>]                 The uCernVM version (default " << DEFAULT_CERNVM_VERSION << ")";
+	CLIOutputLine(CLI_STDERR) << "             [--flavor <flavor>]           The uCernVM flavor (default " << DEFAULT_CERNVM_FLAVOR << ")";
+	CLIOutputLine(CLI_STDERR) << "             [--32]                        Use the 32-bit image";
+	CLIOutputLine(CLI_STDERR) << "   images    list                          List the images in the cache";
+	CLIOutputLine(CLI_STDERR) << "   images    gc                            Remove the images no session uses";
+	CLIOutputLine(CLI_STDERR) << "             [--keep <num>]                How many of the most recent unused images to keep (default 1)";
+	CLIOutputLine(CLI_STDERR) << "   completion bash|zsh                     Print the shell completion script, load it with:";
+	CLIOutputLine(CLI_STDERR) << "                                           source <(cernvm-cli completion bash)";
+	CLIOutputLine(CLI_STDERR) << "   install-hypervisor                      Download and install VirtualBox";
+	CLIOutputLine(CLI_STDERR) << "             [--prefetch]                  Only download the installer in the cache";
+	CLIOutputLine(CLI_STDERR) << "   daemon                                  Accept commands from other hosts (see --host)";
+	CLIOutputLine(CLI_STDERR) << "             [--listen <host>:<port>]      The address to listen on (default 127.0.0.1:" << CLI_DAEMON_PORT << ")";
+	CLIOutputLine(CLI_STDERR) << "   reclaim                                 Delete the disks of the sessions removed with --async";
+	CLIOutputLine(CLI_STDERR) << "             [--rate <MB/s>]               How fast to delete them (default " << CLI_RECLAIM_RATE << ")";
+	CLIOutputLine(CLI_STDERR) << "   exporter                                Serve prometheus metrics on /metrics";
+	CLIOutputLine(CLI_STDERR) << "             [--listen <host>:<port>]      The address to listen on (default 127.0.0.1:9117)";
+	CLIOutputLine(CLI_STDERR) << "             [--interval <sec>]            How often to refresh the metrics (default 15)";
+	CLIOutputLine(CLI_STDERR);
+	CLIOutputLine(CLI_STDERR) << "Commands:";
+	CLIOutputLine(CLI_STDERR);
+	CLIOutputLine(CLI_STDERR) << "   setup     <session>                     The name of the new session";
+	CLIOutputLine(CLI_STDERR) << "             [--32]                        Use 32-bit CPU (default is 64-bit)";
+	CLIOutputLine(CLI_STDERR) << "             [--fio]                       Use FloppyIO for data exchange";
+	CLIOutputLine(CLI_STDERR) << "             [--gui]                       Enable GUI additions";
+	CLIOutputLine(CLI_STDERR) << "             [--dualnic]                   Use two NICs instead of NATing through one";
+	CLIOutputLine(CLI_STDERR) << "             [--ram <MB>]                  How much RAM to allocate on the new VM (default 512M)";
+	CLIOutputLine(CLI_STDERR) << "             [--hdd <MB>]                  How much disk to allocate on the new VM (default 80Gb)";
+	CLIOutputLine(CLI_STDERR) << "             [--api <num>]                 Define the API port to use (default " << DEFAULT_API_PORT << ")";
+	CLIOutputLine(CLI_STDERR) << "             [--context <uuid>]            The ContextID for CernVM-Online to boot";
+	CLIOutputLine(CLI_STDERR) << "             [--ver <ver>]                 The uCernVM version to use (default " << DEFAULT_CERNVM_VERSION << ")";
+    CLIOutputLine(CLI_STDERR) << "             [--flavor devel|testing|prod] The uCernVM flavor to use (default " << DEFAULT_CERNVM_FLAVOR <<")";
+	CLIOutputLine(CLI_STDERR) << "             [--start]                     Start the VM after configuration";
+	CLIOutputLine(CLI_STDERR) << "             [--ssh]                       Synonym of --api 22";
+	CLIOutputLine(CLI_STDERR) << "             [--label <key>=<value>]       Label the session, for use with -l (repeatable)";
+	CLIOutputLine(CLI_STDERR);
+	CLIOutputLine(CLI_STDERR) << "   start     <session>...                  Start one or more VMs";
+	CLIOutputLine(CLI_STDERR) << "             [--all]                       Start all the sessions";
+	CLIOutputLine(CLI_STDERR) << "             [--overcommit <ratio>]        How much to over-commit the host RAM and CPUs (default 1.0)";
+	CLIOutputLine(CLI_STDERR) << "   stop      <session>                     Stop the VM";
+	CLIOutputLine(CLI_STDERR) << "   save      <session>                     Save the VM on disk";
+	CLIOutputLine(CLI_STDERR) << "   pause     <session>                     Pause the VM on memory";
+	CLIOutputLine(CLI_STDERR) << "   resume    <session>                     Resume the VM";
+	CLIOutputLine(CLI_STDERR) << "   remove    <session>|--all               Destroy and remove the VM";
+	CLIOutputLine(CLI_STDERR) << "             [--async]                     Unregister the VM now and delete it's disks in the background";
+	CLIOutputLine(CLI_STDERR) << "             [--rate <MB/s>]               How fast to delete the disks in the background (default " << CLI_RECLAIM_RATE << ")";
+	CLIOutputLine(CLI_STDERR) << "   snapshot  <session> <tag>               Take a snapshot of the VM (live if running)";
+	CLIOutputLine(CLI_STDERR) << "   snapshots <session>                     List the snapshots of the VM";
+	CLIOutputLine(CLI_STDERR) << "   export    <session>                     Write the VM and it's parameters as a bundle on stdout";
+	CLIOutputLine(CLI_STDERR) << "   import    <session>                     Create a VM from a bundle read from stdin";
+	CLIOutputLine(CLI_STDERR) << "   restore   <session>... <tag>            Restore one or more VMs to the given snapshot";
+	CLIOutputLine(CLI_STDERR) << "             [--all]                       Restore all the sessions";
+	CLIOutputLine(CLI_STDERR) << "   get       <session> <parm> [<param>...] Get one or more configuration parameter values";
+	CLIOutputLine(CLI_STDERR) << "   get       <session>... -- <param>...    Get parameters from many sessions (wildcards allowed)";
+	CLIOutputLine(CLI_STDERR) << "   get       --all <param>...              Get parameters from all sessions (wildcards allowed)";
+	CLIOutputLine(CLI_STDERR) << "             [--format <format>]           The output format: plain, table, jsonl or tsv (default is table for many sessions)";
+	CLIOutputLine(CLI_STDERR) << "   set       <session>... <param>=<value>  Change configuration parameters of one or more sessions";
+	CLIOutputLine(CLI_STDERR) << "             [--all]                       Change the parameters of all sessions";
+	CLIOutputLine(CLI_STDERR) << "                                           Parameters: ram, cpus, executionCap, userData,";
+	CLIOutputLine(CLI_STDERR) << "                                           cernvmVersion, cernvmFlavor";
+	CLIOutputLine(CLI_STDERR) << "   waitstate <session> [<state>]           Wait until the session state changes (optionally to the given state)";
+	CLIOutputLine(CLI_STDERR) << "   stats     <session>...                  Sample the CPU, memory, disk and network usage of the VMs";
+	CLIOutputLine(CLI_STDERR) << "             [--all]                       Sample all the sessions";
+	CLIOutputLine(CLI_STDERR) << "             [--interval <ms>]             The sampling interval (default 1000)";
+	CLIOutputLine(CLI_STDERR) << "             [--count <num>]               Stop after so many samples (default is until Ctrl-C)";
+	CLIOutputLine(CLI_STDERR) << "             [--window <num>]              How many samples to keep for the percentiles (default 60)";
+	CLIOutputLine(CLI_STDERR) << "             [--format table|jsonl]        The output format (default table)";
+	CLIOutputLine(CLI_STDERR) << "   logs      <session>...                  Print the hypervisor log and the serial console output of the VMs";
+	CLIOutputLine(CLI_STDERR) << "             [--all]                       Print the logs of all sessions";
+	CLIOutputLine(CLI_STDERR) << "             [-n|--lines <num>]            Only print the last <num> lines of every log";
+	CLIOutputLine(CLI_STDERR) << "             [-f|--follow]                 Keep printing the new lines until Ctrl-C";
+	CLIOutputLine(CLI_STDERR) << "   autosave  [<session>...]                Save the running VMs that stay idle (default all sessions)";
+	CLIOutputLine(CLI_STDERR) << "             [--idle-cpu <pct>]            The CPU usage below which a VM is idle (default 5)";
+	CLIOutputLine(CLI_STDERR) << "             [--idle-for <duration>]       How long a VM must be idle, like 90s, 15m or 2h (default 10m)";
+	CLIOutputLine(CLI_STDERR) << "             [--interval <ms>]             How often to check the VMs (default 10000)";
+	CLIOutputLine(CLI_STDERR) << "                                           Saved VMs are resumed by exec, push and pull when needed";
+	CLIOutputLine(CLI_STDERR) << "   exec      <session>... -- <command>     Run a command over SSH in one or more VMs";
+	CLIOutputLine(CLI_STDERR) << "             [--all]                       Run the command in all sessions";
+	CLIOutputLine(CLI_STDERR) << "             [--persist <sec>]             Keep the SSH connection open for re-use (default 600)";
+	CLIOutputLine(CLI_STDERR) << "   push      <session>... <src> <dst>      Copy a file or directory into the <dst> directory of the VMs";
+	CLIOutputLine(CLI_STDERR) << "   pull      <session>... <src> <dst>      Copy a file or directory from the VMs into <dst>";
+	CLIOutputLine(CLI_STDERR) << "             [--all]                       Transfer to/from all sessions";
+	CLIOutputLine(CLI_STDERR) << "             [-z|--compress]               Compress the data on the fly";
+	CLIOutputLine(CLI_STDERR);
+	CLIOutputLine(CLI_STDERR) << "Examples:";
+	CLIOutputLine(CLI_STDERR);
+	CLIOutputLine(CLI_STDERR) << "   Before you use a session, you must first set it up, using the 'setup' command,";
+	CLIOutputLine(CLI_STDERR) << "   like this:";
+	CLIOutputLine(CLI_STDERR);
+	CLIOutputLine(CLI_STDERR) << "      cernvm-cli setup myvm --gui";
+	CLIOutputLine(CLI_STDERR);
+	CLIOutputLine(CLI_STDERR) << "   Then you can control it using the control commands like this:";
+	CLIOutputLine(CLI_STDERR);
+	CLIOutputLine(CLI_STDERR) << "      cernvm-cli start myvm";
+	CLIOutputLine(CLI_STDERR);
+}
+
+/**
+ * Lookup a registered session by it's name
+ */
+HVSessionPtr find_session( const string& name ) {
+	for (std::map< std::string, HVSessionPtr >::iterator it = hv->sessions.begin(); it != hv->sessions.end(); ++it) {
+		if ((*it).second->parameters->get("name", "").compare(name) == 0)
+			return (*it).second;
+	}
+	return HVSessionPtr();
+}
+
+/**
+ * Return the progress task to use for the session of the current thread
+ */
+FiniteTaskPtr session_progress() {
+	if (sessionTask.get() != NULL)
+		return *sessionTask;
+	return progressTask;
+}
+
+/**
+ * Index all the sessions by their name, for looking up many of them
+ */
+void index_sessions( map<string, HVSessionPtr> * byName ) {
+	for (std::map< std::string, HVSessionPtr >::iterator it = hv->sessions.begin(); it != hv->sessions.end(); ++it) {
+		(*byName)[ (*it).second->parameters->get("name", "") ] = (*it).second;
+	}
+}
+
+/**
+ * Add the sessions matching the label selector to the list
+ */
+int select_sessions( vector<string>& names, const map<string, HVSessionPtr>& byName ) {
+	vector<string> matches;
+	label_index_select( labelSelector, &matches );
+
+	int found = 0;
+	set<string> listed( names.begin(), names.end() );
+	for (vector<string>::iterator it = matches.begin(); it != matches.end(); ++it) {
+		// The index might be out of date, so check the session itself
+		map<string, HVSessionPtr>::const_iterator session = byName.find( *it );
+		if ((session == byName.end()) || !label_matches( session->second->parameters->get("labels", ""), labelSelector ))
+			continue;
+		if (listed.insert( *it ).second)
+			names.push_back( *it );
+		found++;
+	}
+	if (found == 0) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: No session matches the label selector";
+		return 2;
+	}
+	return 0;
+}
+
+/**
+ * Expand '--all' to all the session names, or make sure that all
+ * the sessions specified exist.
+ */
+int resolve_sessions( vector<string>& names, bool all ) {
+	map<string, HVSessionPtr> byName;
+	index_sessions( &byName );
+
+	// With a label selector, --all means all the matching sessions
+	if (!labelSelector.empty()) {
+		int res = select_sessions( names, byName );
+		if (res != 0) return res;
+	} else if (all) {
+		names.clear();
+		for (std::map< std::string, HVSessionPtr >::iterator it = hv->sessions.begin(); it != hv->sessions.end(); ++it) {
+			names.push_back( (*it).second->parameters->get("name", "") );
+		}
+		return 0;
+	}
+	for (vector<string>::iterator it = names.begin(); it != names.end(); ++it) {
+		if (byName.find(*it) == byName.end()) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: The specified session " << *it <<" does not exist!";
+			return 2;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Lookup a parameter in the SETTABLE_PARAMETERS table
+ */
+const settable_parameter * find_settable_parameter( const string& name ) {
+	for (size_t i=0; i<SETTABLE_PARAMETER_COUNT; i++) {
+		if (name.compare(SETTABLE_PARAMETERS[i].name) == 0)
+			return &SETTABLE_PARAMETERS[i];
+	}
+	return NULL;
+}
+
+/**
+ * Check the value of a parameter before applying it
+ */
+bool settable_value_valid( const settable_parameter * p, const string& value ) {
+	if (p->maxValue == 0)
+		return true;
+	if (value.empty() || (value.length() > 9))
+		return false;
+	for (size_t i=0; i<value.length(); i++) {
+		if (!isdigit((unsigned char) value[i])) return false;
+	}
+	int num = ston<int>( value );
+	return (num >= p->minValue) && (num <= p->maxValue);
+}
+
+/**
+ * Run a VBoxManage command on the VM of the given session
+ */
+int vbox_exec( const HVSessionPtr& session, const string& command, const string& args, vector<string> * lines ) {
+	if (hv->type != HV_VIRTUALBOX)
+		return HVE_NOT_SUPPORTED;
+
+	// Prepare arguments
+	string err, cmdline = command + " " + session->parameters->get("vboxid");
+	if (!args.empty())
+		cmdline += " " + args;
+
+	// Execute
+	SysExecConfig config;
+	return hv_exec( hv, cmdline, lines, &err, config );
+}
+
+/**
+ * Collect the UUIDs of the VMs the hypervisor is running or has paused
+ */
+bool list_running_vms( set<string> * uuids ) {
+	if (hv->type != HV_VIRTUALBOX)
+		return false;
+
+	// Every line is '"<name>" {<uuid>}'
+	vector<string> lines;
+	string err;
+	SysExecConfig config;
+	if (hv_exec( hv, "list runningvms", &lines, &err, config ) != 0)
+		return false;
+	for (vector<string>::iterator it = lines.begin(); it != lines.end(); ++it) {
+		size_t open = it->rfind('{'), close = it->rfind('}');
+		if ((open != string::npos) && (close != string::npos) && (close > open))
+			uuids->insert( it->substr(open + 1, close - open - 1) );
+	}
+	return true;
+}
+
+/**
+ * Apply the value of a parameter on the hypervisor
+ */
+int apply_parameter( const HVSessionPtr& session, const settable_parameter * p, const string& value ) {
+
+	// Execution cap can be changed at any time
+	if (string(p->name).compare("executionCap") == 0)
+		return session->setExecutionCap( ston<int>(value) );
+
+	// The rest are picked up by libCernVM when the VM is configured
+	if ((p->vboxArg == NULL) || (hv->type != HV_VIRTUALBOX))
+		return HVE_OK;
+
+	// Modify the VM
+	vector<string> lines;
+	return vbox_exec( session, "modifyvm", string(p->vboxArg) + " " + value, &lines );
+
+}
+
+/**
+ * Apply the changes the SET command deferred until the VM is powered off
+ */
+int apply_pending_changes( const HVSessionPtr& session ) {
+	string pending = session->parameters->get("pendingChanges", "");
+	if (pending.empty())
+		return HVE_OK;
+
+	// We can only apply them if the VM is powered off
+	session->update();
+	if (session->local->getNum<int>( "state", -1 ) != SS_POWEROFF)
+		return HVE_OK;
+
+	// Apply changes
+	vector<string> keys;
+	explode( pending, ',', &keys );
+	for (vector<string>::iterator it = keys.begin(); it != keys.end(); ++it) {
+		const settable_parameter * p = find_settable_parameter( *it );
+		if (p == NULL) continue;
+		int res = apply_parameter( session, p, session->parameters->get(*it) );
+		if (res < 0) return res;
+	}
+
+	// Everything is applied
+	session->parameters->erase("pendingChanges");
+	return HVE_OK;
+
+}
+
+/**
+ * Make sure the uCernVM image of the session is in the shared image
+ * cache, so sessions of the same version wait for a single download.
+ */
+int fetch_session_image( const HVSessionPtr& session, const FiniteTaskPtr& pf ) {
+	string version = session->parameters->get( "cernvmVersion", "" );
+	if (version.empty() || hv_replaying( hv )) return HVE_OK;
+	CLIImageCache cache( hv );
+	return cache.fetch(
+			version,
+			session->parameters->get( "cernvmFlavor", DEFAULT_CERNVM_FLAVOR ),
+			image_arch( session->parameters->getNum<int>( "flags", HVF_SYSTEM_64BIT ) ),
+			pf
+		);
+}
+
+/**
+ * Give the session a host port for the API forwarding, that is not
+ * used by any other session
+ */
+int allocate_api_port( const string& name ) {
+	vector<int> inUse;
+	for (std::map< std::string, HVSessionPtr >::iterator it = hv->sessions.begin(); it != hv->sessions.end(); ++it) {
+		if ((*it).second->parameters->get("name", "").compare(name) == 0) continue;
+		int port = (*it).second->local->getNum<int>( "apiPort", 0 );
+		if (port > 0) inUse.push_back( port );
+	}
+	return port_index_allocate( name, inUse );
+}
+
+/**
+ * Refresh the session names used by the shell completion.
+ * Must be called with the registry lock held.
+ */
+void update_session_cache() {
+	if (hv_replaying(hv)) return;
+	vector<string> names;
+	for (std::map< std::string, HVSessionPtr >::iterator it = hv->sessions.begin(); it != hv->sessions.end(); ++it) {
+		names.push_back( (*it).second->parameters->get("name", "") );
+	}
+	completion_cache_update( names );
+}
+
+/**
+ * Add a new session to the label index and give it a host port.
+ * Must be called with the registry lock held.
+ */
+void index_session( const HVSessionPtr& session, const string& name ) {
+	label_index_add( name, session->parameters->get("labels", "") );
+	if (session->local->getNum<int>( "apiPort", 0 ) == 0) {
+		int port = allocate_api_port( name );
+		if (port < 0) {
+			CLIOutputLine(CLI_STDERR) << "WARNING: Unable to allocate a host port for the API of " << name;
+		} else {
+			session->local->setNum<int>( "apiPort", port );
+		}
+	}
+	update_session_cache();
+}
+
+/**
+ * The bit of a session state, for the masks of session_transition()
+ */
+#define STATE_BIT(s) 	(1 << (s))
+
+/**
+ * One attempt to bring the session to the target state. Returns 0, a
+ * negative HVE_* error, or the exit code of an interrupted wait.
+ */
+int session_goto( const HVSessionPtr& session, const retryAction& request, int from, int target, const CLIDeadline& deadline ) {
+
+	// Check where we are, the previous attempt might have got there after all
+	session->update();
+	int state = session->local->getNum<int>( "state", SS_MISSING );
+	if (state == target)
+		return 0;
+	if (state == SS_MISSING)
+		return HVE_NOT_FOUND;
+	if ((STATE_BIT(state) & from) == 0)
+		return HVE_INVALID_STATE;
+
+	// Request and wait for completion
+	int res = request();
+	if (res < 0)
+		return res;
+	res = wait_session( session, deadline );
+	if (res != 0)
+		return res;
+
+	// The state machine does not report it's failures, so check where we ended up
+	session->update();
+	if (session->local->getNum<int>( "state", SS_MISSING ) != target)
+		return HVE_CONTROL_ERROR;
+	return 0;
+
+}
+
+/**
+ * Bring the session from any of the states in the 'from' mask to the target
+ * state, retrying on transient failures. Returns 0 or the exit code.
+ */
+int session_transition( const HVSessionPtr& session, const string& name, const string& operation,
+                        const retryAction& request, int from, int target, const CLIDeadline& deadline ) {
+	return CLIRetry::run( name, operation, boost::bind(&session_goto, session, request, from, target, boost::cref(deadline)), deadline );
 }
 
+/**
+ * The states every operation starts from
+ */
+#define START_FROM 		(STATE_BIT(SS_AVAILABLE) | STATE_BIT(SS_POWEROFF) | STATE_BIT(SS_SAVED))
+#define STOP_FROM 		(STATE_BIT(SS_AVAILABLE) | STATE_BIT(SS_SAVED) | STATE_BIT(SS_PAUSED) | STATE_BIT(SS_RUNNING))
+#define PAUSE_FROM 		(STATE_BIT(SS_RUNNING))
+#define RESUME_FROM 	(STATE_BIT(SS_PAUSED))
+#define SAVE_FROM 		(STATE_BIT(SS_PAUSED) | STATE_BIT(SS_RUNNING))
+
 /**
  * Get the first user 
  */
@@ -116,6 +569,7 @@ int handle_setup( list<string>& args, const string& name, const string& key ) {
 	int  	int_ram=512, int_hdd=81920, int_flags=HVF_SYSTEM_64BIT, int_port=80;
 	string	str_ver=DEFAULT_CERNVM_VERSION, context_id="", str_flavor=DEFAULT_CERNVM_FLAVOR, strval, arg;
 	bool 	bool_start=false, ssh_wait=false;
+	string 	str_labels;
 
 	while (!args.empty()) {
 		arg = args.front();
@@ -192,6 +646,19 @@ int handle_setup( list<string>& args, const string& name, const string& key ) {
 				return 5;
 			}
 			context_id = args.front(); args.pop_front();
+		} else if (arg.compare("--label") == 0) {
+			args.pop_front();
+			if (args.empty()) {
+				show_help("Missing value for the '--label' argument");
+				return 5;
+			}
+			strval = args.front(); args.pop_front();
+			if (!label_valid(strval)) {
+				show_help("The label '" + strval + "' should be in <key>=<value> format");
+				return 5;
+			}
+			if (!str_labels.empty()) str_labels += ",";
+			str_labels += strval;
 		} else {
 			args.pop_front();
             show_help("Unknown parameter '" + arg + "'");
@@ -218,25 +685,49 @@ int handle_setup( list<string>& args, const string& name, const string& key ) {
 		   .setNum<int>("flags", int_flags)
 		   .setNum<int>("ram", int_ram)
 		   .setNum<int>("disk", int_hdd);
+	if (!str_labels.empty())
+		params->set("labels", str_labels);
+
+	// Creating a session modifies the session registry
+	CLISessionLock registryLock( "", true );
+	if (!registryLock.acquire()) {
+		if (CLICancel::requested()) return CLI_EXIT_CANCELLED;
+		CLIOutputLine(CLI_STDERR) << "ERROR: The session registry is busy (used by another cernvm-cli process)";
+		return 6;
+	}
 	HVSessionPtr session = hv->sessionOpen( params, progressTask );
+	index_session( session, name );
+	registryLock.release();
     
     // Open & reach poweroff state
+	CLIDeadline deadline( CLICancel::timeoutFor("setup") );
+	int res;
     if (bool_start) {
+		if (fetch_session_image( session, progressTask ) != HVE_OK) {
+			CLIOutputLine(CLI_STDERR) << "WARNING: Unable to place the uCernVM image in the cache";
+		}
 		ParameterMapPtr userData = ParameterMap::instance();
-		session->start( userData );
+		res = session_transition( session, name, "start", boost::bind(&HVSession::start, session, userData), START_FROM, SS_RUNNING, deadline );
     } else {
-	    session->stop();
+		res = session_transition( session, name, "create the VM", boost::bind(&HVSession::stop, session), STOP_FROM, SS_POWEROFF, deadline );
     }
-
-	// Wait for completion
-	session->wait();
+	if ((res == CLI_EXIT_TIMEOUT) || (res == CLI_EXIT_CANCELLED)) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: The setup of " << name << (res == CLI_EXIT_TIMEOUT ? " timed out" : " was cancelled");
+		return res;
+	} else if (res != 0) {
+		return res;
+	}
 
 	// If we have SSH, display SSH port
 	if (ssh_wait) {
 
 		// Wait for SSH to appear
 		while (!session->isAPIAlive(HSK_SIMPLE)) {
-			boost::this_thread::sleep(boost::posix_time::milliseconds(5000));
+			if (!deadline.sleep(5000)) {
+				session->abort();
+				CLIOutputLine(CLI_STDERR) << "ERROR: SSH on " << name << (deadline.reason() == CLI_EXIT_TIMEOUT ? " did not come up in time" : " was cancelled");
+				return deadline.reason();
+			}
 		}
 
 		// Lookup the user to use for ssh
@@ -264,28 +755,157 @@ int handle_setup( list<string>& args, const string& name, const string& key ) {
 }
 
 /**
- * Handle the START command
+ * Start a single session, when the admission control allows it
  */
-int handle_start( list<string>& args, const string& name, const string& key ) {
-	
+int start_session( const string& name, CLIAdmissionControl * admission, const FiniteTaskPtr& pf ) {
+	HVSessionPtr info = find_session( name );
+
+	// Don't start anything new after the user cancelled
+	if (CLICancel::requested()) {
+		CLIOutputLine(CLI_STDERR) << "[skip] " << name << ": Cancelled";
+		return CLI_EXIT_CANCELLED;
+	}
+
+	// Make sure no other cernvm-cli process is working on this session
+	CLISessionLock lock( name, true );
+	if (!lock.acquire()) {
+		if (CLICancel::requested()) return CLI_EXIT_CANCELLED;
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": The session is busy (used by another cernvm-cli process)";
+		return 6;
+	}
+	CLIDeadline deadline( CLICancel::timeoutFor("start") );
+	int ram = info->parameters->getNum<int>( "ram", 512 );
+	int cpus = info->parameters->getNum<int>( "cpus", 1 );
+
+	// When starting many sessions, prefix the progress with their name
+	FiniteTaskPtr task = pf;
+	CLIProgessFeedback feedback( name + ": " );
+	if (!task) {
+		task = boost::make_shared<FiniteTask>();
+		feedback.silent = userInteraction->silent;
+		feedback.bindTo( task );
+	}
+
+	// Download the image before taking any host resources
+	if (fetch_session_image( info, task ) != HVE_OK) {
+		CLIOutputLine(CLI_STDERR) << "[warn] " << name << ": Unable to place the uCernVM image in the cache";
+	}
+
+	// Wait until the host has room for this VM
+	if (!admission->acquire( name, ram, cpus, deadline )) {
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": " << (deadline.reason() == CLI_EXIT_TIMEOUT ? "Timed out" : "Cancelled") << " while waiting for host resources";
+		return deadline.reason();
+	}
+	CLIMetricsTimer timer("start");
+
 	// Try to open a session
 	ParameterMapPtr params = ParameterMap::instance();
 	params->set("name", name)
-		   .set("secret", key);
-	HVSessionPtr session = hv->sessionOpen( params, progressTask );
+		   .set("secret", name);
+	HVSessionPtr session = hv->sessionOpen( params, task );
+
+	// Apply any changes deferred by the SET command. Don't start a VM
+	// that would not match the configuration we report for it.
+	if (apply_pending_changes( session ) < 0) {
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": Unable to apply the pending configuration changes";
+		session->abort();
+		admission->release( ram, cpus, false );
+		return 3;
+	}
 
 	// Start session with blank key/value userData
 	ParameterMapPtr userData = ParameterMap::instance();
-	session->start( userData );
-
-	// Wait for completion
-	session->wait();
+	int res = session_transition( session, name, "start", boost::bind(&HVSession::start, session, userData), START_FROM, SS_RUNNING, deadline );
 
 	// Cleanup thread
 	session->abort();
+	if (res == 0)
+		session->parameters->erase( "autosaved" );
+
+	// Let the next VM in
+	admission->release( ram, cpus, (res == 0) );
+	if ((res == CLI_EXIT_TIMEOUT) || (res == CLI_EXIT_CANCELLED)) {
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": " << (res == CLI_EXIT_TIMEOUT ? "Timed out" : "Cancelled") << " while starting";
+		return res;
+	}
+	if ((res == 0) && !pf) {
+		CLIOutputLine(CLI_STDERR) << "[ ok ] " << name << ": Started";
+	}
 
-	// return ok
-	return 0;
+	return res;
+
+}
+
+/**
+ * Handle the START command
+ */
+int handle_start( list<string>& args ) {
+	vector<string> 	names;
+	string 			arg, strval;
+	double 			overcommit=1.0;
+	bool 			bool_all=false;
+
+	while (!args.empty()) {
+		arg = args.front(); args.pop_front();
+		if (arg.compare("--all") == 0) {
+			bool_all = true;
+		} else if (arg.compare("--overcommit") == 0) {
+			if (args.empty()) {
+				show_help("Missing value for the '--overcommit' argument");
+				return 5;
+			}
+			strval = args.front(); args.pop_front();
+			overcommit = ston<double>(strval);
+			if (overcommit <= 0) {
+				show_help("The '--overcommit' ratio must be positive");
+				return 5;
+			}
+		} else if (arg[0] == '-') {
+            show_help("Unknown parameter '" + arg + "'");
+            return 5;
+		} else {
+			names.push_back(arg);
+		}
+	}
+
+	// Resolve sessions
+	if (!bool_all && names.empty() && labelSelector.empty()) {
+		show_help("Missing session name!");
+		return 5;
+	}
+	int res = resolve_sessions( names, bool_all );
+	if (res != 0) return res;
+
+	// Count the CPUs already used by running VMs. The state we loaded may
+	// be stale, so ask the hypervisor once which VMs are running right now,
+	// or synchronize every session if it can't tell us.
+	int usedCpus = 0;
+	set<string> running;
+	bool listed = list_running_vms( &running );
+	for (std::map< std::string, HVSessionPtr >::iterator it = hv->sessions.begin(); it != hv->sessions.end(); ++it) {
+		HVSessionPtr sess = (*it).second;
+		bool active;
+		if (listed) {
+			string vboxid = sess->parameters->get( "vboxid", "" );
+			if ((vboxid.length() > 2) && (vboxid[0] == '{'))
+				vboxid = vboxid.substr( 1, vboxid.length() - 2 );
+			active = (running.find( vboxid ) != running.end());
+		} else {
+			sess->update();
+			int state = sess->local->getNum<int>( "state", -1 );
+			active = (state == SS_RUNNING) || (state == SS_PAUSED);
+		}
+		if (active)
+			usedCpus += sess->parameters->getNum<int>( "cpus", 1 );
+	}
+	CLIAdmissionControl admission( overcommit, usedCpus );
+
+	// A single session reports it's progress as usual
+	if (names.size() == 1)
+		return start_session( names[0], &admission, progressTask );
+
+	// Start all sessions in parallel
+	return run_parallel( names, boost::bind(&start_session, _1, &admission, FiniteTaskPtr()), maxParallel );
 
 }
 
@@ -298,19 +918,15 @@ int handle_stop( list<string>& args, const string& name, const string& key ) {
 	ParameterMapPtr params = ParameterMap::instance();
 	params->set("name", name)
 		   .set("secret", key);
-	HVSessionPtr session = hv->sessionOpen( params, progressTask );
+	HVSessionPtr session = hv->sessionOpen( params, session_progress() );
 
-	// Stop
-	session->stop();
-
-	// Wait for completion
-	session->wait();
+	// Stop and wait for completion
+	int res = session_transition( session, name, "stop", boost::bind(&HVSession::stop, session), STOP_FROM, SS_POWEROFF, CLIDeadline( CLICancel::timeoutFor("stop") ) );
 
 	// Cleanup thread
 	session->abort();
 
-	// return ok
-	return 0;
+	return res;
 
 }
 
@@ -323,19 +939,15 @@ int handle_pause( list<string>& args, const string& name, const string& key ) {
 	ParameterMapPtr params = ParameterMap::instance();
 	params->set("name", name)
 		   .set("secret", key);
-	HVSessionPtr session = hv->sessionOpen( params, progressTask );
+	HVSessionPtr session = hv->sessionOpen( params, session_progress() );
 
-	// Pause
-	session->pause();
-
-	// Wait for completion
-	session->wait();
+	// Pause and wait for completion
+	int res = session_transition( session, name, "pause", boost::bind(&HVSession::pause, session), PAUSE_FROM, SS_PAUSED, CLIDeadline( CLICancel::timeoutFor("pause") ) );
 
 	// Cleanup thread
 	session->abort();
 
-	// return ok
-	return 0;
+	return res;
 
 }
 
@@ -348,19 +960,15 @@ int handle_resume( list<string>& args, const string& name, const string& key ) {
 	ParameterMapPtr params = ParameterMap::instance();
 	params->set("name", name)
 		   .set("secret", key);
-	HVSessionPtr session = hv->sessionOpen( params, progressTask );
-
-	// Pesume
-	session->resume();
+	HVSessionPtr session = hv->sessionOpen( params, session_progress() );
 
-	// Wait for completion
-	session->wait();
+	// Resume and wait for completion
+	int res = session_transition( session, name, "resume", boost::bind(&HVSession::resume, session), RESUME_FROM, SS_RUNNING, CLIDeadline( CLICancel::timeoutFor("resume") ) );
 
 	// Cleanup thread
 	session->abort();
 
-	// return ok
-	return 0;
+	return res;
 
 }
 
@@ -373,44 +981,68 @@ int handle_save( list<string>& args, const string& name, const string& key ) {
 	ParameterMapPtr params = ParameterMap::instance();
 	params->set("name", name)
 		   .set("secret", key);
-	HVSessionPtr session = hv->sessionOpen( params, progressTask );
+	HVSessionPtr session = hv->sessionOpen( params, session_progress() );
 
-	// Hibernate
-	session->hibernate();
-
-	// Wait for completion
-	session->wait();
+	// Hibernate and wait for completion
+	int res = session_transition( session, name, "save", boost::bind(&HVSession::hibernate, session), SAVE_FROM, SS_SAVED, CLIDeadline( CLICancel::timeoutFor("save") ) );
 
 	// Cleanup thread
 	session->abort();
 
-	// return ok
-	return 0;
+	return res;
 
 }
 
 /**
- * Handle the REMOVE command
+ * Check if the snapshot tag can be passed to the hypervisor. It's
+ * quoted on the command-line, so quotes, backslashes and control
+ * characters are not allowed.
  */
-int handle_remove( list<string>& args, const string& name, const string& key ) {
-
-	// Try to open a session
-	ParameterMapPtr params = ParameterMap::instance();
-	params->set("name", name)
-		   .set("secret", key);
-	HVSessionPtr session = hv->sessionOpen( params, progressTask );
-
-	// Destroy
-	session->close();
-
-	// Wait for completion
-	session->wait();
+bool snapshot_tag_valid( const string& tag ) {
+	if (tag.empty())
+		return false;
+	for (size_t i=0; i<tag.length(); i++) {
+		unsigned char c = (unsigned char) tag[i];
+		if ((c < 0x20) || (c == 0x7f) || (c == '"') || (c == '\\'))
+			return false;
+	}
+	return true;
+}
 
-	// Cleanup thread
-	session->abort();
+/**
+ * Handle the SNAPSHOT command
+ */
+int handle_snapshot( list<string>& args, const string& name, const string& key ) {
+	if (args.empty()) {
+		show_help("Missing snapshot tag!");
+		return 5;
+	}
+	string tag = args.front(); args.pop_front();
+	if (!snapshot_tag_valid(tag)) {
+		show_help("The snapshot tag can't contain quotes, backslashes or control characters");
+		return 5;
+	}
 
-	// Delete session
-	hv->sessionDelete(session);
+	// Synchronize state
+	HVSessionPtr session = find_session( name );
+	session->update();
+	int state = session->local->getNum<int>( "state", -1 );
+
+	// Running VMs are snapshotted live, so they can be restored in running state
+	string cmdline = "take \"" + tag + "\"";
+	if (state == SS_RUNNING)
+		cmdline += " --live";
+
+	// Take snapshot
+	vector<string> lines;
+	int res = vbox_exec( session, "snapshot", cmdline, &lines );
+	if (res == HVE_NOT_SUPPORTED) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: Snapshots are not supported by this hypervisor";
+		return 3;
+	} else if (res < 0) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: Unable to take snapshot '" << tag << "' of session " << name;
+		return 3;
+	}
 
 	// return ok
 	return 0;
@@ -418,27 +1050,43 @@ int handle_remove( list<string>& args, const string& name, const string& key ) {
 }
 
 /**
- * Handle the LIST command
+ * Handle the SNAPSHOTS command
  */
-int handle_list( list<string>& args ) {
+int handle_snapshots( list<string>& args, const string& name, const string& key ) {
+
+	// Query the snapshot tree
+	HVSessionPtr session = find_session( name );
+	vector<string> lines;
+	int res = vbox_exec( session, "snapshot", "list --machinereadable", &lines );
+	if (res == HVE_NOT_SUPPORTED) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: Snapshots are not supported by this hypervisor";
+		return 3;
+	}
 
-	// Iterate over open sessions
-	cerr << "Registered sessions with libCernVM:" << endl;
-	cerr << endl;
-	for (std::map< std::string, HVSessionPtr >::iterator it = hv->sessions.begin(); it != hv->sessions.end(); ++it) {
-		string name = (*it).first;
-		HVSessionPtr sess = (*it).second;
-		cout << " - " << sess->parameters->get("name", "") << " (" << name << ")" << endl;
-		cout << "   cpus=" << sess->parameters->get("cpus", "1")
-		     << ", ram=" << sess->parameters->get("ram", "512")
-		     << ", disk=" << sess->parameters->get("disk", "1024")
-		     << ", apiPort=" << sess->parameters->get("apiPort", BOOST_PP_STRINGIZE( DEFAULT_API_PORT ))
-		     << ", flags=" << sess->parameters->get("flags", "9")
-             << ", uCernVM=" << sess->parameters->get("cernvmVersion", DEFAULT_CERNVM_VERSION) << "," << sess->parameters->get("cernvmFlavor", DEFAULT_CERNVM_FLAVOR) << endl << endl;
+	// VirtualBox fails when there is nothing to list
+	if (res != 0) {
+		for (vector<string>::iterator it = lines.begin(); it != lines.end(); ++it) {
+			if (it->find("does not have any snapshots") != string::npos)
+				return 0;
+		}
+		CLIOutputLine(CLI_STDERR) << "ERROR: Unable to list the snapshots of " << name;
+		return 3;
+	}
+
+	// Flush stderror (status) messages
+	CLIOutput::flush();
+
+	// Extract the snapshot names (SnapshotName[-1-2..]="<name>")
+	for (vector<string>::iterator it = lines.begin(); it != lines.end(); ++it) {
+		string k, v;
+		size_t pos = it->find('=');
+		if (pos == string::npos) continue;
+		k = it->substr(0, pos);
+		v = it->substr(pos+1);
+		if (k.substr(0, 12).compare("SnapshotName") != 0) continue;
+		if ((v.length() >= 2) && (v[0] == '"')) v = v.substr(1, v.length()-2);
+		CLIOutputLine(CLI_STDOUT) << v;
 	}
-    if (hv->sessions.empty()) {
-        cerr << " (There are no registered sessions)" << endl;
-    }
 
 	// return ok
 	return 0;
@@ -446,95 +1094,2273 @@ int handle_list( list<string>& args ) {
 }
 
 /**
- * Handle the GET command
+ * Restore a single session to the given snapshot
  */
-int handle_get( list<string>& args, const string& name, const string& key ) {
-
+int restore_session( const string& name, const string& tag ) {
+	HVSessionPtr session = find_session( name );
+
+	// Make sure no other cernvm-cli process is working on this session
+	CLISessionLock lock( name, true );
+	if (!lock.acquire()) {
+		if (CLICancel::requested()) return CLI_EXIT_CANCELLED;
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": The session is busy (used by another cernvm-cli process)";
+		return 6;
+	}
+	vector<string> lines;
+	int res;
+
+	// The VM must not be running while restoring
+	session->update();
+	int state = session->local->getNum<int>( "state", -1 );
+	if ((state == SS_RUNNING) || (state == SS_PAUSED)) {
+		if (vbox_exec( session, "controlvm", "poweroff", &lines ) != 0) {
+			CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": Unable to power off the VM before restoring";
+			return 3;
+		}
+	}
+
+	// Restore snapshot
+	res = vbox_exec( session, "snapshot", "restore \"" + tag + "\"", &lines );
+	if (res != 0) {
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": Unable to restore snapshot '" << tag << "'";
+		return 3;
+	}
+
+	// Snapshots taken while running restore into the saved state,
+	// resume them so they are back where they were.
+	session->update();
+	if (session->local->getNum<int>( "state", -1 ) == SS_SAVED) {
+		ParameterMapPtr params = ParameterMap::instance();
+		params->set("name", name)
+			   .set("secret", name);
+		FiniteTaskPtr task = boost::make_shared<FiniteTask>();
+		CLIProgessFeedback feedback( name + ": " );
+		feedback.silent = userInteraction->silent;
+		feedback.bindTo( task );
+		HVSessionPtr vm = hv->sessionOpen( params, task );
+		ParameterMapPtr userData = ParameterMap::instance();
+		res = session_transition( vm, name, "resume", boost::bind(&HVSession::start, vm, userData), START_FROM, SS_RUNNING, CLIDeadline( CLICancel::timeoutFor("restore") ) );
+		vm->abort();
+		if ((res == CLI_EXIT_TIMEOUT) || (res == CLI_EXIT_CANCELLED)) {
+			CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": Restored to '" << tag << "', but " << (res == CLI_EXIT_TIMEOUT ? "timed out" : "cancelled") << " while resuming";
+			return res;
+		} else if (res != 0) {
+			CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": Restored to '" << tag << "', but it could not be resumed";
+			return res;
+		}
+	}
+	CLIOutputLine(CLI_STDERR) << "[ ok ] " << name << ": Restored to '" << tag << "'";
+	return 0;
+}
+
+/**
+ * Handle the RESTORE command
+ */
+int handle_restore( list<string>& args ) {
+	vector<string> 	names;
+	string 			arg;
+	bool 			bool_all=false;
+
+	while (!args.empty()) {
+		arg = args.front(); args.pop_front();
+		if (arg.compare("--all") == 0) {
+			bool_all = true;
+		} else if (arg[0] == '-') {
+            show_help("Unknown parameter '" + arg + "'");
+            return 5;
+		} else {
+			names.push_back(arg);
+		}
+	}
+
+	// The last argument is the tag
+	if (names.empty()) {
+		show_help("Missing snapshot tag!");
+		return 5;
+	}
+	string tag = names.back(); names.pop_back();
+	if (!snapshot_tag_valid(tag)) {
+		show_help("The snapshot tag can't contain quotes, backslashes or control characters");
+		return 5;
+	}
+	if (!bool_all && names.empty() && labelSelector.empty()) {
+		show_help("Missing session name!");
+		return 5;
+	}
+
+	// Resolve sessions
+	int res = resolve_sessions( names, bool_all );
+	if (res != 0) return res;
+
+	if (hv->type != HV_VIRTUALBOX) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: Snapshots are not supported by this hypervisor";
+		return 3;
+	}
+
+	// Restore all sessions in parallel
+	return run_parallel( names, boost::bind(&restore_session, _1, boost::cref(tag)), maxParallel );
+
+}
+
+/**
+ * Remove the session from the registry and the indexes
+ */
+int unregister_session( const HVSessionPtr& session, const string& name ) {
+	CLISessionLock registryLock( "", true );
+	if (!registryLock.acquire()) {
+		if (CLICancel::requested()) return CLI_EXIT_CANCELLED;
+		CLIOutputLine(CLI_STDERR) << "ERROR: The session registry is busy (used by another cernvm-cli process)";
+		return 6;
+	}
+	string labels = session->parameters->get("labels", "");
+	hv->sessionDelete(session);
+	label_index_remove( name, labels );
+	port_index_release( name );
+	registry_journal( "remove", name );
+	update_session_cache();
+	return 0;
+}
+
+/**
+ * A disk in the folder of a VM
+ */
+struct vm_disk {
+	string 	slot;
+	string 	path;
+	string 	uuid;
+};
+
+/**
+ * Read the string values of the VM configuration and the folder of the VM
+ */
+int read_vm_info( const HVSessionPtr& session, string * folder, map<string, string> * values ) {
+	vector<string> lines;
+	if (vbox_exec( session, "showvminfo", "--machinereadable", &lines ) != 0)
+		return HVE_NOT_SUPPORTED;
+
+	values->clear();
+	for (vector<string>::iterator it = lines.begin(); it != lines.end(); ++it) {
+		size_t eq = it->find("=\"");
+		if ((eq == string::npos) || ((*it)[it->length()-1] != '"')) continue;
+		string key = it->substr( 0, eq );
+		if ((key.length() > 1) && (key[0] == '"')) key = key.substr( 1, key.length() - 2 );
+		(*values)[key] = it->substr( eq + 2, it->length() - eq - 3 );
+	}
+
+	string cfgFile = (*values)["CfgFile"];
+	size_t sep = cfgFile.find_last_of("/\\");
+	if ((sep == string::npos) || (sep == 0))
+		return HVE_NOT_SUPPORTED;
+	*folder = cfgFile.substr( 0, sep );
+	return 0;
+}
+
+/**
+ * Find the folder of the VM and the disks in it, for example:
+ *
+ *   CfgFile="/home/user/VirtualBox VMs/myvm/myvm.vbox"
+ *   "SATA-0-0"="/home/user/VirtualBox VMs/myvm/disk.vdi"
+ *   "SATA-ImageUUID-0-0"="0b2c1ab0-..."
+ *
+ * The disks outside the folder (like the shared uCernVM image) are skipped.
+ */
+int read_vm_disks( const HVSessionPtr& session, string * folder, vector<vm_disk> * disks, bool * hasSnapshots = NULL ) {
+	map<string, string> values;
+	if (read_vm_info( session, folder, &values ) != 0)
+		return HVE_NOT_SUPPORTED;
+	string cfgFile = values["CfgFile"];
+	size_t sep = folder->length();
+	if (hasSnapshots != NULL)
+		*hasSnapshots = (values.find("SnapshotName") != values.end());
+
+	disks->clear();
+	for (map<string, string>::iterator it = values.begin(); it != values.end(); ++it) {
+		const string & path = (*it).second;
+		if ((path.length() < 5) || (path.compare(0, sep + 1, cfgFile, 0, sep + 1) != 0)) continue;
+		if ((path.compare(path.length()-4, 4, ".vdi") != 0) && (path.compare(path.length()-5, 5, ".vmdk") != 0)) continue;
+
+		// <controller>-<port>-<device> has it's UUID in <controller>-ImageUUID-<port>-<device>
+		vm_disk disk;
+		disk.slot = (*it).first;
+		disk.path = path;
+		size_t p2 = disk.slot.rfind('-');
+		size_t p1 = (p2 == string::npos || p2 == 0) ? string::npos : disk.slot.rfind('-', p2 - 1);
+		if (p1 == string::npos) continue;
+		disk.uuid = values[ disk.slot.substr(0, p1) + "-ImageUUID" + disk.slot.substr(p1) ];
+		disks->push_back( disk );
+	}
+	return 0;
+}
+
+/**
+ * Let the watcher know where the VM of every session lives
+ */
+void watch_sessions( CLIRegistryWatcher& watcher ) {
+	for (std::map< std::string, HVSessionPtr >::iterator it = hv->sessions.begin(); it != hv->sessions.end(); ++it) {
+		string folder;
+		vector<vm_disk> disks;
+		if (read_vm_disks( (*it).second, &folder, &disks ) == 0)
+			watcher.watch( (*it).second->parameters->get("name", ""), folder );
+	}
+}
+
+/**
+ * Unregister the VM of the session right away and leave the deletion
+ * of it's files to the background reclaimer
+ */
+int remove_session_async( const HVSessionPtr& session, const string& name, int rate ) {
+	string folder;
+	vector<vm_disk> disks;
+	vector<string> out;
+	if (read_vm_disks( session, &folder, &disks ) != 0)
+		return HVE_NOT_SUPPORTED;
+
+	// Nobody needs the state of a VM being removed
+	session->update();
+	int state = session->local->getNum<int>( "state", -1 );
+	if ((state == SS_RUNNING) || (state == SS_PAUSED)) {
+		if (vbox_exec( session, "controlvm", "poweroff", &out ) != 0) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: Unable to power off the VM of " << name;
+			return 3;
+		}
+	}
+
+	// The VM stays locked for a moment after it powers off
+	CLIDeadline deadline( CLICancel::timeoutFor("remove") );
+	while (vbox_exec( session, "unregistervm", "", &out ) != 0) {
+		if (!deadline.sleep(500)) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: Unable to unregister the VM of " << name;
+			return deadline.reason();
+		}
+	}
+
+	// Forget the disks in the VM folder (the shared ones stay registered)
+	SysExecConfig config;
+	string err;
+	for (vector<vm_disk>::iterator it = disks.begin(); it != disks.end(); ++it) {
+		if (hv_exec( hv, "closemedium disk \"" + it->path + "\"", &out, &err, config ) != 0)
+			CLIOutputLine(CLI_STDERR) << "WARNING: Unable to close the disk " << it->path << " of " << name;
+	}
+
+	int res = unregister_session( session, name );
+	if (res != 0) return res;
+
+	// Hand the folder to the reclaimer, that starts when we release the session lock
+	if (reclaim_queue( name, folder ) != 0) {
+		CLIOutputLine(CLI_STDERR) << "WARNING: Unable to queue " << folder << " for deletion";
+		return 0;
+	}
+	reclaimRate = rate;
+	return 0;
+
+}
+
+/**
+ * Start the reclaimer for the sessions removed with --async. This must be
+ * done after the session locks are released, so it can't hold on to them.
+ */
+void start_reclaimer() {
+	int rate = reclaimRate.exchange( 0 );
+	if (rate <= 0)
+		return;
+
+	ostringstream oss;
+	oss << rate;
+	vector<string> workerArgs;
+	workerArgs.push_back( "reclaim" );
+	workerArgs.push_back( "--rate" );
+	workerArgs.push_back( oss.str() );
+	if (spawn_detached( selfPath, workerArgs ) != 0)
+		CLIOutputLine(CLI_STDERR) << "WARNING: Unable to start the reclaimer, run '" << selfPath << " reclaim' to free the disk space";
+}
+
+/**
+ * Handle the REMOVE command
+ */
+int handle_remove( list<string>& args, const string& name, const string& key ) {
+	bool 	bool_async = false;
+	int 	int_rate = CLI_RECLAIM_RATE;
+	string 	arg;
+
+	while (!args.empty()) {
+		arg = args.front(); args.pop_front();
+		if (arg.compare("--async") == 0) {
+			bool_async = true;
+		} else if (arg.compare("--rate") == 0) {
+			if (args.empty()) {
+				show_help("Missing value for the '--rate' argument");
+				return 5;
+			}
+			int_rate = ston<int>( args.front() ); args.pop_front();
+		} else if (arg.compare("--all") == 0) {
+			/* Handled by main */
+		} else {
+			show_help("Unknown parameter '" + arg + "'");
+			return 5;
+		}
+	}
+
+	// Try to open a session
+	ParameterMapPtr params = ParameterMap::instance();
+	params->set("name", name)
+		   .set("secret", key);
+	HVSessionPtr session = hv->sessionOpen( params, session_progress() );
+
+	// Leave the slow part for later
+	if (bool_async) {
+		int res = remove_session_async( session, name, int_rate );
+		if (res != HVE_NOT_SUPPORTED) {
+			session->abort();
+			return res;
+		}
+	}
+
+	// Destroy
+	session->close();
+
+	// Wait for completion
+	int res = wait_session( session, CLIDeadline( CLICancel::timeoutFor("remove") ) );
+
+	// Cleanup thread
+	session->abort();
+	if (res != 0) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: The removal of " << name << (res == CLI_EXIT_TIMEOUT ? " timed out" : " was cancelled");
+		return res;
+	}
+
+	// Delete session
+	return unregister_session( session, name );
+
+}
+
+/**
+ * Handle the LIST command
+ */
+int handle_list( list<string>& args ) {
+
+	// Flush stderror (status) messages
+	CLIOutput::flush();
+
+	// Iterate over open sessions
+	CLIOutputLine(CLI_STDERR) << "Registered sessions with libCernVM:";
+	CLIOutputLine(CLI_STDERR);
+	for (std::map< std::string, HVSessionPtr >::iterator it = hv->sessions.begin(); it != hv->sessions.end(); ++it) {
+		string name = (*it).first;
+		HVSessionPtr sess = (*it).second;
+		if (!labelSelector.empty() && !label_matches( sess->parameters->get("labels", ""), labelSelector ))
+			continue;
+		CLIOutputLine(CLI_STDOUT) << " - " << sess->parameters->get("name", "") << " (" << name << ")";
+		CLIOutputLine(CLI_STDOUT) << "   cpus=" << sess->parameters->get("cpus", "1")
+		     << ", ram=" << sess->parameters->get("ram", "512")
+		     << ", disk=" << sess->parameters->get("disk", "1024")
+		     << ", apiPort=" << sess->parameters->get("apiPort", BOOST_PP_STRINGIZE( DEFAULT_API_PORT ))
+		     << ", flags=" << sess->parameters->get("flags", "9")
+             << ", uCernVM=" << sess->parameters->get("cernvmVersion", DEFAULT_CERNVM_VERSION) << "," << sess->parameters->get("cernvmFlavor", DEFAULT_CERNVM_FLAVOR);
+		if (sess->parameters->contains("labels"))
+			CLIOutputLine(CLI_STDOUT) << "   labels=" << sess->parameters->get("labels");
+		CLIOutputLine(CLI_STDOUT);
+	}
+    if (hv->sessions.empty()) {
+        CLIOutputLine(CLI_STDERR) << " (There are no registered sessions)";
+    }
+
+	// return ok
+	return 0;
+
+}
+
+/**
+ * Handle the IMAGES command
+ */
+int handle_images( list<string>& args ) {
+	string 	str_ver=DEFAULT_CERNVM_VERSION, str_flavor=DEFAULT_CERNVM_FLAVOR, command, arg;
+	int 	int_flags=HVF_SYSTEM_64BIT, int_keep=1;
+
+	if (args.empty()) {
+		show_help("Missing images command!");
+		return 5;
+	}
+	command = args.front(); args.pop_front();
+
+	// Parse arguments
+	while (!args.empty()) {
+		arg = args.front(); args.pop_front();
+		if (arg.compare("--32") == 0) {
+			int_flags &= ~HVF_SYSTEM_64BIT;
+		} else if ((arg.compare("--ver") == 0) || (arg.compare("--flavor") == 0) || (arg.compare("--keep") == 0)) {
+			if (args.empty()) {
+				show_help("Missing value for the '" + arg + "' argument");
+				return 5;
+			}
+			if (arg.compare("--ver") == 0) {
+				str_ver = args.front();
+			} else if (arg.compare("--flavor") == 0) {
+				str_flavor = args.front();
+			} else {
+				int_keep = ston<int>( args.front() );
+			}
+			args.pop_front();
+		} else {
+			show_help("Unknown argument '" + arg + "'");
+			return 5;
+		}
+	}
+
+	CLIImageCache cache( hv );
+	if (command.compare("prefetch") == 0) {
+		if (cache.fetch( str_ver, str_flavor, image_arch(int_flags), progressTask ) != HVE_OK) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: Unable to download uCernVM " << str_ver << " (" << str_flavor << ")";
+			return 3;
+		}
+		CLIOutputLine(CLI_STDERR) << "[ ok ] uCernVM " << str_ver << " (" << str_flavor << ", " << image_arch(int_flags) << ") is in the cache";
+		return 0;
+	}
+
+	// Find the images the sessions are using
+	vector<CLIImageEntry> images;
+	if (cache.list( &images ) != HVE_OK) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: The image cache is busy";
+		return 6;
+	}
+	map<string, int> users;
+	set<string> inUse;
+	for (std::map< std::string, HVSessionPtr >::iterator it = hv->sessions.begin(); it != hv->sessions.end(); ++it) {
+		ParameterMapPtr p = (*it).second->parameters;
+		for (vector<CLIImageEntry>::iterator img = images.begin(); img != images.end(); ++img) {
+			if ((img->version == p->get("cernvmVersion", DEFAULT_CERNVM_VERSION)) &&
+				(img->flavor == p->get("cernvmFlavor", DEFAULT_CERNVM_FLAVOR)) &&
+				(img->arch == image_arch( p->getNum<int>("flags", HVF_SYSTEM_64BIT) ))) {
+				users[img->filename]++;
+				inUse.insert( img->filename );
+			}
+		}
+	}
+
+	if (command.compare("list") == 0) {
+
+		// Flush stderror (status) messages
+		CLIOutput::flush();
+
+		CLIOutputLine(CLI_STDOUT) << left << setw(12) << "VERSION" << setw(10) << "FLAVOR" << setw(8) << "ARCH"
+		     << setw(10) << "SIZE" << setw(10) << "SESSIONS" << "CHECKSUM";
+		for (vector<CLIImageEntry>::iterator img = images.begin(); img != images.end(); ++img) {
+			ifstream f( img->filename.c_str(), ios::binary | ios::ate );
+			ostringstream size;
+			size << ((long) f.tellg() / 1024 / 1024) << "M";
+			CLIOutputLine(CLI_STDOUT) << left << setw(12) << img->version << setw(10) << img->flavor << setw(8) << img->arch
+			     << setw(10) << size.str() << setw(10) << users[img->filename] << img->checksum.substr(0, 12);
+		}
+		if (images.empty()) {
+			CLIOutputLine(CLI_STDERR) << " (There are no images in the cache)";
+		}
+		return 0;
+
+	} else if (command.compare("gc") == 0) {
+		vector<CLIImageEntry> removed;
+		if (cache.gc( int_keep, inUse, &removed ) < 0) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: Unable to clean up the image cache";
+			return 3;
+		}
+		for (vector<CLIImageEntry>::iterator img = removed.begin(); img != removed.end(); ++img) {
+			CLIOutputLine(CLI_STDERR) << "[ ok ] Removed uCernVM " << img->version << " (" << img->flavor << ", " << img->arch << ")";
+		}
+		return 0;
+
+	} else {
+		show_help("Unknown images command '" + command + "'");
+		return 5;
+	}
+
+}
+
+/**
+ * Handle the EXPORTER command
+ */
+int handle_exporter( list<string>& args ) {
+	string 	str_host="127.0.0.1", strval, arg;
+	int 	int_port=9117, int_interval=15;
+
+	while (!args.empty()) {
+		arg = args.front();
+		if (arg.compare("--listen") == 0) {
+			args.pop_front();
+			if (args.empty()) {
+				show_help("Missing value for the '--listen' argument");
+				return 5;
+			}
+			strval = args.front(); args.pop_front();
+			size_t pos = strval.rfind(':');
+			if (pos == string::npos) {
+				show_help("The '--listen' argument should be in <host>:<port> format");
+				return 5;
+			}
+			str_host = strval.substr(0, pos);
+			int_port = ston<int>(strval.substr(pos+1));
+		} else if (arg.compare("--interval") == 0) {
+			args.pop_front();
+			if (args.empty()) {
+				show_help("Missing value for the '--interval' argument");
+				return 5;
+			}
+			strval = args.front(); args.pop_front();
+			int_interval = ston<int>(strval);
+			if (int_interval < 1) int_interval = 1;
+		} else {
+			args.pop_front();
+            show_help("Unknown parameter '" + arg + "'");
+            return 5;
+		}
+	}
+
+	// Start collecting metrics in the background
+	boost::shared_ptr<CLIRegistryWatcher> watcher = boost::make_shared<CLIRegistryWatcher>( hv );
+	watch_sessions( *watcher );
+	CLIMetricsExporter exporter( hv, watcher, int_interval );
+	exporter.start();
+
+	// Serve scrapes
+	CLIOutputLine(CLI_STDERR) << "Serving metrics on http://" << str_host << ":" << int_port << "/metrics";
+	return exporter.serve( str_host, int_port );
+
+}
+
+/**
+ * Handle the COMPLETION command
+ */
+int handle_completion( list<string>& args ) {
+	if (args.empty()) {
+		show_help("Missing shell name for the completion");
+		return 5;
+	}
+	if (!completion_script( args.front(), cout )) {
+		show_help("Unsupported shell '" + args.front() + "', expected bash or zsh");
+		return 5;
+	}
+	return 0;
+}
+
+/**
+ * Print the parameters of many sessions in the given format. When the
+ * rows were collected from remote hosts, 'hosts' has the host of every
+ * row and it's printed before the session.
+ */
+void print_parameters( const string& format, const vector<string>& keys, vector< map<string, string> >& values, const vector<string>& hosts ) {
+	bool withHost = !hosts.empty();
+
+	if (format.compare("plain") == 0) {
+		for (size_t i=0; i<values.size(); i++) {
+			string prefix = (withHost ? hosts[i] + ":" : "") + ((withHost || (values.size() > 1)) ? values[i]["name"] + ":" : "");
+			for (vector<string>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+				map<string, string>::iterator v = values[i].find(*it);
+				CLIOutputLine(CLI_STDOUT) << prefix << *it << "=" << (v == values[i].end() ? "<not defined>" : v->second);
+			}
+		}
+
+	} else if (format.compare("jsonl") == 0) {
+		for (size_t i=0; i<values.size(); i++) {
+			ostringstream oss;
+			oss << "{";
+			if (withHost)
+				oss << "\"host\":\"" << json_escape(hosts[i]) << "\",";
+			oss << "\"session\":\"" << json_escape(values[i]["name"]) << "\"";
+			for (vector<string>::const_iterator it = keys.begin(); it != keys.end(); ++it) {
+				map<string, string>::iterator v = values[i].find(*it);
+				oss << ",\"" << json_escape(*it) << "\":";
+				if (v == values[i].end()) {
+					oss << "null";
+				} else {
+					oss << "\"" << json_escape(v->second) << "\"";
+				}
+			}
+			CLIOutputLine(CLI_STDOUT) << oss.str() << "}";
+		}
+
+	} else if (format.compare("tsv") == 0) {
+		// Machine-readable table, with '\N' for the values not defined
+		ostringstream header;
+		if (withHost)
+			header << "host\t";
+		header << "session";
+		for (size_t j=0; j<keys.size(); j++)
+			header << "\t" << tsv_escape(keys[j]);
+		CLIOutputLine(CLI_STDOUT) << header.str();
+		for (size_t i=0; i<values.size(); i++) {
+			ostringstream row;
+			if (withHost)
+				row << tsv_escape(hosts[i]) << "\t";
+			row << tsv_escape(values[i]["name"]);
+			for (size_t j=0; j<keys.size(); j++) {
+				map<string, string>::iterator v = values[i].find(keys[j]);
+				row << "\t" << (v == values[i].end() ? "\\N" : tsv_escape(v->second));
+			}
+			CLIOutputLine(CLI_STDOUT) << row.str();
+		}
+
+	} else {
+		// Calculate column widths
+		size_t hostWidth = 4;
+		vector<size_t> widths( keys.size() + 1, 7 );
+		for (size_t i=0; i<values.size(); i++) {
+			if (withHost)
+				hostWidth = max( hostWidth, hosts[i].length() );
+			widths[0] = max( widths[0], values[i]["name"].length() );
+			for (size_t j=0; j<keys.size(); j++) {
+				widths[j+1] = max( widths[j+1], keys[j].length() );
+				map<string, string>::iterator v = values[i].find(keys[j]);
+				if (v != values[i].end())
+					widths[j+1] = max( widths[j+1], v->second.length() );
+			}
+		}
+
+		// Header
+		ostringstream header;
+		if (withHost)
+			header << left << setw(hostWidth) << "host" << "  ";
+		header << left << setw(widths[0]) << "session";
+		for (size_t j=0; j<keys.size(); j++)
+			header << "  " << setw(widths[j+1]) << keys[j];
+		CLIOutputLine(CLI_STDOUT) << header.str();
+
+		// Rows
+		for (size_t i=0; i<values.size(); i++) {
+			ostringstream row;
+			if (withHost)
+				row << left << setw(hostWidth) << hosts[i] << "  ";
+			row << left << setw(widths[0]) << values[i]["name"];
+			for (size_t j=0; j<keys.size(); j++) {
+				map<string, string>::iterator v = values[i].find(keys[j]);
+				row << "  " << setw(widths[j+1]) << (v == values[i].end() ? "-" : v->second);
+			}
+			CLIOutputLine(CLI_STDOUT) << row.str();
+		}
+	}
+}
+
+/**
+ * Handle the GET command
+ */
+int handle_get( list<string>& args ) {
+	list<string> 	names, patterns;
+	string 			str_format="", arg;
+	bool 			bool_all=false, bool_keys=false;
+
+	// If there is a '--' separator, everything before it is a session name
+	bool has_separator = (find(args.begin(), args.end(), "--") != args.end());
+
+	while (!args.empty()) {
+		arg = args.front(); args.pop_front();
+		if (arg.compare("--all") == 0) {
+			bool_all = true;
+		} else if (arg.compare("--format") == 0) {
+			if (args.empty()) {
+				show_help("Missing value for the '--format' argument");
+				return 5;
+			}
+			str_format = args.front(); args.pop_front();
+			if ((str_format.compare("plain") != 0) &&
+				(str_format.compare("table") != 0) &&
+				(str_format.compare("jsonl") != 0) &&
+				(str_format.compare("tsv") != 0)) {
+				show_help("Unknown format specified! Should be one of: plain,table,jsonl,tsv");
+				return 5;
+			}
+		} else if (arg.compare("--") == 0) {
+			bool_keys = true;
+		} else if (has_separator && !bool_keys) {
+			names.push_back(arg);
+		} else if (!has_separator && !bool_all && names.empty() && labelSelector.empty()) {
+			names.push_back(arg);
+		} else {
+			patterns.push_back(arg);
+		}
+	}
+
+	// Validate arguments
+	if (!bool_all && names.empty() && labelSelector.empty()) {
+		show_help("Missing session name!");
+		return 5;
+	}
+	if (patterns.empty()) {
+		show_help("Missing parameter name!");
+		return 5;
+	}
+
+	// Resolve sessions
+	vector<HVSessionPtr> sessions;
+	if (bool_all && labelSelector.empty()) {
+		for (std::map< std::string, HVSessionPtr >::iterator it = hv->sessions.begin(); it != hv->sessions.end(); ++it) {
+			sessions.push_back( (*it).second );
+		}
+	} else {
+		map<string, HVSessionPtr> byName;
+		index_sessions( &byName );
+		vector<string> selected( names.begin(), names.end() );
+		if (!labelSelector.empty()) {
+			int res = select_sessions( selected, byName );
+			if (res != 0) return res;
+		}
+		for (vector<string>::iterator it = selected.begin(); it != selected.end(); ++it) {
+			map<string, HVSessionPtr>::iterator sess = byName.find( *it );
+			if (sess == byName.end()) {
+				CLIOutputLine(CLI_STDERR) << "ERROR: The specified session " << *it <<" does not exist!";
+				return 2;
+			}
+			sessions.push_back( sess->second );
+		}
+	}
+
+	// Plain output is the default when querying a single session
+	if (str_format.empty())
+		str_format = (!bool_all && labelSelector.empty() && (sessions.size() == 1)) ? "plain" : "table";
+
+	// Read the parameters of all sessions in one pass
+	vector< map<string, string> > values( sessions.size() );
+	for (size_t i=0; i<sessions.size(); i++) {
+		sessions[i]->parameters->toMap( &values[i], true );
+	}
+
+	// Expand wildcard patterns into the keys they match
+	vector<string> keys;
+	for (list<string>::iterator it = patterns.begin(); it != patterns.end(); ++it) {
+		if (!has_wildcards(*it)) {
+			if (find(keys.begin(), keys.end(), *it) == keys.end())
+				keys.push_back(*it);
+			continue;
+		}
+		set<string> matched;
+		for (size_t i=0; i<values.size(); i++) {
+			for (map<string, string>::iterator jt = values[i].begin(); jt != values[i].end(); ++jt) {
+				if (match_pattern(*it, jt->first))
+					matched.insert(jt->first);
+			}
+		}
+		for (set<string>::iterator jt = matched.begin(); jt != matched.end(); ++jt) {
+			if (find(keys.begin(), keys.end(), *jt) == keys.end())
+				keys.push_back(*jt);
+		}
+	}
+
+	// Flush stderror (status) messages
+	CLIOutput::flush();
+
+	// Render in the requested format
+	print_parameters( str_format, keys, values, vector<string>() );
+
+    return 0;
+}
+
+
+/**
+ * Change the parameters of a single session
+ */
+int set_session_parameters( const string& name, const map<string, string>& changes ) {
+	HVSessionPtr session = find_session( name );
+
+	// Make sure no other cernvm-cli process is working on this session
+	CLISessionLock lock( name, true );
+	if (!lock.acquire()) {
+		if (CLICancel::requested()) return CLI_EXIT_CANCELLED;
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": The session is busy (used by another cernvm-cli process)";
+		return 6;
+	}
+
+	// Synchronize state
+	session->update();
+	int state = session->local->getNum<int>( "state", -1 );
+
+	// Start with the changes still pending from before
+	set<string> pending;
+	vector<string> keys;
+	explode( session->parameters->get("pendingChanges", ""), ',', &keys );
+	for (vector<string>::iterator it = keys.begin(); it != keys.end(); ++it) {
+		if (!it->empty()) pending.insert(*it);
+	}
+
+	// Apply what we can right now and keep the values that made it.
+	// A value the hypervisor refused is not stored, so the configuration
+	// never claims something the VM does not have.
+	ostringstream oss;
+	int ret = 0;
+	for (map<string, string>::const_iterator it = changes.begin(); it != changes.end(); ++it) {
+		const settable_parameter * p = find_settable_parameter( it->first );
+
+		if (p->hot || (state == SS_POWEROFF)) {
+			int res = apply_parameter( session, p, it->second );
+			if (res < 0) {
+				CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": Unable to apply " << it->first << " (error " << res << ")";
+				ret = 3;
+				break;
+			}
+			pending.erase( it->first );
+		} else if ((state == SS_RUNNING) || (state == SS_PAUSED) || (state == SS_SAVED)) {
+			oss << " " << it->first << "=" << it->second << " (on next start)";
+			session->parameters->set( it->first, it->second );
+			pending.insert( it->first );
+			continue;
+		}
+		oss << " " << it->first << "=" << it->second;
+		session->parameters->set( it->first, it->second );
+	}
+
+	// Store the changes we could not apply yet
+	if (pending.empty()) {
+		session->parameters->erase("pendingChanges");
+	} else {
+		string str_pending;
+		for (set<string>::iterator it = pending.begin(); it != pending.end(); ++it) {
+			if (!str_pending.empty()) str_pending += ",";
+			str_pending += *it;
+		}
+		session->parameters->set("pendingChanges", str_pending);
+	}
+	if (ret != 0)
+		return ret;
+	CLIOutputLine(CLI_STDERR) << "[ ok ] " << name << ":" << oss.str();
+	return 0;
+}
+
+/**
+ * Handle the SET command
+ */
+int handle_set( list<string>& args ) {
+	vector<string> 		names;
+	map<string, string> changes;
+	string 				arg, param, value;
+	bool 				bool_all=false;
+
+	while (!args.empty()) {
+		arg = args.front(); args.pop_front();
+		size_t pos = arg.find('=');
+		if (arg.compare("--all") == 0) {
+			bool_all = true;
+		} else if (pos != string::npos) {
+			param = arg.substr(0, pos);
+			value = arg.substr(pos+1);
+			const settable_parameter * p = find_settable_parameter( param );
+			if (p == NULL) {
+				show_help("The parameter '" + param + "' cannot be changed");
+				return 5;
+			}
+			if (!settable_value_valid( p, value )) {
+				ostringstream oss;
+				oss << "The value of '" << param << "' should be a number between " << p->minValue << " and " << p->maxValue;
+				show_help(oss.str());
+				return 5;
+			}
+			changes[param] = value;
+		} else if (arg[0] == '-') {
+            show_help("Unknown parameter '" + arg + "'");
+            return 5;
+		} else {
+			names.push_back(arg);
+		}
+	}
+
+	// Validate arguments
+	if (!bool_all && names.empty() && labelSelector.empty()) {
+		show_help("Missing session name!");
+		return 5;
+	}
+	if (changes.empty()) {
+		show_help("Missing <param>=<value> pairs to set!");
+		return 5;
+	}
+
+	// Resolve sessions
+	int res = resolve_sessions( names, bool_all );
+	if (res != 0) return res;
+
+	// Apply changes on all sessions in parallel
+	return run_parallel( names, boost::bind(&set_session_parameters, _1, boost::cref(changes)), maxParallel );
+
+}
+
+/**
+ * Resume a session that AUTOSAVE has saved, because something needs it.
+ *
+ * This starts the VM, so it takes the session lock exclusively and must
+ * be called before the caller takes it's own (shared) lock.
+ */
+int resume_autosaved( const string& name ) {
+	HVSessionPtr info = find_session( name );
+	if (info->parameters->get( "autosaved", "" ).compare("1") != 0)
+		return 0;
+
+	// Make sure no other cernvm-cli process is working on this session
+	CLISessionLock lock( name, true );
+	if (!lock.acquire()) {
+		if (CLICancel::requested()) return CLI_EXIT_CANCELLED;
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": The session is busy (used by another cernvm-cli process)";
+		return 6;
+	}
+
+	// Somebody else might have resumed it while we were waiting
+	info->update();
+	if (info->local->getNum<int>( "state", -1 ) != SS_SAVED)
+		return 0;
+
+	// Start it again
+	CLIOutputLine(CLI_STDERR) << "[wait] " << name << ": Resuming the session that was saved while idle";
+	ParameterMapPtr params = ParameterMap::instance();
+	params->set("name", name)
+		   .set("secret", name);
+	HVSessionPtr session = hv->sessionOpen( params, boost::make_shared<FiniteTask>() );
+	ParameterMapPtr userData = ParameterMap::instance();
+	int res = session_transition( session, name, "resume", boost::bind(&HVSession::start, session, userData), START_FROM, SS_RUNNING, CLIDeadline( CLICancel::timeoutFor("resume") ) );
+	session->abort();
+	if (res != 0)
+		return res;
+
+	// It's now running
+	session->parameters->erase( "autosaved" );
+	info->update();
+	return 0;
+}
+
+/**
+ * Find the user to log-in the VM with, from the context it was set up with
+ */
+string get_session_user( const HVSessionPtr& session ) {
+
+	// Use the user we have looked-up before
+	string user = session->parameters->get("sshUser", "");
+	if (!user.empty())
+		return user;
+
+	// Lookup the context ID in the user data
+	string context_id;
+	vector<string> lines;
+	explode( session->parameters->get("userData", ""), '\n', &lines );
+	for (vector<string>::iterator it = lines.begin(); it != lines.end(); ++it) {
+		if (it->substr(0,22).compare("contextualization_key=") == 0)
+			context_id = it->substr(22);
+	}
+
+	// Get user ID from context
+	if (!context_id.empty())
+		user = get_user_from_context( context_id, DownloadProvider::Default() );
+
+	// Fallback to root
+	if (user.empty())
+		user = "root";
+
+	// Keep it for the next time
+	session->parameters->set("sshUser", user);
+	return user;
+
+}
+
+/**
+ * Print a line of command output, prefixed with the session name
+ */
+void print_session_line( const string& name, const string& line ) {
+	CLIOutputLine(CLI_STDOUT) << name << ": " << line;
+}
+
+/**
+ * Run a command in a single session
+ */
+int exec_session( const string& name, const string& command, int persist, bool prefix ) {
+	HVSessionPtr session = find_session( name );
+
+	// Bring back the session if it was saved while idle
+	int res = resume_autosaved( name );
+	if (res != 0) return res;
+
+	// Make sure no other cernvm-cli process is working on this session
+	CLISessionLock lock( name, false );
+	if (!lock.acquire()) {
+		if (CLICancel::requested()) return CLI_EXIT_CANCELLED;
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": The session is busy (used by another cernvm-cli process)";
+		return 6;
+	}
+
+	// The VM must be running
+	if (session->local->getNum<int>( "state", -1 ) != SS_RUNNING) {
+		session->update();
+		if (session->local->getNum<int>( "state", -1 ) != SS_RUNNING) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: The session " << name << " is not running!";
+			return 4;
+		}
+	}
+
+	// Lookup where to connect
+	string host = session->getAPIHost();
+	int port = session->getAPIPort();
+	string user = get_session_user( session );
+
+	// Run the command over the master connection of this session
+	lineCallback onLine;
+	if (prefix)
+		onLine = boost::bind(&print_session_line, name, _1);
+	res = ssh_exec( host, port, user, get_cli_data_path("ssh-" + encode_filename(name)), persist, command, onLine );
+	if (res < 0) return 3;
+	return res;
+
+}
+
+/**
+ * Handle the EXEC command
+ */
+int handle_exec( list<string>& args ) {
+	vector<string> 	names;
+	string 			command, strval, arg;
+	int 			int_persist=600;
+	bool 			bool_all=false;
+
+	while (!args.empty()) {
+		arg = args.front(); args.pop_front();
+		if (arg.compare("--") == 0) {
+			// The rest is the command
+			while (!args.empty()) {
+				if (!command.empty()) command += " ";
+				command += shell_quote( args.front() );
+				args.pop_front();
+			}
+		} else if (arg.compare("--all") == 0) {
+			bool_all = true;
+		} else if (arg.compare("--persist") == 0) {
+			if (args.empty()) {
+				show_help("Missing value for the '--persist' argument");
+				return 5;
+			}
+			strval = args.front(); args.pop_front();
+			int_persist = ston<int>(strval);
+		} else if (arg[0] == '-') {
+            show_help("Unknown parameter '" + arg + "'");
+            return 5;
+		} else {
+			names.push_back(arg);
+		}
+	}
+
+	// Validate arguments
+	if (!bool_all && names.empty() && labelSelector.empty()) {
+		show_help("Missing session name!");
+		return 5;
+	}
+	if (command.empty()) {
+		show_help("Missing command to execute (after '--')!");
+		return 5;
+	}
+	int res = resolve_sessions( names, bool_all );
+	if (res != 0) return res;
+
+	// Flush stderror (status) messages
+	CLIOutput::flush();
+
+	// A single session gets the terminal
+	if (names.size() == 1)
+		return exec_session( names[0], command, int_persist, false );
+
+	// Otherwise run everywhere in parallel, prefixing the output lines
+	return run_parallel( names, boost::bind(&exec_session, _1, boost::cref(command), int_persist, true), maxParallel );
+
+}
+
+/**
+ * Locate the FloppyIO image attached to the VM of the session
+ */
+string find_floppy_image( const HVSessionPtr& session ) {
+	vector<string> lines;
+	if (vbox_exec( session, "showvminfo", "--machinereadable", &lines ) < 0)
+		return "";
+
+	// Look for '"Floppy...-0-0"="<filename>"'
+	for (vector<string>::iterator it = lines.begin(); it != lines.end(); ++it) {
+		size_t pos = it->find("\"=\"");
+		if ((pos == string::npos) || (it->find("Floppy") != 1)) continue;
+		string file = it->substr(pos+3, it->length()-pos-4);
+		if ((file.compare("none") != 0) && (file.compare("emptydrive") != 0))
+			return file;
+	}
+	return "";
+}
+
+/**
+ * Split a path into it's parent directory and it's last component
+ */
+void split_path( const string& path, string * dir, string * base ) {
+	string p = path;
+	while ((p.length() > 1) && (p[p.length()-1] == '/'))
+		p = p.substr(0, p.length()-1);
+	size_t pos = p.rfind('/');
+	if (pos == string::npos) {
+		*dir = ".";
+		*base = p;
+	} else {
+		*dir = (pos == 0) ? "/" : p.substr(0, pos);
+		*base = p.substr(pos+1);
+	}
+}
+
+/**
+ * Copy files between the host and a single session
+ */
+int transfer_session( const string& name, bool push, const string& src, const string& dst, bool compress, bool prefixDst ) {
+	HVSessionPtr session = find_session( name );
+
+	// Bring back the session if it was saved while idle
+	int res = resume_autosaved( name );
+	if (res != 0) return res;
+
+	// Make sure no other cernvm-cli process is working on this session
+	CLISessionLock lock( name, false );
+	if (!lock.acquire()) {
+		if (CLICancel::requested()) return CLI_EXIT_CANCELLED;
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": The session is busy (used by another cernvm-cli process)";
+		return 6;
+	}
+	string tarFlags = compress ? "z" : "";
+	string srcDir, srcBase, localDst = dst;
+
+	// When pulling from many sessions, each one goes in it's own directory
+	if (prefixDst)
+		localDst = dst + "/" + name;
+	split_path( src, &srcDir, &srcBase );
+
+	// Check if we can reach the VM over the network
+	session->update();
+	bool network = (session->local->getNum<int>( "state", -1 ) == SS_RUNNING) && (session->getAPIPort() > 0);
+
+	if (network) {
+
+		// Stream a tarball through the multiplexed SSH connection
+		string ssh = ssh_command( session->getAPIHost(), session->getAPIPort(), get_session_user(session), get_cli_data_path("ssh-" + encode_filename(name)), 600 );
+		if (push) {
+			string remote = "mkdir -p " + shell_quote(dst) + " && tar -C " + shell_quote(dst) + " -x" + tarFlags + "f -";
+			res = shell_exec( "tar -C " + shell_quote(srcDir) + " -c" + tarFlags + "f - " + shell_quote(srcBase) + " | " + ssh + " -- " + shell_quote(remote) );
+		} else {
+			string remote = "tar -C " + shell_quote(srcDir) + " -c" + tarFlags + "f - " + shell_quote(srcBase);
+			res = shell_exec( "mkdir -p " + shell_quote(localDst) + " && " + ssh + " -- " + shell_quote(remote) + " | tar -C " + shell_quote(localDst) + " -x" + tarFlags + "f -" );
+		}
+
+	} else if ((session->parameters->getNum<int>( "flags", 0 ) & HVF_FLOPPY_IO) != 0) {
+
+		// Fall back to the FloppyIO channel
+		string image = find_floppy_image( session );
+		if (image.empty()) {
+			CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": Unable to locate the FloppyIO image";
+			return 3;
+		}
+		CLIFloppyIO fio( image );
+
+		// The data go through FloppyIO as a base64-encoded tarball
+		string data;
+		if (push) {
+			res = shell_capture( "tar -C " + shell_quote(srcDir) + " -czf - " + shell_quote(srcBase), &data );
+			if (res == 0) {
+				data = base64_encode( (const unsigned char *) data.c_str(), data.length() );
+				if (data.length() > fio.capacity()) {
+					CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": The data do not fit in the FloppyIO channel (" << fio.capacity() << " bytes)";
+					return 4;
+				}
+				res = (fio.send( data ) == HVE_OK) ? 0 : 3;
+			}
+		} else {
+			// We get whatever the guest has placed on the floppy
+			res = fio.receive( &data );
+			if (res == HVE_NOT_FOUND) {
+				CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": The guest has not sent any data over FloppyIO";
+				return 4;
+			}
+			if (res == HVE_OK) {
+				res = shell_feed( "mkdir -p " + shell_quote(localDst) + " && tar -C " + shell_quote(localDst) + " -xzf -", base64_decode(data) );
+			}
+		}
+
+	} else {
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": The VM is not running and has no FloppyIO channel";
+		return 4;
+	}
+	if (res != 0) {
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": Transfer failed";
+		return 3;
+	}
+	CLIOutputLine(CLI_STDERR) << "[ ok ] " << name << ": " << (push ? "Pushed " : "Pulled ") << src << (network ? "" : " (over FloppyIO)");
+	return 0;
+}
+
+/**
+ * Handle the PUSH and PULL commands
+ */
+int handle_transfer( list<string>& args, bool push ) {
+	vector<string> 	names;
+	string 			arg;
+	bool 			bool_all=false, bool_compress=false;
+
+	while (!args.empty()) {
+		arg = args.front(); args.pop_front();
+		if (arg.compare("--all") == 0) {
+			bool_all = true;
+		} else if ((arg.compare("-z") == 0) || (arg.compare("--compress") == 0)) {
+			bool_compress = true;
+		} else if (arg[0] == '-') {
+            show_help("Unknown parameter '" + arg + "'");
+            return 5;
+		} else {
+			names.push_back(arg);
+		}
+	}
+
+	// The last two arguments are the source and destination
+	if (names.size() < 2) {
+		show_help("Missing source and destination!");
+		return 5;
+	}
+	string dst = names.back(); names.pop_back();
+	string src = names.back(); names.pop_back();
+	if (!bool_all && names.empty() && labelSelector.empty()) {
+		show_help("Missing session name!");
+		return 5;
+	}
+	int res = resolve_sessions( names, bool_all );
+	if (res != 0) return res;
+
+	// Transfer to/from all sessions in parallel
+	bool prefixDst = !push && (names.size() > 1);
+	return run_parallel( names, boost::bind(&transfer_session, _1, push, boost::cref(src), boost::cref(dst), bool_compress, prefixDst), maxParallel );
+
+}
+
+/**
+ * Take a sample of a session, used by the STATS command
+ */
+int sample_session( const string& name, map< string, boost::shared_ptr<CLIStatsSampler> > * samplers ) {
+	// The samplers are created before the workers start, so only look them up
+	samplers->find( name )->second->sample();
+	return 0;
+}
+
+/**
+ * Format a rate in KB/s
+ */
+string format_rate( double bytesPerSec ) {
+	ostringstream oss;
+	oss << fixed << setprecision(1) << (bytesPerSec / 1024.0);
+	return oss.str();
+}
+
+/**
+ * Handle the STATS command
+ */
+int handle_stats( list<string>& args ) {
+	vector<string> 	names;
+	string 			str_format="table", strval, arg;
+	int 			int_interval=1000, int_count=0, int_window=60;
+	bool 			bool_all=false;
+
+	while (!args.empty()) {
+		arg = args.front(); args.pop_front();
+		if (arg.compare("--all") == 0) {
+			bool_all = true;
+		} else if ((arg.compare("--interval") == 0) || (arg.compare("--count") == 0) || (arg.compare("--window") == 0)) {
+			if (args.empty()) {
+				show_help("Missing value for the '" + arg + "' argument");
+				return 5;
+			}
+			strval = args.front(); args.pop_front();
+			if (arg.compare("--interval") == 0) {
+				int_interval = ston<int>(strval);
+			} else if (arg.compare("--count") == 0) {
+				int_count = ston<int>(strval);
+			} else {
+				int_window = ston<int>(strval);
+			}
+		} else if (arg.compare("--format") == 0) {
+			if (args.empty()) {
+				show_help("Missing value for the '--format' argument");
+				return 5;
+			}
+			str_format = args.front(); args.pop_front();
+			if ((str_format.compare("table") != 0) && (str_format.compare("jsonl") != 0)) {
+				show_help("Unknown format specified! Should be one of: table,jsonl");
+				return 5;
+			}
+		} else if (arg[0] == '-') {
+            show_help("Unknown parameter '" + arg + "'");
+            return 5;
+		} else {
+			names.push_back(arg);
+		}
+	}
+
+	// Validate arguments
+	if (!bool_all && names.empty() && labelSelector.empty()) {
+		show_help("Missing session name!");
+		return 5;
+	}
+	if (int_interval < 100) int_interval = 100;
+	int res = resolve_sessions( names, bool_all );
+	if (res != 0) return res;
+
+	// Prepare a sampler for every session
+	map< string, boost::shared_ptr<CLIStatsSampler> > samplers;
+	for (vector<string>::iterator it = names.begin(); it != names.end(); ++it) {
+		samplers[*it] = boost::make_shared<CLIStatsSampler>( hv, find_session(*it), int_window );
+	}
+
+	// Flush stderror (status) messages
+	CLIOutput::flush();
+	if (str_format.compare("table") == 0) {
+		ostringstream oss;
+		oss << left << setw(20) << "SESSION" << right << setw(8) << "CPU%" << setw(10) << "RAM(MB)"
+		    << setw(12) << "DISK-R KB/s" << setw(12) << "DISK-W KB/s" << setw(12) << "NET-RX KB/s" << setw(12) << "NET-TX KB/s"
+		    << setw(9) << "CPU-p50" << setw(9) << "CPU-p95";
+		CLIOutputLine(CLI_STDOUT) << oss.str();
+	}
+
+	// Sample all sessions at the same time, in every interval
+	CLIDeadline deadline( 0 );
+	for (int round=0; (int_count == 0) || (round <= int_count); round++) {
+		boost::posix_time::ptime started = boost::posix_time::microsec_clock::universal_time();
+		run_parallel( names, boost::bind(&sample_session, _1, &samplers), names.size() );
+
+		// We need two samples for the rates
+		if (round > 0) {
+			for (vector<string>::iterator it = names.begin(); it != names.end(); ++it) {
+				vector<CLIStatsRates> rates;
+				vector<double> cpu;
+				{
+					boost::mutex::scoped_lock lock( samplers[*it]->mutex );
+					samplers[*it]->ring.rates( &rates );
+				}
+				if (rates.empty()) {
+					if (str_format.compare("table") == 0)
+						CLIOutputLine(CLI_STDOUT) << left << setw(20) << *it << right << setw(8) << "-";
+					continue;
+				}
+				for (vector<CLIStatsRates>::iterator r = rates.begin(); r != rates.end(); ++r)
+					cpu.push_back( r->cpu );
+				const CLIStatsRates& r = rates.back();
+
+				ostringstream oss;
+				if (str_format.compare("jsonl") == 0) {
+					oss << "{\"session\":\"" << json_escape(*it) << "\",\"cpu\":" << r.cpu << ",\"ram_mb\":" << r.ram
+					    << ",\"disk_read_bps\":" << r.diskRead << ",\"disk_write_bps\":" << r.diskWrite
+					    << ",\"net_rx_bps\":" << r.netRx << ",\"net_tx_bps\":" << r.netTx
+					    << ",\"cpu_p50\":" << stats_percentile(cpu, 50) << ",\"cpu_p95\":" << stats_percentile(cpu, 95) << "}";
+				} else {
+					oss << left << setw(20) << *it << right << fixed << setprecision(1) << setw(8) << r.cpu << setw(10) << r.ram
+					    << setw(12) << format_rate(r.diskRead) << setw(12) << format_rate(r.diskWrite)
+					    << setw(12) << format_rate(r.netRx) << setw(12) << format_rate(r.netTx)
+					    << setw(9) << stats_percentile(cpu, 50) << setw(9) << stats_percentile(cpu, 95);
+				}
+				CLIOutputLine(CLI_STDOUT) << oss.str();
+			}
+		}
+
+		// Wait for the next interval (or until the user presses Ctrl-C)
+		if ((int_count != 0) && (round == int_count)) break;
+		int elapsed = (int)(boost::posix_time::microsec_clock::universal_time() - started).total_milliseconds();
+		if (!deadline.sleep( (elapsed < int_interval) ? (int_interval - elapsed) : 0 )) break;
+	}
+
+	// Summarize the window of every session
+	if (str_format.compare("table") == 0) {
+		CLIOutputLine(CLI_STDOUT) << "";
+		CLIOutputLine(CLI_STDOUT) << left << setw(20) << "SESSION" << setw(12) << "METRIC" << right
+		                          << setw(10) << "p50" << setw(10) << "p95" << setw(10) << "p99";
+	}
+	for (vector<string>::iterator it = names.begin(); it != names.end(); ++it) {
+		vector<CLIStatsRates> rates;
+		{
+			boost::mutex::scoped_lock lock( samplers[*it]->mutex );
+			samplers[*it]->ring.rates( &rates );
+		}
+
+		// Collect the values of every metric
+		const char * metrics[] = { "cpu", "ram_mb", "disk_read_kbps", "disk_write_kbps", "net_rx_kbps", "net_tx_kbps" };
+		vector<double> values[6];
+		for (vector<CLIStatsRates>::iterator r = rates.begin(); r != rates.end(); ++r) {
+			values[0].push_back( r->cpu );
+			values[1].push_back( r->ram );
+			values[2].push_back( r->diskRead / 1024.0 );
+			values[3].push_back( r->diskWrite / 1024.0 );
+			values[4].push_back( r->netRx / 1024.0 );
+			values[5].push_back( r->netTx / 1024.0 );
+		}
+
+		ostringstream oss;
+		if (str_format.compare("jsonl") == 0) {
+			oss << "{\"session\":\"" << json_escape(*it) << "\",\"summary\":true,\"samples\":" << rates.size();
+			for (int i=0; i<6; i++) {
+				oss << ",\"" << metrics[i] << "_p50\":" << stats_percentile(values[i], 50)
+				    << ",\"" << metrics[i] << "_p95\":" << stats_percentile(values[i], 95)
+				    << ",\"" << metrics[i] << "_p99\":" << stats_percentile(values[i], 99);
+			}
+			oss << "}";
+			CLIOutputLine(CLI_STDOUT) << oss.str();
+		} else {
+			for (int i=0; i<6; i++) {
+				ostringstream line;
+				line << left << setw(20) << *it << setw(12) << metrics[i] << right << fixed << setprecision(1)
+				     << setw(10) << stats_percentile(values[i], 50) << setw(10) << stats_percentile(values[i], 95)
+				     << setw(10) << stats_percentile(values[i], 99);
+				CLIOutputLine(CLI_STDOUT) << line.str();
+			}
+		}
+	}
+
+	return 0;
+
+}
+
+/**
+ * Add the hypervisor log and the serial console output of a session to the follower
+ */
+int add_session_logs( CLILogFollower * follower, const string& name, bool prefix ) {
+	string folder;
+	map<string, string> values;
+	if (read_vm_info( find_session(name), &folder, &values ) != 0) {
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": Unable to find the VM of the session";
+		return 3;
+	}
+
+	// VirtualBox creates the log folder on the first start, but
+	// we need it now to follow the log of that start
+	string logs = folder + "/Logs";
+#ifdef _WIN32
+	_mkdir( logs.c_str() );
+#else
+	mkdir( logs.c_str(), 0700 );
+#endif
+	follower->add( prefix ? name + ": " : "", logs + "/VBox.log" );
+
+	// The serial ports that write to a file, like uartmode1="file,/path/to/console.log"
+	for (int i=1; i<=4; i++) {
+		ostringstream key;
+		key << "uartmode" << i;
+		string mode = values[ key.str() ];
+		if (mode.compare(0, 5, "file,") == 0)
+			follower->add( (prefix ? name + " " : "") + "console: ", mode.substr(5) );
+	}
+	return 0;
+}
+
+/**
+ * Handle the LOGS command
+ */
+int handle_logs( list<string>& args ) {
+	vector<string> 	names;
+	string 			strval, arg;
+	int 			int_lines=-1;
+	bool 			bool_all=false, bool_follow=false;
+
+	while (!args.empty()) {
+		arg = args.front(); args.pop_front();
+		if (arg.compare("--all") == 0) {
+			bool_all = true;
+		} else if ((arg.compare("-f") == 0) || (arg.compare("--follow") == 0)) {
+			bool_follow = true;
+		} else if ((arg.compare("-n") == 0) || (arg.compare("--lines") == 0)) {
+			if (args.empty()) {
+				show_help("Missing value for the '" + arg + "' argument");
+				return 5;
+			}
+			strval = args.front(); args.pop_front();
+			int_lines = ston<int>(strval);
+		} else if (arg[0] == '-') {
+            show_help("Unknown parameter '" + arg + "'");
+            return 5;
+		} else {
+			names.push_back(arg);
+		}
+	}
+
+	// Resolve sessions
+	if (!bool_all && names.empty() && labelSelector.empty()) {
+		show_help("Missing session name!");
+		return 5;
+	}
+	int res = resolve_sessions( names, bool_all );
+	if (res != 0) return res;
+
+	// Find the logs of every session
+	CLILogFollower follower;
+	for (vector<string>::iterator it = names.begin(); it != names.end(); ++it) {
+		res = add_session_logs( &follower, *it, names.size() > 1 );
+		if (res != 0) return res;
+	}
+
+	// Print what we have so far
+	CLIOutput::flush();
+	follower.dump( int_lines );
+	if (!bool_follow) {
+		follower.finish();
+		return 0;
+	}
+
+	// Then everything new, until the user presses Ctrl-C
+	return follower.follow();
+
+}
+
+/**
+ * What AUTOSAVE knows about a session
+ */
+struct autosave_state {
+	boost::shared_ptr<CLIStatsSampler> 	sampler;
+	boost::posix_time::ptime 			idleSince;
+};
+
+/**
+ * Sample a session and save it if it has been idle for long enough
+ */
+int autosave_session( const string& name, map< string, autosave_state > * states, double idleCpu, int idleFor ) {
+	// The states are created before the workers start, so only look them up
+	autosave_state& state = states->find( name )->second;
+
+	// If we can't sample the VM, it's not running
+	if (!state.sampler->sample()) {
+		state.sampler = boost::make_shared<CLIStatsSampler>( hv, find_session(name), 2 );
+		state.idleSince = boost::posix_time::not_a_date_time;
+		return 0;
+	}
+	vector<CLIStatsRates> rates;
+	{
+		boost::mutex::scoped_lock lock( state.sampler->mutex );
+		state.sampler->ring.rates( &rates );
+	}
+	if (rates.empty())
+		return 0;
+
+	// Check for how long the VM is idle
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	if (rates.back().cpu >= idleCpu) {
+		state.idleSince = boost::posix_time::not_a_date_time;
+		return 0;
+	}
+	if (state.idleSince.is_not_a_date_time()) {
+		state.idleSince = now;
+		return 0;
+	}
+	if ((now - state.idleSince).total_seconds() < idleFor)
+		return 0;
+
+	// Don't touch sessions another process is working on
+	CLISessionLock lock( name, true );
+	if (!lock.acquire(0))
+		return 0;
+
+	// Save it
+	ParameterMapPtr params = ParameterMap::instance();
+	params->set("name", name)
+		   .set("secret", name);
+	HVSessionPtr session = hv->sessionOpen( params, boost::make_shared<FiniteTask>() );
+	int res = session_transition( session, name, "save", boost::bind(&HVSession::hibernate, session), SAVE_FROM, SS_SAVED, CLIDeadline( CLICancel::timeoutFor("autosave") ) );
+	session->abort();
+	if (res == 0) {
+		session->parameters->set( "autosaved", "1" );
+		CLIOutputLine(CLI_STDERR) << "[ ok ] " << name << ": Saved after being idle for " << (now - state.idleSince).total_seconds() << " seconds";
+	} else if ((res == CLI_EXIT_TIMEOUT) || (res == CLI_EXIT_CANCELLED)) {
+		CLIOutputLine(CLI_STDERR) << "[!!!!] " << name << ": " << (res == CLI_EXIT_TIMEOUT ? "Timed out" : "Cancelled") << " while saving the idle session";
+	}
+
+	// Start over
+	state.sampler = boost::make_shared<CLIStatsSampler>( hv, find_session(name), 2 );
+	state.idleSince = boost::posix_time::not_a_date_time;
+	return 0;
+}
+
+/**
+ * Handle the AUTOSAVE command
+ */
+int handle_autosave( list<string>& args ) {
+	vector<string> 	names;
+	string 			strval, arg;
+	double 			idleCpu=5.0;
+	int 			int_idle=600, int_interval=10000;
+	bool 			bool_all=false;
+
+	while (!args.empty()) {
+		arg = args.front(); args.pop_front();
+		if (arg.compare("--all") == 0) {
+			bool_all = true;
+		} else if ((arg.compare("--idle-cpu") == 0) || (arg.compare("--idle-for") == 0) || (arg.compare("--interval") == 0)) {
+			if (args.empty()) {
+				show_help("Missing value for the '" + arg + "' argument");
+				return 5;
+			}
+			strval = args.front(); args.pop_front();
+			if (arg.compare("--idle-cpu") == 0) {
+				idleCpu = ston<double>(strval);
+			} else if (arg.compare("--interval") == 0) {
+				int_interval = ston<int>(strval);
+			} else {
+				int_idle = parse_duration(strval);
+				if (int_idle < 0) {
+					show_help("The '--idle-for' argument should be a duration, like 90s, 15m or 2h");
+					return 5;
+				}
+			}
+		} else if (arg[0] == '-') {
+            show_help("Unknown parameter '" + arg + "'");
+            return 5;
+		} else {
+			names.push_back(arg);
+		}
+	}
+
+	// Watch all sessions by default
+	if (names.empty() && labelSelector.empty())
+		bool_all = true;
+	int res = resolve_sessions( names, bool_all );
+	if (res != 0) return res;
+	if (int_interval < 1000) int_interval = 1000;
+
+	// Prepare the state of every session
+	map< string, autosave_state > states;
+	for (vector<string>::iterator it = names.begin(); it != names.end(); ++it) {
+		states[*it].sampler = boost::make_shared<CLIStatsSampler>( hv, find_session(*it), 2 );
+	}
+	CLIOutputLine(CLI_STDERR) << "[ ok ] Watching " << names.size() << " session(s), saving the ones below "
+	                          << idleCpu << "% CPU for " << int_idle << " seconds";
+
+	// Forget the sessions other processes remove while we are running
+	CLIRegistryWatcher watcher( hv );
+	watch_sessions( watcher );
+
+	// Check all the sessions in every interval, until the user presses Ctrl-C
+	set<string> changed, removed;
+	do {
+		for (set<string>::iterator it = removed.begin(); it != removed.end(); ++it) {
+			if (states.erase(*it) == 0) continue;
+			names.erase( std::remove(names.begin(), names.end(), *it), names.end() );
+			CLIOutputLine(CLI_STDERR) << "[info] " << *it << ": The session was removed, not watching it any more";
+		}
+		changed.clear();
+		removed.clear();
+		run_parallel( names, boost::bind(&autosave_session, _1, &states, idleCpu, int_idle), maxParallel );
+	} while (watcher.wait( int_interval, &changed, &removed ));
+
+	return 0;
+
+}
+
+/**
+ * Callback for handling the state change
+ */
+boost::mutex 				stateWaitMutex;
+boost::condition_variable 	stateWaitCond;
+bool 						stateWaitFlag;
+int 						stateWaitTarget;
+
+int handle_waitstate( list<string>& args, const string& name, const string& key ) {
+
 	// Try to open a session
 	ParameterMapPtr params = ParameterMap::instance();
 	params->set("name", name)
 		   .set("secret", key);
+	HVSessionPtr session = hv->sessionOpen( params, session_progress() );
+
+	// Flush stderror (status) messages
+	CLIOutput::flush();
+
+	// Calculate the state target
+	stateWaitTarget = -1;
+	if (!args.empty()) {
+		string state = args.front();
+		if (state == "available") {
+			stateWaitTarget = SS_AVAILABLE;
+		} else if (state == "poweroff") {
+			stateWaitTarget = SS_POWEROFF;
+		} else if (state == "saved") {
+			stateWaitTarget = SS_SAVED;
+		} else if (state == "paused") {
+			stateWaitTarget = SS_PAUSED;
+		} else if (state == "running") {
+			stateWaitTarget = SS_RUNNING;
+		} else if (state == "missing") {
+			stateWaitTarget = SS_MISSING;
+		} else {
+            show_help("Unknown state specified! It must be one of: available, poweroff, saved, paused, running, missing");
+            return 5;
+		}
+	}
+
+	// Synchronize state
+	session->update();
+
+	// Check if we are already on the specified state
+	int lastState = session->local->getNum<int>( "state", -1 );
+	if (lastState == stateWaitTarget) {
+		return lastState;
+	}
+
+	// Wait for state change
+	CLIDeadline deadline( CLICancel::timeoutFor("waitstate") );
+	while (true) {
+		int state = session->local->getNum<int>( "state", -1 );
+		if (state != lastState) {
+			lastState = state;
+			if ((stateWaitTarget == -1) || (stateWaitTarget == state)) {
+				break;
+			}
+		}
+		if (!deadline.sleep(500)) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: " << (deadline.reason() == CLI_EXIT_TIMEOUT ? "Timed out" : "Cancelled") << " while waiting for the state of " << name;
+			return deadline.reason();
+		}
+		session->update();
+	}
+
+	// Return
+	return lastState;
+
+}
+
+/**
+ * Download and install the hypervisor through the download cache.
+ * In prefetch mode the installer is only placed in the cache.
+ */
+int install_hypervisor( DomainKeystore& keystore, bool prefetch ) {
+	boost::shared_ptr<CLIDownloadProvider> downloadProvider = boost::make_shared<CLIDownloadProvider>( DownloadProvider::Default(), maxParallel );
+	FiniteTaskPtr pf = progressTask;
+	if (prefetch) {
+		// The installer stops when the download does, so keep it's feedback quiet
+		downloadProvider->prefetchOnly = true;
+		pf = boost::make_shared<FiniteTask>();
+	}
+
+	// Install
+	int ans = installHypervisor(
+			downloadProvider,
+			keystore,
+			userInteraction,
+			pf
+		);
+
+	// Check prefetch
+	if (prefetch) {
+		if (downloadProvider->cached == 0) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: Unable to download the hypervisor installer";
+			return 3;
+		}
+		CLIOutputLine(CLI_STDERR) << "[ ok ] The hypervisor installer is now in the cache";
+		return 0;
+	}
+
+	// Don't keep an installer that failed
+	if (ans != HVE_OK) {
+		downloadProvider->evict();
+		CLIOutputLine(CLI_STDERR) << "ERROR: Unable to install hypervisor";
+		return 3;
+	}
+	return 0;
+}
+
+/**
+ * Install the hypervisor
+ */
+int handle_install_hypervisor( list<string>& args, DomainKeystore& keystore ) {
+	bool prefetch = false;
+
+	// Parse arguments
+	while (!args.empty()) {
+		string arg = args.front(); args.pop_front();
+		if (arg.compare("--prefetch") == 0) {
+			prefetch = true;
+		} else {
+			show_help("Unknown argument '" + arg + "'");
+			return 5;
+		}
+	}
+
+	// Check if there is nothing to do
+	if (!prefetch && detectHypervisor()) {
+		CLIOutputLine(CLI_STDERR) << "[ ok ] A hypervisor is already installed";
+		return 0;
+	}
+
+	return install_hypervisor( keystore, prefetch );
+}
+
+/**
+ * Session parameters that are specific to the host and not exported
+ */
+const char * LOCAL_PARAMETERS[] = { "name", "secret", "vboxid", "autosaved", NULL };
+
+/**
+ * Handle the EXPORT command
+ */
+int handle_export( list<string>& args, const string& name, const string& key ) {
+	if (!args.empty()) {
+		show_help("Unknown parameter '" + args.front() + "'");
+		return 5;
+	}
+
+	// The disks can only be copied while nothing writes on them
+	HVSessionPtr session = find_session( name );
+	session->update();
+	int state = session->local->getNum<int>( "state", -1 );
+	if ((state != SS_POWEROFF) && (state != SS_AVAILABLE)) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: The session " << name << " must be stopped before it's exported";
+		return 4;
+	}
+	string folder;
+	vector<vm_disk> disks;
+	bool hasSnapshots = false;
+	int res = read_vm_disks( session, &folder, &disks, &hasSnapshots );
+	if (res == HVE_NOT_SUPPORTED) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: Exporting sessions is not supported by this hypervisor";
+		return 3;
+	}
+	if (hasSnapshots) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: The session " << name << " has snapshots, which can not be exported";
+		return 3;
+	}
+
+	// Collect the parameters
+	map<string, string> values;
+	session->parameters->toMap( &values );
+	for (int i=0; LOCAL_PARAMETERS[i] != NULL; i++)
+		values.erase( LOCAL_PARAMETERS[i] );
+
+	// Stream the bundle
+#ifdef _WIN32
+	_setmode( _fileno(stdout), _O_BINARY );
+#endif
+	CLIBundleWriter writer( stdout, boost::thread::hardware_concurrency() );
+	res = writer.writeParameters( values );
+	for (vector<vm_disk>::iterator it = disks.begin(); (it != disks.end()) && (res == 0); ++it)
+		res = writer.writeFile( it->slot, it->path );
+	if (res == 0)
+		res = writer.finish();
+	if (res == CLI_EXIT_CANCELLED) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: The export of " << name << " was cancelled";
+		return res;
+	} else if (res != 0) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: Unable to export the session " << name;
+		return 3;
+	}
+
+	return 0;
+}
+
+/**
+ * Handle the IMPORT command
+ */
+int handle_import( list<string>& args, const string& name, const string& key ) {
+	if (!args.empty()) {
+		show_help("Unknown parameter '" + args.front() + "'");
+		return 5;
+	}
+	if (hv->type != HV_VIRTUALBOX) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: Importing sessions is not supported by this hypervisor";
+		return 3;
+	}
+
+	// The parameters come first
+#ifdef _WIN32
+	_setmode( _fileno(stdin), _O_BINARY );
+#endif
+	CLIBundleReader reader( stdin, boost::thread::hardware_concurrency() );
+	map<string, string> values;
+	if (reader.readParameters( &values ) != 0) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: The standard input is not a session bundle";
+		return 5;
+	}
+	ParameterMapPtr params = ParameterMap::instance();
+	for (map<string, string>::iterator it = values.begin(); it != values.end(); ++it)
+		params->set( (*it).first, (*it).second );
+	params->set("name", name)
+		   .set("secret", key);
+
+	// Create the session and it's VM, with empty disks
+	CLISessionLock registryLock( "", true );
+	if (!registryLock.acquire()) {
+		if (CLICancel::requested()) return CLI_EXIT_CANCELLED;
+		CLIOutputLine(CLI_STDERR) << "ERROR: The session registry is busy (used by another cernvm-cli process)";
+		return 6;
+	}
 	HVSessionPtr session = hv->sessionOpen( params, progressTask );
+	index_session( session, name );
+	registryLock.release();
+	session->stop();
+	int res = wait_session( session, CLIDeadline( CLICancel::timeoutFor("import") ) );
+	session->abort();
+	if (res != 0) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: The import of " << name << (res == CLI_EXIT_TIMEOUT ? " timed out" : " was cancelled");
+		return res;
+	}
+	string folder;
+	vector<vm_disk> disks;
+	if (read_vm_disks( session, &folder, &disks ) != 0) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: Unable to find the disks of the session " << name;
+		return 3;
+	}
+
+	// Fill the disks of the new VM. They keep the UUID of the disk
+	// they replace, so they stay registered with the hypervisor.
+	string slot, err;
+	unsigned long long size;
+	vector<string> out;
+	SysExecConfig config;
+	while (reader.nextFile( &slot, &size )) {
+		vm_disk * disk = NULL;
+		for (vector<vm_disk>::iterator it = disks.begin(); it != disks.end(); ++it)
+			if (it->slot.compare(slot) == 0) disk = &(*it);
+		if (disk == NULL) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: The session " << name << " has no disk on " << slot << " to import to";
+			return 3;
+		}
+		res = reader.extractFile( disk->path, size );
+		if (res == CLI_EXIT_CANCELLED) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: The import of " << name << " was cancelled, remove the session and try again";
+			return res;
+		} else if (res != 0) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: Unable to import " << slot << " of session " << name << ", remove the session and try again";
+			return 3;
+		}
+		if (hv_exec( hv, "internalcommands sethduuid \"" + disk->path + "\" " + disk->uuid, &out, &err, config ) != 0) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: Unable to register the imported disk " << disk->path;
+			return 3;
+		}
+	}
+	if (reader.error) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: The session bundle is corrupt, remove the session and try again";
+		return 5;
+	}
+
+	return 0;
+}
+
+/**
+ * Handle the DAEMON command
+ */
+int handle_daemon( list<string>& args ) {
+	string 	str_host="127.0.0.1", strval, arg;
+	int 	int_port=CLI_DAEMON_PORT;
+
+	while (!args.empty()) {
+		arg = args.front(); args.pop_front();
+		if (arg.compare("--listen") == 0) {
+			if (args.empty()) {
+				show_help("Missing value for the '--listen' argument");
+				return 5;
+			}
+			strval = args.front(); args.pop_front();
+			size_t pos = strval.rfind(':');
+			if (pos == string::npos) {
+				show_help("The '--listen' argument should be in <host>:<port> format");
+				return 5;
+			}
+			str_host = strval.substr(0, pos);
+			int_port = ston<int>(strval.substr(pos+1));
+		} else {
+			show_help("Unknown parameter '" + arg + "'");
+			return 5;
+		}
+	}
+
+	// Anybody that can connect can control the sessions of this host,
+	// so without a --token we make one up and keep it for our user
+	if (remoteToken.empty()) {
+		if (!daemon_generate_token( &remoteToken )) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: Unable to generate a token, please specify one with --token";
+			return 3;
+		}
+		CLIOutputLine(CLI_STDERR) << "Generated a new token in " << get_cli_data_path( CLI_DAEMON_TOKEN_FILE );
+	}
 
-	// Flush stderror (status) messages
-	cerr.flush();
+	CLIOutputLine(CLI_STDERR) << "Accepting commands on " << str_host << ":" << int_port;
+	return daemon_serve( str_host, int_port, remoteToken, selfPath );
+}
 
-    // Return parameter
-    for ( list<string>::iterator it = args.begin(); it != args.end(); ++it) {
-        string arg = *it;
-        cout << arg << "=" << session->parameters->get(arg,"<not defined>") << endl;
-    }
+/**
+ * Handle the RECLAIM command
+ */
+int handle_reclaim( list<string>& args ) {
+	int int_rate = CLI_RECLAIM_RATE;
+	string arg;
 
-    return 0;
-}
+	while (!args.empty()) {
+		arg = args.front(); args.pop_front();
+		if (arg.compare("--rate") == 0) {
+			if (args.empty()) {
+				show_help("Missing value for the '--rate' argument");
+				return 5;
+			}
+			int_rate = ston<int>( args.front() ); args.pop_front();
+		} else {
+			show_help("Unknown parameter '" + arg + "'");
+			return 5;
+		}
+	}
 
+	return reclaim_run( int_rate );
+}
 
 /**
- * Callback for handling the state change
+ * Handle a command on a single session
  */
-boost::mutex 				stateWaitMutex;
-boost::condition_variable 	stateWaitCond;
-bool 						stateWaitFlag;
-int 						stateWaitTarget;
+int handle_session_command( const string& command, list<string>& args, const string& session ) {
 
-int handle_waitstate( list<string>& args, const string& name, const string& key ) {
+	// Calculate session key
+	// TODO: Make this a bit more difficult to guess
+	string key = session;
 
-	// Try to open a session
+	// Make sure no other cernvm-cli process is working on this session.
+	// The commands that only look at the session can share the lock.
+	bool readOnly = (command.compare("snapshots") == 0) || (command.compare("waitstate") == 0) || (command.compare("export") == 0);
+	CLISessionLock sessionLock( session, !readOnly );
+	if (!sessionLock.acquire()) {
+		if (CLICancel::requested()) return CLI_EXIT_CANCELLED;
+		CLIOutputLine(CLI_STDERR) << "ERROR: The session " << session << " is busy (used by another cernvm-cli process)";
+		return 6;
+	}
+
+	// Validate session
 	ParameterMapPtr params = ParameterMap::instance();
-	params->set("name", name)
-		   .set("secret", key);
-	HVSessionPtr session = hv->sessionOpen( params, progressTask );
+	params->set("name", session)
+		   .set("secret", session);
+	int status = hv->sessionValidate( params );
+	if (status == 2) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: Could not open session " << session <<"!";
+		CLIOutputLine(CLI_STDERR) << "       (was that session created from another source?)";
+		CLIOutputLine(CLI_STDERR);
+		return 1;
+	} else if ((status != 0) && (command.compare("import") == 0)) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: The session " << session << " already exists!";
+		CLIOutputLine(CLI_STDERR);
+		return 2;
+	} else if ((status == 0) && (command.compare("setup") != 0) && (command.compare("import") != 0)) {
+		CLIOutputLine(CLI_STDERR) << "ERROR: The specified session " << session <<" does not exist!";
+		CLIOutputLine(CLI_STDERR) << "       Use the 'setup' command to initialize the session before.";
+		CLIOutputLine(CLI_STDERR);
+		return 2;
+	}
 
-	// Flush stderror (status) messages
-	cerr.flush();
+	// Handle action
+	if (command.compare("setup") == 0) { /* OPEN */
+		return handle_setup(args, session, key);
 
-	// Calculate the state target
-	stateWaitTarget = -1;
-	if (!args.empty()) {
-		string state = args.front();
-		if (state == "available") {
-			stateWaitTarget = SS_AVAILABLE;
-		} else if (state == "poweroff") {
-			stateWaitTarget = SS_POWEROFF;
-		} else if (state == "saved") {
-			stateWaitTarget = SS_SAVED;
-		} else if (state == "paused") {
-			stateWaitTarget = SS_PAUSED;
-		} else if (state == "running") {
-			stateWaitTarget = SS_RUNNING;
-		} else if (state == "missing") {
-			stateWaitTarget = SS_MISSING;
+	} else if (command.compare("stop") == 0) { /* STOP */
+		CLIMetricsTimer timer("stop");
+		return handle_stop(args, session, key);
+
+	} else if (command.compare("pause") == 0) { /* PAUSE */
+		return handle_pause(args, session, key);
+
+	} else if (command.compare("resume") == 0) { /* RESUME */
+		CLIMetricsTimer timer("resume");
+		return handle_resume(args, session, key);
+
+	} else if (command.compare("save") == 0) { /* SAVE */
+		CLIMetricsTimer timer("save");
+		return handle_save(args, session, key);
+
+	} else if (command.compare("remove") == 0) { /* REMOVE */
+		return handle_remove(args, session, key);
+
+	} else if (command.compare("snapshot") == 0) { /* TAKE SNAPSHOT */
+		return handle_snapshot(args, session, key);
+
+	} else if (command.compare("snapshots") == 0) { /* LIST SNAPSHOTS */
+		return handle_snapshots(args, session, key);
+
+    } else if (command.compare("waitstate") == 0) { /* WAIT STATE CHANGE */
+    	return handle_waitstate(args, session, key);
+
+	} else if (command.compare("export") == 0) { /* EXPORT */
+		return handle_export(args, session, key);
+
+	} else if (command.compare("import") == 0) { /* IMPORT */
+		return handle_import(args, session, key);
+
+	} else {
+		CLIOutputLine(CLI_STDERR) << "Unknown command " << command << "!";
+		show_help("");
+
+	}
+
+	// Success
+	return 0;
+
+}
+
+/**
+ * Handle a command on one of the sessions matching the label selector
+ */
+int fanout_session_command( const string& session, const string& command, const list<string>& args ) {
+
+	// Every session reports it's own progress
+	FiniteTaskPtr task = boost::make_shared<FiniteTask>();
+	CLIProgessFeedback feedback( session + ": " );
+	feedback.silent = userInteraction->silent;
+	feedback.bindTo( task );
+	sessionTask.reset( new FiniteTaskPtr(task) );
+
+	// The arguments are consumed by the handlers
+	list<string> sessionArgs( args );
+	int res = handle_session_command( command, sessionArgs, session );
+	sessionTask.reset();
+
+	// WAITSTATE returns the state
+	if (command.compare("waitstate") != 0) {
+		if (res == 0) {
+			CLIOutputLine(CLI_STDERR) << "[ ok ] " << session << ": Completed " << command;
 		} else {
-            show_help("Unknown state specified! It must be one of: available, poweroff, saved, paused, running, missing");
-            return 5;
+			CLIOutputLine(CLI_STDERR) << "[!!!!] " << session << ": Unable to " << command << " (exit code " << res << ")";
 		}
 	}
+	return res;
 
-	// Synchronize state
-	session->update();
+}
 
-	// Check if we are already on the specified state
-	int lastState = session->local->getNum<int>( "state", -1 );
-	if (lastState == stateWaitTarget) {
-		return lastState;
+/**
+ * The global options that can be sent to the daemon. They only
+ * change what the command runs on and how long it takes.
+ */
+static const char * REMOTE_OPTIONS[] = { "-l", "--selector", "-j", "--parallel", "--timeout", NULL };
+static const char * REMOTE_FLAGS[] = { "-s", "--silent", NULL };
+
+/**
+ * The rest of the global options, that only make sense locally
+ */
+static const char * LOCAL_OPTIONS[] = { "-h", "--help", "--answers", "--accept-license", "--auto-confirm", "--auto-deny",
+	"--prompt-timeout", "--wait-lock", "--no-wait", "--retries", "--retry-budget", "--record", "--replay", "--replay-speed", NULL };
+
+/**
+ * Check if the argument is one of the options in the list
+ */
+static bool option_in( const char ** options, const string& arg ) {
+	for (size_t i=0; options[i] != NULL; i++) {
+		if (arg.compare(options[i]) == 0) return true;
 	}
+	return false;
+}
 
-	// Wait for state change
-	while (true) {
-		int state = session->local->getNum<int>( "state", -1 );
-		if (state != lastState) {
-			lastState = state;
-			if ((stateWaitTarget == -1) || (stateWaitTarget == state)) {
-				break;
+/**
+ * Return how many values the global option takes if it can be used
+ * remotely, or -1 if it can't
+ */
+static int remote_option_arity( const string& arg ) {
+	if (option_in( REMOTE_OPTIONS, arg )) return 1;
+	if (option_in( REMOTE_FLAGS, arg )) return 0;
+	return -1;
+}
+
+/**
+ * The output of a command on a remote host
+ */
+struct remote_output {
+	int 			exitCode;
+	vector<string> 	lines;
+};
+
+/**
+ * Run a command on a remote host and keep it's output
+ */
+static int remote_collect( const string& host, const vector<string>& args, const string& token, map<string, remote_output> * outputs ) {
+	remote_output& output = outputs->find( host )->second;
+	output.exitCode = remote_run( host, args, token, &output.lines );
+	return output.exitCode;
+}
+
+/**
+ * Split a line of tab-separated fields
+ */
+static void split_tsv( const string& line, vector<string> * fields ) {
+	size_t start = 0, pos;
+	while ((pos = line.find('\t', start)) != string::npos) {
+		fields->push_back( line.substr(start, pos - start) );
+		start = pos + 1;
+	}
+	fields->push_back( line.substr(start) );
+}
+
+/**
+ * Run LIST, GET or WAITSTATE on many hosts and print what they
+ * return as a single table, with the host in the first column
+ */
+static int remote_merged( const vector<string>& hosts, const vector<string>& globals, vector<string> command, const string& token ) {
+	string name = command.front(), format = "table";
+	command.erase( command.begin() );
+
+	// Ask the hosts for a machine-readable table. The format the user
+	// asked for is only applied once we have all the rows.
+	vector<string> args( globals );
+	if (name.compare("waitstate") == 0) {
+		args.push_back( name );
+		args.insert( args.end(), command.begin(), command.end() );
+	} else if (name.compare("list") == 0) {
+		static const char * listArgs[] = { "get", "--all", "--format", "tsv", "cpus", "ram", "disk",
+			"apiPort", "flags", "cernvmVersion", "cernvmFlavor", "labels", NULL };
+		for (const char ** arg = listArgs; *arg != NULL; arg++)
+			args.push_back( *arg );
+	} else {
+		for (size_t i=0; i<command.size(); ) {
+			if ((command[i].compare("--format") == 0) && (i+1 < command.size())) {
+				format = command[i+1];
+				command.erase( command.begin() + i, command.begin() + i + 2 );
+			} else {
+				i++;
 			}
 		}
-		boost::this_thread::sleep(boost::posix_time::milliseconds(500));
-		session->update();
+		if ((format.compare("plain") != 0) && (format.compare("table") != 0) &&
+			(format.compare("jsonl") != 0) && (format.compare("tsv") != 0)) {
+			show_help("Unknown format specified! Should be one of: plain,table,jsonl,tsv");
+			return 5;
+		}
+		args.push_back( "get" );
+		args.push_back( "--format" );
+		args.push_back( "tsv" );
+		args.insert( args.end(), command.begin(), command.end() );
 	}
 
-	// Return
-	return lastState;
+	// Every host gets it's slot before the workers start
+	map<string, remote_output> outputs;
+	for (vector<string>::const_iterator it = hosts.begin(); it != hosts.end(); ++it)
+		outputs[*it].exitCode = 0;
+	int res = run_parallel( hosts, boost::bind(&remote_collect, _1, boost::cref(args), boost::cref(token), &outputs), hosts.size() );
+
+	// Print the errors of the hosts before the table
+	CLIOutput::flush();
+
+	// Collect the rows of all the hosts
+	vector<string> keys, rowHosts;
+	vector< map<string, string> > values;
+	for (vector<string>::const_iterator it = hosts.begin(); it != hosts.end(); ++it) {
+		const remote_output& output = outputs.find( *it )->second;
+
+		// The state we waited for is the exit code
+		if (name.compare("waitstate") == 0) {
+			if (keys.empty()) keys.push_back( "state" );
+			map<string, string> row;
+			row["name"] = command.empty() ? "" : command.front();
+			row["state"] = get_state_name( output.exitCode );
+			values.push_back( row );
+			rowHosts.push_back( *it );
+			continue;
+		}
 
+		// The first line has the names of the columns
+		if (output.lines.empty()) continue;
+		vector<string> columns;
+		split_tsv( output.lines.front(), &columns );
+		for (size_t j=1; j<columns.size(); j++) {
+			columns[j] = tsv_unescape( columns[j] );
+			if (find(keys.begin(), keys.end(), columns[j]) == keys.end())
+				keys.push_back( columns[j] );
+		}
+		for (size_t i=1; i<output.lines.size(); i++) {
+			vector<string> fields;
+			split_tsv( output.lines[i], &fields );
+			map<string, string> row;
+			row["name"] = tsv_unescape( fields[0] );
+			for (size_t j=1; (j<fields.size()) && (j<columns.size()); j++) {
+				if (fields[j].compare("\\N") != 0)
+					row[columns[j]] = tsv_unescape( fields[j] );
+			}
+			values.push_back( row );
+			rowHosts.push_back( *it );
+		}
+	}
+
+	print_parameters( format, keys, values, rowHosts );
+	return res;
 }
 
 /**
@@ -548,6 +3374,7 @@ int main( int argc, char ** argv ) {
 		show_help("");
 		return 5;
 	}
+	selfPath = get_self_path( argv[0] );
 
 	// Prepare for user interaction
 	userInteraction = boost::make_shared<CLIInteraction>();
@@ -557,16 +3384,220 @@ int main( int argc, char ** argv ) {
 	CLIProgessFeedback clifeedback;
 	clifeedback.bindTo( progressTask );
 
+	// Commands received by the daemon start with '--remote'. They run
+	// silently and after it come only the global options that are safe
+	// remotely, then the command and it's own arguments.
+	bool remote = (argc > 1) && (string(argv[1]).compare("--remote") == 0);
+	if (remote) {
+		userInteraction->silent = true;
+		clifeedback.silent = true;
+	}
+
+	// Pick the hosts to send the command to. Everything else is
+	// forwarded as-is.
+	vector<string> hosts, remoteArgs;
+	bool literal = remote;
+	for (int i=1; i<argc; i++) {
+		string arg = argv[i];
+		if (!literal && ((arg.compare("--host") == 0) || (arg.compare("--hosts") == 0) || (arg.compare("--token") == 0))) {
+			if (i+1 >= argc) {
+				show_help("Missing value for the '" + arg + "' argument");
+				return 5;
+			}
+			string value = argv[++i];
+			if (arg.compare("--host") == 0) {
+				hosts.push_back( value );
+			} else if (arg.compare("--token") == 0) {
+				remoteToken = value;
+			} else if (!read_hosts_file( value, &hosts )) {
+				CLIOutputLine(CLI_STDERR) << "ERROR: Unable to read the hosts file '" << value << "'";
+				return 5;
+			}
+			continue;
+		}
+		if (arg.compare("--") == 0)
+			literal = true;
+		remoteArgs.push_back( arg );
+	}
+
+	// Run on all the hosts at once and merge their output
+	if (!hosts.empty()) {
+		if (remoteArgs.empty()) {
+			show_help("Missing command!");
+			return 5;
+		}
+		if (remoteToken.empty() && !daemon_read_token( &remoteToken )) {
+			show_help("Missing value for the '--token' argument");
+			return 5;
+		}
+
+		// The daemon takes the global options before the command, so
+		// move them there and refuse the ones it would not accept
+		vector<string> globals, command;
+		bool literalArgs = false;
+		for (size_t i=0; i<remoteArgs.size(); i++) {
+			const string& arg = remoteArgs[i];
+			if (arg.compare("--") == 0)
+				literalArgs = true;
+			int arity = literalArgs ? -1 : remote_option_arity( arg );
+			if (arity >= 0) {
+				globals.push_back( arg );
+				if (arity > 0) {
+					if (i+1 >= remoteArgs.size()) {
+						show_help("Missing value for the '" + arg + "' argument");
+						return 5;
+					}
+					globals.push_back( remoteArgs[++i] );
+				}
+			} else if (!literalArgs && option_in( LOCAL_OPTIONS, arg )) {
+				show_help("The '" + arg + "' argument can't be used with --host");
+				return 5;
+			} else {
+				command.push_back( arg );
+			}
+		}
+		if (command.empty()) {
+			show_help("Missing command!");
+			return 5;
+		}
+		remoteArgs = globals;
+		remoteArgs.insert( remoteArgs.end(), command.begin(), command.end() );
+
+		// Every host runs the command only once
+		vector<string> uniqueHosts;
+		for (vector<string>::iterator it = hosts.begin(); it != hosts.end(); ++it) {
+			if (find(uniqueHosts.begin(), uniqueHosts.end(), *it) == uniqueHosts.end())
+				uniqueHosts.push_back( *it );
+		}
+		hosts.swap( uniqueHosts );
+
+		// Tables from many hosts are merged into one
+		CLIOutputScope outputScope;
+		string name = command.front();
+		if ((name.compare("list") == 0) || (name.compare("get") == 0) || (name.compare("waitstate") == 0))
+			return remote_merged( hosts, globals, command, remoteToken );
+		return run_parallel( hosts, boost::bind(&remote_run, _1, boost::cref(remoteArgs), boost::cref(remoteToken), (vector<string> *)NULL), hosts.size() );
+	}
+
 	// Parse arguments into vector
-    string arg;
+    string arg, recordFile, replayFile;
+    double replaySpeed = 1.0;
 	static list<string> args;
-	for (int i=1; i<argc; i++) {
+	literal = false;
+	for (int i=(remote ? 2 : 1); i<argc; i++) {
         arg = argv[i];
 
+        // Remote commands take only the safe global options, and only
+        // before the command. Everything after it belongs to the command.
+        if (remote) {
+        	if (args.empty() && (remote_option_arity(arg) < 0) && !arg.empty() && (arg[0] == '-')) {
+        		show_help("The '" + arg + "' argument can't be used remotely");
+        		return 5;
+        	}
+        	if (!args.empty() || (remote_option_arity(arg) < 0)) {
+        		args.push_back(arg);
+        		continue;
+        	}
+
+        // Everything after '--' belongs to the command
+        } else if (literal || (arg.compare("--") == 0)) {
+        	literal = true;
+        	args.push_back(arg);
+        	continue;
+        }
+
         // Take this opportunity to scan for flags
         if ((arg.compare("-h") == 0) || (arg.compare("--help") == 0)) {
             show_help("");
             return 5;
+        } else if ((arg.compare("-j") == 0) || (arg.compare("--parallel") == 0)) {
+            if (i+1 >= argc) {
+                show_help("Missing value for the '--parallel' argument");
+                return 5;
+            }
+            maxParallel = ston<int>( argv[++i] );
+        } else if ((arg.compare("--answers") == 0) || (arg.compare("--accept-license") == 0) ||
+                   (arg.compare("--auto-confirm") == 0) || (arg.compare("--auto-deny") == 0) ||
+                   (arg.compare("--prompt-timeout") == 0)) {
+            if (i+1 >= argc) {
+                show_help("Missing value for the '" + arg + "' argument");
+                return 5;
+            }
+            string value = argv[++i];
+            if (arg.compare("--answers") == 0) {
+                if (!userInteraction->loadAnswers(value)) {
+                    CLIOutputLine(CLI_STDERR) << "ERROR: Unable to load the answers file '" << value << "'";
+                    return 5;
+                }
+            } else if (arg.compare("--accept-license") == 0) {
+                userInteraction->addRule( CLI_PROMPT_LICENSE, value, UI_OK );
+            } else if (arg.compare("--auto-confirm") == 0) {
+                userInteraction->addRule( CLI_PROMPT_CONFIRM, value, UI_OK );
+            } else if (arg.compare("--auto-deny") == 0) {
+                userInteraction->addRule( CLI_PROMPT_ANY, value, UI_CANCEL );
+            } else {
+                userInteraction->timeout = ston<int>( value );
+            }
+        } else if (arg.compare("--wait-lock") == 0) {
+            if (i+1 >= argc) {
+                show_help("Missing value for the '--wait-lock' argument");
+                return 5;
+            }
+            CLISessionLock::waitTimeout = ston<int>( argv[++i] );
+        } else if (arg.compare("--timeout") == 0) {
+            if (i+1 >= argc) {
+                show_help("Missing value for the '--timeout' argument");
+                return 5;
+            }
+            string value = argv[++i];
+            size_t pos = value.find('=');
+            if (pos == string::npos) {
+                CLICancel::timeout = ston<int>( value );
+            } else {
+                CLICancel::commandTimeouts[ value.substr(0, pos) ] = ston<int>( value.substr(pos+1) );
+            }
+        } else if ((arg.compare("--retries") == 0) || (arg.compare("--retry-budget") == 0)) {
+            if (i+1 >= argc) {
+                show_help("Missing value for the '" + arg + "' argument");
+                return 5;
+            }
+            int value = ston<int>( argv[++i] );
+            if (value < 0) {
+                show_help("The '" + arg + "' argument can't be negative");
+                return 5;
+            }
+            if (arg.compare("--retries") == 0) {
+                CLIRetry::retries = value;
+            } else {
+                CLIRetry::budget = value;
+            }
+        } else if ((arg.compare("-l") == 0) || (arg.compare("--selector") == 0)) {
+            if (i+1 >= argc) {
+                show_help("Missing value for the '" + arg + "' argument");
+                return 5;
+            }
+            string label = argv[++i];
+            if (!label_valid(label)) {
+                show_help("The selector '" + label + "' should be in <key>=<value> format");
+                return 5;
+            }
+            labelSelector.push_back( label );
+        } else if ((arg.compare("--record") == 0) || (arg.compare("--replay") == 0) || (arg.compare("--replay-speed") == 0)) {
+            if (i+1 >= argc) {
+                show_help("Missing value for the '" + arg + "' argument");
+                return 5;
+            }
+            if (arg.compare("--record") == 0) {
+                recordFile = argv[++i];
+            } else if (arg.compare("--replay") == 0) {
+                replayFile = argv[++i];
+            } else {
+                replaySpeed = atof( argv[++i] );
+            }
+        } else if ((arg.compare("--host") == 0) || (arg.compare("--hosts") == 0) || (arg.compare("--token") == 0)) {
+            i++;
+        } else if (arg.compare("--no-wait") == 0) {
+            CLISessionLock::waitTimeout = 0;
         } else if ((arg.compare("-s") == 0) || (arg.compare("--silent") == 0)) {
         	userInteraction->silent = true;
         	clifeedback.silent = true;
@@ -583,34 +3614,58 @@ int main( int argc, char ** argv ) {
 	}
 	command = args.front(); args.pop_front();
 
+	// Completion is used on every key press, so it never touches the hypervisor
+	if (command.compare("completion") == 0) {
+		return handle_completion(args);
+	}
+
+	// From now on the terminal is owned by the output thread
+	CLIOutputScope outputScope;
+
+	// Let Ctrl-C cancel the operations cleanly. The exporter and the
+	// daemon have nothing to clean up, so they are simply killed like before.
+	if ((command.compare("exporter") != 0) && (command.compare("daemon") != 0)) {
+		CLICancel::install();
+	}
+
 	// Initialize cryptographic keystore
 	DomainKeystore::Initialize();
 	DomainKeystore keystore;
 
     // Synchronize keystore (if it's nessecary)
-    res = keystore.updateAuthorizedKeystore( DownloadProvider::Default() );
+    res = replayFile.empty() ? keystore.updateAuthorizedKeystore( DownloadProvider::Default() ) : HVE_OK;
     if (res != HVE_OK) {
-		cerr << "ERROR: Could not initialize the cryptographic keystore." << endl;
+		CLIOutputLine(CLI_STDERR) << "ERROR: Could not initialize the cryptographic keystore.";
 		return 3;
     }
 
+	// Install hypervisor on request
+	if (command.compare("install-hypervisor") == 0) {
+		return handle_install_hypervisor(args, keystore);
+	} else if (command.compare("reclaim") == 0) {
+		return handle_reclaim(args);
+	} else if (command.compare("daemon") == 0) {
+		return handle_daemon(args);
+	}
+
 	// Create a hypervisor instance
-	hv = detectHypervisor();
+	if (!replayFile.empty()) {
+		hv = replay_hypervisor( replayFile, replaySpeed );
+		if (!hv) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: Unable to load the recording '" << replayFile << "'";
+			return 5;
+		}
+	} else {
+		hv = detectHypervisor();
+	}
 	if (!hv) {
 		if (userInteraction->confirm("No hypervisor found", "Would you like to auto-install VirtualBox in your system?") == UI_OK) {
-			int ans = installHypervisor(
-					DownloadProvider::Default(),
-					keystore,
-					userInteraction,
-					progressTask
-				);
-			if (ans != HVE_OK) {
-				cerr << "ERROR: Unable to install hypervisor" << endl;
+			if (install_hypervisor( keystore, false ) != 0) {
 				return 3;
 			} else {
 				hv = detectHypervisor();
 				if (!hv) {				
-					cerr << "ERROR: Could not detect hypervisor even after installation. Sorry." << endl;
+					CLIOutputLine(CLI_STDERR) << "ERROR: Could not detect hypervisor even after installation. Sorry.";
 					return 3;
 				}
 			}
@@ -619,13 +3674,71 @@ int main( int argc, char ** argv ) {
 		}
 	}
 
+	// Log everything we ask from the hypervisor
+	if (!recordFile.empty()) {
+		hv = record_hypervisor( hv, recordFile );
+		if (!hv) {
+			CLIOutputLine(CLI_STDERR) << "ERROR: Unable to write the recording '" << recordFile << "'";
+			return 5;
+		}
+	}
+
 	// Initialize hypervisor
 	hv->setUserInteraction( userInteraction );
 	hv->waitTillReady( keystore, progressTask, userInteraction );
 
+	// Keep the shell completion up to date with what we found. If the registry
+	// is busy, the process holding it will update the cache anyway.
+	{
+		CLISessionLock registryLock( "", true );
+		if (registryLock.acquire(0))
+			update_session_cache();
+	}
+
 	// Handle commands wihtout parameters
 	if (command.compare("list") == 0) { /* LIST */
 		return handle_list(args);	
+	} else if (command.compare("exporter") == 0) { /* EXPORTER */
+		return handle_exporter(args);
+	} else if (command.compare("images") == 0) { /* IMAGE CACHE */
+		return handle_images(args);
+    } else if (command.compare("get") == 0) { /* GET PARAMETER */
+        return handle_get(args);
+    } else if (command.compare("set") == 0) { /* SET PARAMETER */
+        return handle_set(args);
+    } else if (command.compare("restore") == 0) { /* RESTORE SNAPSHOT */
+        return handle_restore(args);
+	} else if (command.compare("start") == 0) { /* START */
+		return handle_start(args);
+	} else if (command.compare("autosave") == 0) { /* SAVE IDLE SESSIONS */
+		return handle_autosave(args);
+	} else if (command.compare("stats") == 0) { /* RESOURCE USAGE */
+		return handle_stats(args);
+	} else if (command.compare("logs") == 0) { /* HYPERVISOR LOGS */
+		return handle_logs(args);
+	} else if (command.compare("exec") == 0) { /* EXECUTE COMMAND */
+		return handle_exec(args);
+	} else if (command.compare("push") == 0) { /* COPY TO GUEST */
+		return handle_transfer(args, true);
+	} else if (command.compare("pull") == 0) { /* COPY FROM GUEST */
+		return handle_transfer(args, false);
+	}
+
+	// With a label selector (or 'remove --all'), run the command on every matching session
+	bool removeAll = (command.compare("remove") == 0) && (find( args.begin(), args.end(), "--all" ) != args.end());
+	bool singleSession = (command.compare("setup") == 0) || (command.compare("import") == 0) || (command.compare("export") == 0);
+	if ((!labelSelector.empty() || removeAll) && !singleSession) {
+		args.remove( "--all" );
+		vector<string> names;
+		res = resolve_sessions( names, true );
+		if (res != 0) return res;
+		if (names.size() == 1) {
+			res = handle_session_command( command, args, names[0] );
+		} else {
+			res = run_parallel( names, boost::bind(&fanout_session_command, _1, boost::cref(command), boost::cref(args)), maxParallel );
+		}
+		start_reclaimer();
+		return res;
 	}
 
 	// Handle cases where a session name is needed
@@ -641,62 +3754,8 @@ int main( int argc, char ** argv ) {
 		return 5;
 	}
 
-	// Calculate session key
-	// TODO: Make this a bit more difficult to guess
-	string key = session;
-
-	// Validate session
-	ParameterMapPtr params = ParameterMap::instance();
-	params->set("name", session)
-		   .set("secret", session);
-	int status = hv->sessionValidate( params );
-	if (status == 2) {
-		cerr << "ERROR: Could not open session " << session <<"!" << endl;
-		cerr << "       (was that session created from another source?)" << endl;
-		cerr << endl;
-		return 1;
-	} else if ((status == 0) && (command.compare("setup") != 0)) {
-		cerr << "ERROR: The specified session " << session <<" does not exist!" << endl;
-		cerr << "       Use the 'setup' command to initialize the session before." << endl;
-		cerr << endl;
-		return 2;
-	}
-
-	// Handle action
-	if (command.compare("setup") == 0) { /* OPEN */
-		return handle_setup(args, session, key);
-
-	} else if (command.compare("start") == 0) { /* START */
-		return handle_start(args, session, key);
-
-	} else if (command.compare("stop") == 0) { /* STOP */
-		return handle_stop(args, session, key);
-
-	} else if (command.compare("pause") == 0) { /* PAUSE */
-		return handle_pause(args, session, key);
-
-	} else if (command.compare("resume") == 0) { /* RESUME */
-		return handle_resume(args, session, key);
-
-	} else if (command.compare("save") == 0) { /* SAVE */
-		return handle_save(args, session, key);
-
-	} else if (command.compare("remove") == 0) { /* REMOVE */
-		return handle_remove(args, session, key);
-
-    } else if (command.compare("get") == 0) { /* GET PARAMETER */
-        return handle_get(args, session, key);
-
-    } else if (command.compare("waitstate") == 0) { /* WAIT STATE CHANGE */
-    	return handle_waitstate(args, session, key);
-
-	} else {
-		cerr << "Unknown command " << arg << "!" << endl;
-		show_help("");
-
-	}
+	res = handle_session_command( command, args, session );
+	start_reclaimer();
+	return res;
 
-	// Success
-	return 0;
-	
 }
\ No newline at end of file
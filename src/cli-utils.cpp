@@ -19,8 +19,24 @@
  */
 
 #include <cli-utils.h>
+#include "CLIOutput.h"
 #include <CernVM/Hypervisor.h>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
 #include <vector>
+#include <stdio.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #ifdef _WIN32
 #include <Searchapi.h>
@@ -100,7 +116,7 @@ void open_ssh( const string& host, const int port, const string& user ) {
     // Locate PuTTY
     string putty = findPuTTY();
     if (putty.empty()) {
-    	cout << "You can now use your SSH client to connect to: " << host << ":" << port << endl;
+    	CLIOutputLine(CLI_STDOUT) << "You can now use your SSH client to connect to: " << host << ":" << port;
         return;
     }
 
@@ -129,7 +145,7 @@ void open_ssh( const string& host, const int port, const string& user ) {
        &si,
        &pi )
     ) {
-        cout << "Could not start PuTTY, but you can now use any SSH client to connect to: " << host << ":" << port << endl;
+        CLIOutputLine(CLI_STDOUT) << "Could not start PuTTY, but you can now use any SSH client to connect to: " << host << ":" << port;
         return;
     }
 
@@ -143,6 +159,127 @@ void open_ssh( const string& host, const int port, const string& user ) {
 #endif
 }
 
+/**
+ * Quote a string for the shell
+ */
+string shell_quote( const string& str ) {
+	string ans = "'";
+	for (size_t i=0; i<str.length(); i++) {
+		if (str[i] == '\'') {
+			ans += "'\\''";
+		} else {
+			ans += str[i];
+		}
+	}
+	return ans + "'";
+}
+
+/**
+ * Build the ssh command-line for the multiplexed connection
+ */
+string ssh_command( const string& host, const int port, const string& user, const string& controlPath, const int persist ) {
+	ostringstream oss;
+
+	// The first call spawns the master connection in the background
+	// and the following ones only open a new channel over it.
+	oss << "/usr/bin/ssh -o LogLevel=ERROR";
+
+	// The VM gets new host keys every time it's set up, so there is nothing
+	// to verify on the port forwarded to the loopback interface. Any other
+	// address is checked against the known hosts like normal.
+	if ((host.compare("localhost") == 0) || (host.compare("::1") == 0) || (host.compare(0, 4, "127.") == 0))
+		oss << " -o \"UserKnownHostsFile /dev/null\" -o StrictHostKeyChecking=no";
+
+	oss << " -o ControlMaster=auto -o " << shell_quote("ControlPath=" + controlPath)
+		<< " -o ControlPersist=" << persist
+		<< " -p " << port << " " << user << "@" << host;
+	return oss.str();
+}
+
+/**
+ * Run a command over a multiplexed SSH connection
+ */
+int ssh_exec( const string& host, const int port, const string& user, const string& controlPath, const int persist, const string& command, const lineCallback& onLine ) {
+#ifdef _WIN32
+	CLIOutputLine(CLI_STDERR) << "ERROR: Running commands over SSH is not supported on this platform";
+	return -1;
+#else
+	string cmdline = ssh_command( host, port, user, controlPath, persist ) + " -- " + command;
+
+	// Interactive mode
+	if (onLine.empty())
+		return shell_exec( cmdline );
+
+	// Capture output
+	FILE * f = popen( (cmdline + " 2>&1").c_str(), "r" );
+	if (f == NULL) return -1;
+	char buf[4096];
+	string line;
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		line += buf;
+		if (line[line.length()-1] == '\n') {
+			onLine( line.substr(0, line.length()-1) );
+			line = "";
+		}
+	}
+	if (!line.empty()) onLine( line );
+
+	int status = pclose( f );
+	if ((status == -1) || !WIFEXITED(status)) return -1;
+	return WEXITSTATUS(status);
+#endif
+}
+
+/**
+ * Run a shell command-line
+ */
+int shell_exec( const string& cmdline ) {
+	int status = system( cmdline.c_str() );
+#ifdef _WIN32
+	return status;
+#else
+	if ((status == -1) || !WIFEXITED(status)) return -1;
+	return WEXITSTATUS(status);
+#endif
+}
+
+/**
+ * Run a shell command-line and capture it's standard output
+ */
+int shell_capture( const string& cmdline, string * output ) {
+#ifdef _WIN32
+	return -1;
+#else
+	FILE * f = popen( cmdline.c_str(), "r" );
+	if (f == NULL) return -1;
+	char buf[4096];
+	size_t len;
+	output->clear();
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+		output->append( buf, len );
+	}
+	int status = pclose( f );
+	if ((status == -1) || !WIFEXITED(status)) return -1;
+	return WEXITSTATUS(status);
+#endif
+}
+
+/**
+ * Run a shell command-line, feeding data to it's standard input
+ */
+int shell_feed( const string& cmdline, const string& input ) {
+#ifdef _WIN32
+	return -1;
+#else
+	FILE * f = popen( cmdline.c_str(), "w" );
+	if (f == NULL) return -1;
+	fwrite( input.c_str(), 1, input.length(), f );
+	int status = pclose( f );
+	if ((status == -1) || !WIFEXITED(status)) return -1;
+	return WEXITSTATUS(status);
+#endif
+}
+
 /**
  * Identify who's the first user in the context specified
  */
@@ -192,4 +329,302 @@ string get_user_from_context( const string& context_id, DownloadProviderPtr down
 	// Return username
 	return userName;
 
-}
\ No newline at end of file
+}
+
+/**
+ * Return the path to a file in the CLI state directory
+ */
+string get_cli_data_path( const string& filename ) {
+	string dir = getAppDataPath() + "/cli";
+
+	// Make sure the directory exists
+#ifdef _WIN32
+	_mkdir( dir.c_str() );
+#else
+	mkdir( dir.c_str(), 0700 );
+#endif
+
+	// Return the full path
+	return dir + "/" + filename;
+
+}
+
+/**
+ * Convert a session state to it's name
+ */
+string get_state_name( const int state ) {
+	switch (state) {
+		case SS_MISSING: 	return "missing";
+		case SS_AVAILABLE: 	return "available";
+		case SS_POWEROFF: 	return "poweroff";
+		case SS_SAVED: 		return "saved";
+		case SS_PAUSED: 	return "paused";
+		case SS_RUNNING: 	return "running";
+		default: 			return "unknown";
+	}
+}
+
+/**
+ * Wildcard matching with '*' and '?'
+ */
+bool match_pattern( const string& pattern, const string& str ) {
+	size_t p = 0, s = 0, star = string::npos, mark = 0;
+	while (s < str.length()) {
+		if ((p < pattern.length()) && ((pattern[p] == '?') || (pattern[p] == str[s]))) {
+			p++; s++;
+		} else if ((p < pattern.length()) && (pattern[p] == '*')) {
+			// Remember the star position and try to match nothing
+			star = p++;
+			mark = s;
+		} else if (star != string::npos) {
+			// Backtrack and let the last star eat one more character
+			p = star + 1;
+			s = ++mark;
+		} else {
+			return false;
+		}
+	}
+	// Skip trailing stars
+	while ((p < pattern.length()) && (pattern[p] == '*')) p++;
+	return (p == pattern.length());
+}
+
+/**
+ * Check if the string contains wildcard characters
+ */
+bool has_wildcards( const string& str ) {
+	return (str.find_first_of("*?") != string::npos);
+}
+
+/**
+ * Escape a string for JSON
+ */
+string json_escape( const string& str ) {
+	ostringstream oss;
+	for (size_t i=0; i<str.length(); i++) {
+		unsigned char c = str[i];
+		switch (c) {
+			case '"': 	oss << "\\\""; break;
+			case '\\': 	oss << "\\\\"; break;
+			case '\n': 	oss << "\\n"; break;
+			case '\r': 	oss << "\\r"; break;
+			case '\t': 	oss << "\\t"; break;
+			default:
+				if (c < 0x20) {
+					oss << "\\u00" << "0123456789abcdef"[c >> 4] << "0123456789abcdef"[c & 0xf];
+				} else {
+					oss << c;
+				}
+		}
+	}
+	return oss.str();
+}
+
+/**
+ * Escape a string for a tab-separated field
+ */
+string tsv_escape( const string& str ) {
+	string ans;
+	for (size_t i=0; i<str.length(); i++) {
+		switch (str[i]) {
+			case '\\': 	ans += "\\\\"; break;
+			case '\t': 	ans += "\\t"; break;
+			case '\n': 	ans += "\\n"; break;
+			case '\r': 	ans += "\\r"; break;
+			default: 	ans += str[i];
+		}
+	}
+	return ans;
+}
+
+/**
+ * Unescape a tab-separated field
+ */
+string tsv_unescape( const string& str ) {
+	string ans;
+	for (size_t i=0; i<str.length(); i++) {
+		if ((str[i] != '\\') || (i+1 >= str.length())) {
+			ans += str[i];
+			continue;
+		}
+		switch (str[++i]) {
+			case 't': 	ans += '\t'; break;
+			case 'n': 	ans += '\n'; break;
+			case 'r': 	ans += '\r'; break;
+			default: 	ans += str[i];
+		}
+	}
+	return ans;
+}
+
+/**
+ * Encode a name so it can be used as a filename
+ */
+string encode_filename( const string& name ) {
+	static const char * hex = "0123456789abcdef";
+	string ans;
+	for (size_t i=0; i<name.length(); i++) {
+		unsigned char c = name[i];
+		if (isalnum(c) || (c == '-') || (c == '_') || (c == '.')) {
+			ans += c;
+		} else {
+			ans += '%';
+			ans += hex[c >> 4];
+			ans += hex[c & 0xf];
+		}
+	}
+	return ans;
+}
+
+/**
+ * Parse a duration in seconds
+ */
+int parse_duration( const string& str ) {
+	if (str.empty()) return -1;
+
+	// Check the unit
+	int mult = 1;
+	string num = str;
+	switch (str[str.length()-1]) {
+		case 's': mult = 1; break;
+		case 'm': mult = 60; break;
+		case 'h': mult = 3600; break;
+		case 'd': mult = 86400; break;
+		default:
+			if (!isdigit(str[str.length()-1])) return -1;
+	}
+	if (!isdigit(str[str.length()-1]))
+		num = str.substr( 0, str.length()-1 );
+
+	// Check the number
+	if (num.empty() || (num.find_first_not_of("0123456789") != string::npos)) return -1;
+	return ston<int>( num ) * mult;
+}
+
+/**
+ * Start a program in the background
+ */
+int spawn_detached( const string& program, const vector<string>& args ) {
+#ifdef _WIN32
+	string cmdline = "\"" + program + "\"";
+	for (vector<string>::const_iterator it = args.begin(); it != args.end(); ++it)
+		cmdline += " \"" + *it + "\"";
+
+	STARTUPINFO si;
+	PROCESS_INFORMATION pi;
+	ZeroMemory( &si, sizeof(si) );
+	si.cb = sizeof(si);
+	ZeroMemory( &pi, sizeof(pi) );
+	if (!CreateProcess( program.c_str(), const_cast<char *>(cmdline.c_str()), NULL, NULL, FALSE,
+			DETACHED_PROCESS | CREATE_NEW_PROCESS_GROUP, NULL, NULL, &si, &pi ))
+		return -1;
+	CloseHandle( pi.hProcess );
+	CloseHandle( pi.hThread );
+	return 0;
+#else
+	// Prepare the arguments before forking
+	vector<char *> argv;
+	argv.push_back( const_cast<char *>(program.c_str()) );
+	for (vector<string>::const_iterator it = args.begin(); it != args.end(); ++it)
+		argv.push_back( const_cast<char *>(it->c_str()) );
+	argv.push_back( NULL );
+
+	pid_t pid = fork();
+	if (pid < 0) return -1;
+	if (pid == 0) {
+		// Fork again so the program is not our child
+		setsid();
+		if (fork() != 0) _exit(0);
+		int fd = open( "/dev/null", O_RDWR );
+		if (fd >= 0) {
+			dup2( fd, 0 ); dup2( fd, 1 ); dup2( fd, 2 );
+			if (fd > 2) close( fd );
+		}
+
+		// Don't pass on anything else we have open (like lock files)
+		long maxFd = sysconf( _SC_OPEN_MAX );
+		if ((maxFd < 0) || (maxFd > 65536)) maxFd = 65536;
+		for (int i=3; i<maxFd; i++)
+			close( i );
+		execv( program.c_str(), &argv[0] );
+		_exit(127);
+	}
+
+	// Reap the intermediate child
+	int status;
+	waitpid( pid, &status, 0 );
+	return 0;
+#endif
+}
+
+/**
+ * Return the path of the running executable
+ */
+string get_self_path( const string& argv0 ) {
+#ifdef _WIN32
+	char buf[MAX_PATH];
+	DWORD len = GetModuleFileNameA( NULL, buf, sizeof(buf) );
+	if ((len > 0) && (len < sizeof(buf)))
+		return string( buf, len );
+#elif defined(__linux__)
+	char buf[4096];
+	ssize_t len = readlink( "/proc/self/exe", buf, sizeof(buf) );
+	if ((len > 0) && (len < (ssize_t)sizeof(buf)))
+		return string( buf, len );
+#endif
+	return argv0;
+}
+
+/**
+ * Shared state between the run_parallel workers
+ */
+struct parallel_context {
+	const vector<string> * 	items;
+	const parallelAction * 	action;
+	vector<int> 			results;
+	size_t 					next;
+	boost::mutex 			mutex;
+};
+
+/**
+ * Worker thread that picks the next available item
+ */
+void parallel_worker( parallel_context * ctx ) {
+	while (true) {
+		size_t i;
+		{
+			boost::mutex::scoped_lock lock(ctx->mutex);
+			if (ctx->next >= ctx->items->size()) return;
+			i = ctx->next++;
+		}
+		ctx->results[i] = (*ctx->action)( (*ctx->items)[i] );
+	}
+}
+
+/**
+ * Run the action for every item in parallel
+ */
+int run_parallel( const vector<string>& items, const parallelAction& action, int maxThreads ) {
+	parallel_context ctx;
+	ctx.items = &items;
+	ctx.action = &action;
+	ctx.results.resize( items.size(), 0 );
+	ctx.next = 0;
+
+	// Don't spawn more threads than we need
+	size_t numThreads = (maxThreads < 1) ? 1 : maxThreads;
+	if (numThreads > items.size()) numThreads = items.size();
+
+	// Run and wait for completion
+	boost::thread_group threads;
+	for (size_t i=0; i<numThreads; i++) {
+		threads.create_thread( boost::bind(&parallel_worker, &ctx) );
+	}
+	threads.join_all();
+
+	// Return the first error
+	for (size_t i=0; i<ctx.results.size(); i++) {
+		if (ctx.results[i] != 0) return ctx.results[i];
+	}
+	return 0;
+}
@@ -25,9 +25,12 @@
 #include <CernVM/Utilities.h>
 #include <CernVM/DownloadProvider.h>
 
+#include <boost/function.hpp>
+
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 using namespace std;
 
@@ -36,9 +39,123 @@ using namespace std;
  */
 void open_ssh( const string& host, const int port, const string& user );
 
+/**
+ * Callback that receives the output of a command line-by-line
+ */
+typedef boost::function< void ( const string& ) > 	lineCallback;
+
+/**
+ * Run a command over SSH, re-using a multiplexed master connection
+ * that stays open for 'persist' seconds after the last command.
+ *
+ * If onLine is empty the command inherits the standard input/output,
+ * otherwise each line of the output is passed to it.
+ *
+ * Returns the exit code of the command, or -1 if it could not be run.
+ */
+int ssh_exec( const string& host, const int port, const string& user, const string& controlPath, const int persist, const string& command, const lineCallback& onLine );
+
+/**
+ * Build the ssh command-line (without the remote command) that uses the
+ * same multiplexed master connection as ssh_exec
+ */
+string ssh_command( const string& host, const int port, const string& user, const string& controlPath, const int persist );
+
+/**
+ * Run a shell command-line, returning it's exit code or -1 on error
+ */
+int shell_exec( const string& cmdline );
+
+/**
+ * Run a shell command-line and capture it's (binary) standard output
+ */
+int shell_capture( const string& cmdline, string * output );
+
+/**
+ * Run a shell command-line, feeding the given data to it's standard input
+ */
+int shell_feed( const string& cmdline, const string& input );
+
+/**
+ * Quote a string so it's passed as a single argument through the shell
+ */
+string shell_quote( const string& str );
+
 /**
  * Get User name from the context ID provided
  */
 string get_user_from_context( const string& context_id, DownloadProviderPtr downloadProvider );
 
+/**
+ * Return the full path to a file in the CLI state directory, creating
+ * the directory if it does not exist.
+ */
+string get_cli_data_path( const string& filename );
+
+/**
+ * Return the human-readable name of a session state (SS_* constant)
+ */
+string get_state_name( const int state );
+
+/**
+ * Check if the string matches the given wildcard pattern ('*' and '?')
+ */
+bool match_pattern( const string& pattern, const string& str );
+
+/**
+ * Check if the string contains wildcard characters
+ */
+bool has_wildcards( const string& str );
+
+/**
+ * Escape a string so it can be placed in a JSON document
+ */
+string json_escape( const string& str );
+
+/**
+ * Escape a string so it can be placed in a tab-separated field
+ */
+string tsv_escape( const string& str );
+
+/**
+ * Reverse tsv_escape
+ */
+string tsv_unescape( const string& str );
+
+/**
+ * Encode a name so it can be used as a filename. Anything other than
+ * letters, digits, '-', '_' and '.' is %-encoded.
+ */
+string encode_filename( const string& name );
+
+/**
+ * Parse a duration like 90, 90s, 15m, 2h or 1d into seconds.
+ * Returns -1 if it's not valid.
+ */
+int parse_duration( const string& str );
+
+/**
+ * Start a program in the background, detached from the terminal and
+ * from this process. Returns 0 if it was started.
+ */
+int spawn_detached( const string& program, const vector<string>& args );
+
+/**
+ * Return the path of the running executable ('argv0' if unknown)
+ */
+string get_self_path( const string& argv0 );
+
+/**
+ * An action to be performed on a single item by run_parallel
+ */
+typedef boost::function< int ( const string& ) > 	parallelAction;
+
+/**
+ * Run the action for every item, using up to maxThreads concurrent threads.
+ *
+ * Returns 0 if all the actions succeeded, otherwise the return code of
+ * the first item that failed.
+ */
+int run_parallel( const vector<string>& items, const parallelAction& action, int maxThreads );
+
 #endif /* end of include guard: CLI_UTILS_H */